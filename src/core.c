@@ -1,5 +1,7 @@
 #include "core.h"
 #include "nes_apu.h"
+#include "nes_cart.h"
+#include "nes_romdb.h"
 #include "error.h"
 #include "errcodes.h"
 
@@ -11,16 +13,303 @@
 
 #include "core_callbacks.h"
 
+// battery saves
+
+// writer thread: waits for snapshots and puts them on disk
+static int core_saver_thread(void *psaver) {
+  core_saver_t *sv = psaver;
+
+  for (;;) {
+    SDL_SemWait(sv->sem);
+
+    SDL_LockMutex(sv->lock);
+    if (sv->pending) {
+      nes_cart_write_save(sv->fname, sv->buf, sv->size);
+      sv->pending = 0;
+    }
+    SDL_UnlockMutex(sv->lock);
+
+    if (!SDL_AtomicGet(&sv->run))
+      return 0;
+  }
+}
+
+static inline void core_saver_cleanup(core_saver_t *sv) {
+  free(sv->buf);
+  if (sv->sem) SDL_DestroySemaphore(sv->sem);
+  if (sv->lock) SDL_DestroyMutex(sv->lock);
+  *sv = (core_saver_t){0};
+}
+
+// starts the writer thread if the cart has a battery save
+// without it, the final save on unload is all there is
+static inline void core_saver_start(core_t *core) {
+  core_saver_t *sv = &core->saver;
+  nes_t *nes = &core->nes;
+
+  if (!nes->cart.sav_fname)
+    return;
+
+  sv->fname = nes->cart.sav_fname;
+  sv->size = nes->mem.prgram_size;
+  sv->buf = malloc(sv->size);
+  sv->sem = SDL_CreateSemaphore(0);
+  sv->lock = SDL_CreateMutex();
+  sv->last = SDL_GetTicks();
+  SDL_AtomicSet(&sv->run, 1);
+
+  if (sv->buf && sv->sem && sv->lock)
+    sv->thread = SDL_CreateThread(core_saver_thread, "saver", sv);
+
+  if (!sv->thread) {
+    core_saver_cleanup(sv);
+    error_log_write("Could not start the save writer, "
+                    "saving on exit only\n");
+  }
+}
+
+// lets the writer thread finish whatever is pending and stops it
+static inline void core_saver_stop(core_saver_t *sv) {
+  if (!sv->thread)
+    return;
+
+  SDL_AtomicSet(&sv->run, 0);
+  SDL_SemPost(sv->sem);
+  SDL_WaitThread(sv->thread, NULL);
+  core_saver_cleanup(sv);
+}
+
+// called after each frame on the emulation thread
+// hands a PRG-RAM snapshot to the writer at most once per CORE_SAVE_INTERVAL;
+// writes in between coalesce into the next snapshot, and if the writer is
+// busy with the last one we just try again next frame instead of waiting
+static inline void core_save_poll(core_t *core) {
+  core_saver_t *sv = &core->saver;
+
+  if (!sv->thread || !nes_cart_save_dirty(&core->nes))
+    return;
+
+  uint32_t now = SDL_GetTicks();
+  if (now - sv->last < CORE_SAVE_INTERVAL)
+    return;
+
+  if (SDL_TryLockMutex(sv->lock) != 0)
+    return;
+
+  nes_cart_save_snapshot(&core->nes, sv->buf);
+  sv->pending = 1;
+  SDL_UnlockMutex(sv->lock);
+
+  sv->last = now;
+  SDL_SemPost(sv->sem);
+}
+
+// deferred drawing
+
+// drawing thread: draws bands of logged lines as they are handed out
+static int core_render_thread(void *prender) {
+  core_render_t *rd = prender;
+
+  for (;;) {
+    SDL_SemWait(rd->jobs);
+
+    if (!SDL_AtomicGet(&rd->run))
+      return 0;
+
+    int band = SDL_AtomicAdd(&rd->next, 1);
+    nes_ppu_draw_lines(rd->ppu, band * CORE_RENDER_BAND, CORE_RENDER_BAND);
+    SDL_SemPost(rd->done);
+  }
+}
+
+// called by the PPU on the emulation thread when line y is logged
+static void core_render_line(void *prender, int y) {
+  core_render_t *rd = prender;
+
+  if (y % CORE_RENDER_BAND != CORE_RENDER_BAND - 1)
+    return;
+
+  rd->posted++;
+  SDL_SemPost(rd->jobs);
+}
+
+// called by the PPU at vblank, waits until the frame's bands are drawn
+static void core_render_sync(void *prender) {
+  core_render_t *rd = prender;
+
+  for (; rd->posted > 0; rd->posted--)
+    SDL_SemWait(rd->done);
+  SDL_AtomicSet(&rd->next, 0);
+}
+
+// stops the drawing threads, the PPU goes back to drawing by itself
+static inline void core_render_stop(core_t *core) {
+  core_render_t *rd = &core->render;
+
+  if (rd->ppu)
+    nes_ppu_defer(rd->ppu, NULL, NULL, NULL);
+
+  SDL_AtomicSet(&rd->run, 0);
+  for (int i = 0; i < rd->count; ++i)
+    SDL_SemPost(rd->jobs);
+  for (int i = 0; i < rd->count; ++i)
+    SDL_WaitThread(rd->thread[i], NULL);
+
+  if (rd->jobs) SDL_DestroySemaphore(rd->jobs);
+  if (rd->done) SDL_DestroySemaphore(rd->done);
+  *rd = (core_render_t){0};
+}
+
+// starts count drawing threads and has the PPU hand lines over to them
+static inline void core_render_start(core_t *core, int count) {
+  core_render_t *rd = &core->render;
+
+  if (count > CORE_RENDER_MAX)
+    count = CORE_RENDER_MAX;
+
+  rd->jobs = SDL_CreateSemaphore(0);
+  rd->done = SDL_CreateSemaphore(0);
+  SDL_AtomicSet(&rd->run, 1);
+
+  if (rd->jobs && rd->done) {
+    for (; rd->count < count; ++rd->count) {
+      rd->thread[rd->count] =
+        SDL_CreateThread(core_render_thread, "render", rd);
+      if (!rd->thread[rd->count])
+        break;
+    }
+  }
+
+  if (!rd->count || nes_ppu_defer(&core->nes.ppu, core_render_line,
+                                  core_render_sync, rd)) {
+    core_render_stop(core);
+    error_log_write("Could not start the drawing threads, "
+                    "drawing on the emulation thread\n");
+    return;
+  }
+
+  rd->ppu = &core->nes.ppu;
+}
+
+// sound synthesis
+
+// runs whatever the APU queued and passes the samples on to SDL
+static inline void core_synth_drain(core_t *core) {
+  nes_apu_queue_t *q = core->nes.apu.queue;
+  int more;
+
+  do {
+    more = nes_apu_synth(q);
+    if (q->apu.buf_size > 0) {
+      sdl_mix_audio(&core->sdl, q->apu.buf, q->apu.buf_size);
+      q->apu.buf_size = 0;
+    }
+  } while (more);
+}
+
+// synthesis thread: catches up with the emulation thread whenever it's
+// poked, and once more before stopping
+static int core_synth_thread(void *pcore) {
+  core_t *core = pcore;
+  core_synth_t *sy = &core->synth;
+
+  for (;;) {
+    SDL_SemWait(sy->sem);
+
+    int run = SDL_AtomicGet(&sy->run);
+    core_synth_drain(core);
+
+    if (!run)
+      return 0;
+  }
+}
+
+// called by the APU on the emulation thread while the queue is full
+static void core_synth_wait(void *pcore) {
+  core_t *core = pcore;
+
+  SDL_SemPost(core->synth.sem);
+  SDL_Delay(1);
+}
+
+// called after each frame on the emulation thread
+static inline void core_synth_poll(core_t *core) {
+  if (core->synth.thread)
+    SDL_SemPost(core->synth.sem);
+}
+
+static inline void core_synth_cleanup(core_synth_t *sy) {
+  if (sy->sem) SDL_DestroySemaphore(sy->sem);
+  *sy = (core_synth_t){0};
+}
+
+// moves sound synthesis onto its own thread; expansion audio reads mapper
+// state, so carts with it keep it on the emulation thread
+static inline void core_synth_start(core_t *core) {
+  core_synth_t *sy = &core->synth;
+
+  if (core->nes.cart.mapper.funcs.audio) {
+    error_log_write("Expansion audio is synthesized on the emulation "
+                    "thread\n");
+    return;
+  }
+
+  sy->sem = SDL_CreateSemaphore(0);
+  SDL_AtomicSet(&sy->run, 1);
+
+  if (!sy->sem || nes_apu_split(&core->nes, core_synth_wait, core)) {
+    core_synth_cleanup(sy);
+    error_log_write("Could not set up the synthesis thread, "
+                    "synthesizing on the emulation thread\n");
+    return;
+  }
+
+  sy->thread = SDL_CreateThread(core_synth_thread, "synth", core);
+
+  if (!sy->thread) {
+    nes_apu_join(&core->nes);
+    core_synth_cleanup(sy);
+    error_log_write("Could not start the synthesis thread, "
+                    "synthesizing on the emulation thread\n");
+  }
+}
+
+// lets the synthesis thread catch up and stops it, the APU takes over again
+static inline void core_synth_stop(core_t *core) {
+  core_synth_t *sy = &core->synth;
+
+  if (!sy->thread)
+    return;
+
+  SDL_AtomicSet(&sy->run, 0);
+  SDL_SemPost(sy->sem);
+  SDL_WaitThread(sy->thread, NULL);
+  nes_apu_join(&core->nes);
+  core_synth_cleanup(sy);
+}
+
 void core_load_rom(core_t *core, const char *fname) {
   nes_load_rom(&core->nes, fname);
+
+  if (error_get_code() != NO_ERR)
+    return;
+
+  core_saver_start(core);
+
+  if (core->state.synth_flag)
+    core_synth_start(core);
 }
 
 void core_unload_rom(core_t *core) {
+  core_synth_stop(core);
+  core_saver_stop(&core->saver);
   nes_unload_rom(&core->nes);
 }
 
 static inline void core_state_init(core_state_t *state) {
   state->active_flag = 1;
+  state->threaded_flag = 0;
+  state->synth_flag = 0;
 }
 
 void core_init_controls(core_controls_t *ctrls) {
@@ -48,22 +337,177 @@ void core_set_default_controls(core_controls_t *ctrls) {
   ctrls->p2.code[CTRLS_KEY_A] = SDLK_RIGHTBRACKET;
 }
 
+// runs on the audio thread; each call also wakes up the emulation thread,
+// which is how the audio clock paces emulation in threaded mode
 static void core_audio_feed(void *udata, uint8_t *buf, int buflen) {
-  SDL_AudioStream **stream = udata;
-  SDL_AudioStreamGet(*stream, buf, buflen);
+  core_t *core = udata;
+  SDL_AudioStreamGet(core->sdl.a.stream, buf, buflen);
+  if (core->thr.audio_sem)
+    SDL_SemPost(core->thr.audio_sem);
 }
 
 static inline void core_open_audio(core_t *core, pars_t *pars) {
   sdl_open_audio(&core->sdl,
                  NES_APU_SAMPLE_BUF_SIZE / 2,
                  core_audio_feed,
-                 &core->sdl.a.stream);
+                 core);
 }
 
 static inline void core_close_audio(core_t *core) {
   sdl_close_audio(&core->sdl);
 }
 
+// hands the PPU the next texture to draw into (direct rendering mode)
+// falls back to the PPU's own buffers if the texture can't be locked
+static inline void core_next_target(core_t *core) {
+  int pitch = 0;
+  void *pixels = sdl_frame_begin(&core->sdl, &pitch);
+  nes_ppu_set_target(&core->nes.ppu, pixels, pitch);
+}
+
+// triple buffer
+
+// hands the back buffer over as the newest frame, takes the middle one back
+static inline void core_tribuf_publish(core_tribuf_t *tb) {
+  SDL_MemoryBarrierRelease();
+  tb->back = SDL_AtomicSet(&tb->mid, tb->back | CORE_TRIBUF_FRESH) & 0x03;
+}
+
+// takes the newest frame as the front buffer if there is one
+// returns 1 if front changed
+static inline int core_tribuf_acquire(core_tribuf_t *tb) {
+  if (!(SDL_AtomicGet(&tb->mid) & CORE_TRIBUF_FRESH))
+    return 0;
+  tb->front = SDL_AtomicSet(&tb->mid, tb->front) & 0x03;
+  SDL_MemoryBarrierAcquire();
+  return 1;
+}
+
+// threaded frontend
+
+static inline void core_cleanup_thread(core_thread_t *thr) {
+  for (int i = 0; i < 3; ++i)
+    free(thr->frames.buf[i]);
+  if (thr->audio_sem) SDL_DestroySemaphore(thr->audio_sem);
+  if (thr->frame_sem) SDL_DestroySemaphore(thr->frame_sem);
+  *thr = (core_thread_t){0};
+}
+
+static inline void core_init_thread(core_t *core) {
+  core_thread_t *thr = &core->thr;
+
+  for (int i = 0; i < 3; ++i)
+    thr->frames.buf[i] = calloc(1, sizeof(nes_ppu_screen_t));
+  thr->audio_sem = SDL_CreateSemaphore(0);
+  thr->frame_sem = SDL_CreateSemaphore(0);
+
+  if (!thr->frames.buf[0] || !thr->frames.buf[1] || !thr->frames.buf[2] ||
+      !thr->audio_sem || !thr->frame_sem) {
+    core_cleanup_thread(thr);
+    error_log_write("Could not set up the emulation thread, "
+                    "running single-threaded\n");
+    return;
+  }
+
+  thr->frames.back = 0;
+  SDL_AtomicSet(&thr->frames.mid, 1);
+  thr->frames.front = 2;
+  nes_input_init(&thr->input);
+  core->input = &thr->input;
+  core->state.threaded_flag = 1;
+}
+
+// passes button states from the main thread to the emulation thread
+static inline void core_thread_put_input(core_thread_t *thr) {
+  SDL_AtomicSet(&thr->btns, thr->input.p1.cur.btns |
+                            (thr->input.p2.cur.btns << 8));
+}
+
+// picks up button states on the emulation thread
+static inline void core_thread_get_input(core_t *core) {
+  int btns = SDL_AtomicGet(&core->thr.btns);
+  core->nes.input.p1.cur.btns = btns & 0xFF;
+  core->nes.input.p2.cur.btns = (btns >> 8) & 0xFF;
+}
+
+// points the PPU at the back buffer of the triple buffer
+static inline void core_thread_set_target(core_t *core) {
+  core_tribuf_t *tb = &core->thr.frames;
+  nes_ppu_set_target(&core->nes.ppu, tb->buf[tb->back]->data,
+                     sizeof(tb->buf[tb->back]->data[0]));
+}
+
+// emulation thread: runs frames, publishes them and keeps about two audio
+// buffers queued, sleeping until the audio callback has eaten some more
+static int core_emu_thread(void *pcore) {
+  core_t *core = pcore;
+  core_thread_t *thr = &core->thr;
+  uint32_t max_queued = core->sdl.a.obt_spec.size * 2;
+
+  core_thread_set_target(core);
+
+  while (SDL_AtomicGet(&thr->run)) {
+    core_thread_get_input(core);
+
+    while (!nes_cpu_run(&core->nes, NES_FRAME_CYCLES)) {}
+
+    if (core->nes.apu.buf_size > 0) {
+      sdl_mix_audio(&core->sdl, core->nes.apu.buf, core->nes.apu.buf_size);
+      core->nes.apu.buf_size = 0;
+    }
+
+    core_synth_poll(core);
+    core_save_poll(core);
+
+    if (!BITGET(core->nes.ppu.flags, NES_PPU_FLAG_REPEAT)) {
+      core_tribuf_publish(&thr->frames);
+      core_thread_set_target(core);
+      SDL_SemPost(thr->frame_sem);
+    }
+
+    while (SDL_AtomicGet(&thr->run) &&
+           sdl_get_queued_audio(&core->sdl) > max_queued)
+      SDL_SemWaitTimeout(thr->audio_sem, 100);
+  }
+
+  return 0;
+}
+
+// main thread in threaded mode: only handles events and presents frames
+// returns -1 if the emulation thread couldn't be started, the caller then
+// runs single-threaded
+static int core_process_threaded(core_t *core) {
+  core_thread_t *thr = &core->thr;
+
+  SDL_AtomicSet(&thr->run, 1);
+  thr->thread = SDL_CreateThread(core_emu_thread, "emulation", core);
+
+  if (!thr->thread) {
+    core_cleanup_thread(thr);
+    core->input = &core->nes.input;
+    core->state.threaded_flag = 0;
+    error_log_write("Could not start the emulation thread, "
+                    "running single-threaded\n");
+    return -1;
+  }
+
+  while (core->state.active_flag) {
+    SDL_SemWaitTimeout(thr->frame_sem, 20);
+
+    sdl_process_events(&core->sdl);
+    core_thread_put_input(thr);
+
+    if (core_tribuf_acquire(&thr->frames))
+      sdl_frame(&core->sdl, thr->frames.buf[thr->frames.front]->data);
+  }
+
+  SDL_AtomicSet(&thr->run, 0);
+  SDL_SemPost(thr->audio_sem);
+  SDL_WaitThread(thr->thread, NULL);
+  thr->thread = NULL;
+  return 0;
+}
+
 void core_init(core_t *core, pars_t *pars) {
   sdl_init(&core->sdl, pars);
 
@@ -89,50 +533,94 @@ void core_init(core_t *core, pars_t *pars) {
     return;
   }
 
+  // the database is optional unless it was asked for by name
+  const char *romdb = pars->romdb_fname ? pars->romdb_fname : PARS_ROMDB_DEFAULT;
+  int romdb_size = nes_romdb_load(romdb);
+
+  if (romdb_size >= 0)
+    fprintf(stdout, "Loaded %d ROM database entries from %s\n", romdb_size, romdb);
+  else if (pars->romdb_fname)
+    fprintf(stderr, "Could not read ROM database %s\n", romdb);
+
   core_state_init(&core->state);
 
   core_init_controls(&core->ctrls);
   core_set_default_controls(&core->ctrls);
+  core->input = &core->nes.input;
 
   sdl_set_event_callback(&core->sdl, core_proc_event, core);
 
+  // running a fixed number of frames stays single-threaded and deterministic
+  if (pars->threaded && !pars->run_frames)
+    core_init_thread(core);
+  else if (pars->direct)
+    core_next_target(core);
+
+  if (pars->render_threads)
+    core_render_start(core, pars->render_threads);
+
+  core->state.synth_flag = pars->apu_thread;
+
   core->target_frame = pars->run_frames;
+  core->hash_frames = pars->hash;
+
+  pacer_init(&core->pacer, &core->sdl, pars->pacing, pars->sync);
 }
 
 void core_cleanup(core_t *core) {
+  core_render_stop(core);
   core_close_audio(core);
+  core_cleanup_thread(&core->thr);
   sdl_cleanup(&core->sdl);
   nes_cleanup(&core->nes);
+  nes_romdb_free();
 }
 
 void core_process(core_t *core, pars_t *pars) {
-  static int64_t then, now;
+  if (core->state.threaded_flag && !core_process_threaded(core))
+    return;
 
   while (core->state.active_flag) {
-    then = sdl_get_ticks(&core->sdl);
-
     sdl_process_events(&core->sdl);
 
-    while (!nes_process(&core->nes)) {}
+    while (!nes_cpu_run(&core->nes, NES_FRAME_CYCLES)) {}
 
     if (core->nes.apu.buf_size > 0) {
       sdl_mix_audio(&core->sdl, core->nes.apu.buf, core->nes.apu.buf_size);
       core->nes.apu.buf_size = 0;
     }
 
+    core_synth_poll(core);
+    core_save_poll(core);
+
 #if defined(DEBUG) && defined(DEBUG_SDL)
     sdl_debug_frame(&core->nes);
 #endif
-    sdl_frame(&core->sdl, core->nes.ppu.front->data);
+    // lets tests tell a changed frame apart without reading the screen back
+    if (core->hash_frames) {
+      fprintf(stdout, "frame %u %08X\n", core->nes.ppu.frame,
+        nes_romdb_crc32(0, (const uint8_t *)core->nes.ppu.front->data,
+                        sizeof(nes_ppu_screen_t)));
+    }
 
-    now = sdl_get_ticks(&core->sdl);
+    // the PPU tells us when the frame didn't change, no need to upload it
+    if (BITGET(core->nes.ppu.flags, NES_PPU_FLAG_REPEAT)) {
+      sdl_frame_repeat(&core->sdl);
+    } else if (core->nes.ppu.target_ext) {
+      sdl_frame_end(&core->sdl);
+      core_next_target(core);
+    } else {
+      sdl_frame(&core->sdl, core->nes.ppu.front->data);
+    }
 
     if (!core->target_frame) {
-      if (now - then <= 16)
-        sdl_sleep(&core->sdl, 16 - (now - then));
+      pacer_wait(&core->pacer);
     } else if (core->nes.ppu.frame == core->target_frame) {
       core->state.active_flag = 0;
       sdl_screenshot(&core->sdl, "output.bmp");
     }
   }
+
+  if (!core->target_frame)
+    pacer_report(&core->pacer, stdout);
 }
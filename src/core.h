@@ -3,6 +3,7 @@
 #include "pars.h"
 #include "sdl_manager.h"
 #include "nes.h"
+#include "pacer.h"
 
 // "core" basically means "i/o glue"
 // rewrite this part when porting to a different platform
@@ -35,17 +36,88 @@ typedef struct {
 // core state flags
 typedef struct {
   char active_flag;
+  char threaded_flag; // emulation runs on its own thread
+  char synth_flag; // sound gets synthesized on its own thread
 } core_state_t;
 
+#define CORE_TRIBUF_FRESH 0x04 // set in mid when it holds an unseen frame
+
+// lock-free triple buffer for passing frames between threads
+// the producer owns back, the consumer owns front, mid is swapped atomically
+typedef struct {
+  nes_ppu_screen_t *buf[3];
+  SDL_atomic_t mid; // index of the middle buffer | CORE_TRIBUF_FRESH
+  int back;
+  int front;
+} core_tribuf_t;
+
+// threaded frontend state
+typedef struct {
+  SDL_Thread *thread; // emulation thread
+  SDL_sem *audio_sem; // posted by the audio callback after each buffer
+  SDL_sem *frame_sem; // posted by the emulation thread after each frame
+  SDL_atomic_t run; // cleared to stop the emulation thread
+  SDL_atomic_t btns; // button states, p1 in low byte, p2 in high byte
+  nes_input_t input; // key events go here, then get passed on through btns
+  core_tribuf_t frames;
+} core_thread_t;
+
+#define CORE_RENDER_MAX PARS_RENDER_THREADS_MAX // most drawing threads
+#define CORE_RENDER_BAND 8 // lines per drawing job
+
+// drawing threads for deferred PPU output (see nes_ppu_defer)
+// the emulation thread hands out a band of lines as soon as its last line
+// is logged, and waits for all of them at vblank
+typedef struct {
+  SDL_Thread *thread[CORE_RENDER_MAX];
+  int count; // running threads
+  SDL_sem *jobs; // posted once per band ready to draw, and to stop threads
+  SDL_sem *done; // posted once per band drawn
+  SDL_atomic_t next; // next band to draw
+  SDL_atomic_t run; // cleared to stop the threads
+  int posted; // bands handed out this frame (emulation thread only)
+  nes_ppu_t *ppu;
+} core_render_t;
+
+// sound synthesis thread (see nes_apu_split)
+typedef struct {
+  SDL_Thread *thread; // synthesis thread
+  SDL_sem *sem; // posted after each frame, or while the queue is full
+  SDL_atomic_t run; // cleared to stop the synthesis thread
+} core_synth_t;
+
+#define CORE_SAVE_INTERVAL 1000 // minimum ms between battery save flushes
+
+// battery save writer, runs disk writes off the emulation thread
+typedef struct {
+  SDL_Thread *thread; // writer thread
+  SDL_sem *sem; // posted when there's a snapshot to write or on shutdown
+  SDL_mutex *lock; // guards buf and pending
+  SDL_atomic_t run; // cleared to stop the writer thread
+  const char *fname; // save file name (owned by the cart)
+  uint8_t *buf; // PRG-RAM snapshot
+  uint32_t size; // snapshot size
+  uint8_t pending; // 1 if buf hasn't been written yet
+  uint32_t last; // tick count of the last snapshot
+} core_saver_t;
+
 // core state struct
 typedef struct {
   sdl_man_t sdl;
   nes_t nes;
 
   uint32_t target_frame;
+  uint8_t hash_frames; // if 1, a CRC32 of every frame is printed (--hash)
 
   core_state_t state;
   core_controls_t ctrls;
+  nes_input_t *input; // input state updated by key events
+
+  core_thread_t thr;
+  core_saver_t saver;
+  core_render_t render;
+  core_synth_t synth;
+  pacer_t pacer;
 } core_t;
 
 void core_load_rom(core_t *core, const char *fname);
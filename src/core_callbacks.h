@@ -53,13 +53,11 @@ static void core_proc_event(SDL_Event *ev, void *pcore) {
     case SDL_QUIT: core->state.active_flag = 0; break;
 
     case SDL_KEYDOWN:
-      core_proc_event_key(&core->ctrls, &core->nes.input, ev->key.keysym.sym,
-                          0);
+      core_proc_event_key(&core->ctrls, core->input, ev->key.keysym.sym, 0);
       break;
 
     case SDL_KEYUP:
-      core_proc_event_key(&core->ctrls, &core->nes.input, ev->key.keysym.sym,
-                          1);
+      core_proc_event_key(&core->ctrls, core->input, ev->key.keysym.sym, 1);
       break;
 
     default: break;
@@ -8,8 +8,13 @@
 
 #define NES_MAPPER_ID_CNROM 3
 
-// WARNING: this uses the extra field of nes_mapper_t directly to store
-// a size_t value (the bank index)
+// maps the given 8k CHR bank, or nothing if it is out of range
+static inline void nes_cnrom_map_chr(nes_t *nes, uint8_t bank_id) {
+  if (bank_id < nes->cart.vram8_count)
+    nes_chr_map(nes, 0, 8, nes->cart.vram[bank_id]);
+  else
+    nes_chr_map(nes, 0, 8, NULL);
+}
 
 static uint8_t nes_mem_read_cnrom(nes_t *nes, uint16_t addr) {
   if (addr < 0x2000) return nes_ram_read(nes, addr & 0x07FF);
@@ -17,8 +22,7 @@ static uint8_t nes_mem_read_cnrom(nes_t *nes, uint16_t addr) {
     return nes_input_read(nes, addr - 0x4016);
   if (addr < 0x4000) return nes_ppu_read(nes, addr & 0x0007);
   if (addr < 0x4020) return nes_apu_read(nes, addr - 0x4000);
-  if (addr >= 0xC000) return nes_prg_read(nes, 0, addr - 0xC000);
-  if (addr >= 0x8000) return nes_prg_read(nes, 1, addr - 0x8000);
+  if (addr >= 0x8000) return nes_prg_read(nes, addr);
 
   return 0x00;
 }
@@ -32,10 +36,7 @@ static void nes_mem_write_cnrom(nes_t *nes, uint16_t addr, uint8_t val) {
     return;
   }
   if (addr < 0x4020) {nes_apu_write(nes, addr - 0x4000, val); return;}
-  if (addr >= 0x8000) {
-    size_t bank_id = val & 0x03;
-    nes->cart.mapper.extra = (void *)(bank_id);
-  }
+  if (addr >= 0x8000) nes_cnrom_map_chr(nes, val & 0x03);
 }
 
 static uint8_t nes_vmem_read_cnrom(nes_t *nes, uint16_t addr) {
@@ -46,14 +47,8 @@ static uint8_t nes_vmem_read_cnrom(nes_t *nes, uint16_t addr) {
       addr -= 0x10;
     return nes->vmem.pal[addr];
   }
-  if (addr < 0x2000) {
-    size_t bank_id = (size_t)(nes->cart.mapper.extra);
-    if (nes->cart.vram8_count > bank_id)
-      return nes->cart.vram[bank_id][addr & 0x1FFF];
-    else
-      return 0x00;
-  }
-  return nes->vmem.vram[nes->cart.mirror(addr)];
+  if (addr < 0x2000) return nes_chr_read(nes, addr);
+  return nes_nt_read(nes, addr);
 }
 
 static void nes_vmem_write_cnrom(nes_t *nes, uint16_t addr, uint8_t val) {
@@ -64,20 +59,20 @@ static void nes_vmem_write_cnrom(nes_t *nes, uint16_t addr, uint8_t val) {
       addr -= 0x10;
     nes->vmem.pal[addr] = val;
   } else if (addr < 0x2000) {
-    size_t bank_id = (size_t)(nes->cart.mapper.extra);
-    if (nes->cart.chr_ram && nes->cart.vram8_count > bank_id)
-      nes->cart.vram[bank_id][addr & 0x1FFF] = val;  
+    nes_chr_write(nes, addr, val);
   } else {
-    nes->vmem.vram[nes->cart.mirror(addr)] = val;
+    nes_nt_write(nes, addr, val);
   }
 }
 
 static void nes_init_cnrom(nes_t *nes) {
   nes->cart.mapper.extra = NULL;
   if (nes->cart.rom16_count) {
-    nes->mem.prg[0] = nes->cart.rom[nes->cart.rom16_count - 1];
-    nes->mem.prg[1] = nes->cart.rom[0];
+    nes_prg_map(nes, 0, 2, nes->cart.rom[0]);
+    nes_prg_map(nes, 2, 2, nes->cart.rom[nes->cart.rom16_count - 1]);
   }
+
+  nes_cnrom_map_chr(nes, 0);
 }
 
 static void nes_cleanup_cnrom(nes_t *nes) {
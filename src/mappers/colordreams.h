@@ -0,0 +1,104 @@
+#pragma once
+
+#include "../nes_mappers.h"
+#include "../nes_mem.h"
+#include "../nes_apu.h"
+#include "../nes_input.h"
+#include "../nes_ppu.h"
+
+#define NES_MAPPER_ID_COLORDREAMS 11
+
+// maps the given 32k PRG bank (wraps around on smaller ROMs)
+static inline void nes_colordreams_map_prg(nes_t *nes, uint8_t bank_id) {
+  uint16_t count = nes->cart.rom16_count;
+  nes_prg_map(nes, 0, 2, nes->cart.rom[(bank_id * 2) % count]);
+  nes_prg_map(nes, 2, 2, nes->cart.rom[(bank_id * 2 + 1) % count]);
+}
+
+// maps the given 8k CHR bank (wraps around on smaller ROMs)
+static inline void nes_colordreams_map_chr(nes_t *nes, uint8_t bank_id) {
+  nes_chr_map(nes, 0, 8, nes->cart.vram[bank_id % nes->cart.vram8_count]);
+}
+
+static uint8_t nes_mem_read_colordreams(nes_t *nes, uint16_t addr) {
+  if (addr < 0x2000) return nes_ram_read(nes, addr & 0x07FF);
+  if ((addr == 0x4016) || (addr == 0x4017))
+    return nes_input_read(nes, addr - 0x4016);
+  if (addr < 0x4000) return nes_ppu_read(nes, addr & 0x0007);
+  if (addr < 0x4020) return nes_apu_read(nes, addr - 0x4000);
+  if (addr >= 0x8000) return nes_prg_read(nes, addr);
+
+  return 0x00;
+}
+
+static void nes_mem_write_colordreams(nes_t *nes, uint16_t addr, uint8_t val) {
+  if (addr < 0x2000) {nes_ram_write(nes, addr & 0x07FF, val); return;}
+  if (addr < 0x4000) {nes_ppu_write(nes, addr & 0x0007, val); return;}
+  if (addr == 0x4014) {nes_ppu_oamdma(nes, val); return;}
+  if (addr == 0x4016) {
+    nes_input_write(nes, addr - 0x4016, val);
+    return;
+  }
+  if (addr < 0x4020) {nes_apu_write(nes, addr - 0x4000, val); return;}
+  if (addr >= 0x8000 && nes->cart.rom16_count) {
+    // bits 0-1 select the PRG bank, bits 4-7 the CHR bank
+    nes_colordreams_map_prg(nes, val & 0x03);
+    nes_colordreams_map_chr(nes, (val >> 4) & 0x0F);
+  }
+}
+
+static uint8_t nes_vmem_read_colordreams(nes_t *nes, uint16_t addr) {
+  addr &= 0x3FFF;
+  if (addr >= 0x3F00) {
+    addr &= 0x001F;
+    if (addr >= 0x10 && (addr & 0x03) == 0)
+      addr -= 0x10;
+    return nes->vmem.pal[addr];
+  }
+  if (addr < 0x2000) return nes_chr_read(nes, addr);
+  return nes_nt_read(nes, addr);
+}
+
+static void nes_vmem_write_colordreams(nes_t *nes, uint16_t addr, uint8_t val) {
+  addr &= 0x3FFF;
+  if (addr >= 0x3F00) {
+    addr &= 0x001F;
+    if (addr >= 0x10 && (addr & 0x03) == 0)
+      addr -= 0x10;
+    nes->vmem.pal[addr] = val;
+  } else if (addr < 0x2000) {
+    nes_chr_write(nes, addr, val);
+  } else {
+    nes_nt_write(nes, addr, val);
+  }
+}
+
+static void nes_init_colordreams(nes_t *nes) {
+  if (nes->cart.rom16_count)
+    nes_colordreams_map_prg(nes, 0);
+
+  nes_colordreams_map_chr(nes, 0);
+}
+
+static void nes_cleanup_colordreams(nes_t *nes) {
+  return;
+}
+
+// registry stuff
+
+MAPPER_REG_FUNC
+static void nes_register_colordreams() {
+  static const char *mapper_name = "Color Dreams";
+  static nes_mapper_funcs_t mapper_funcs = {
+    .init = nes_init_colordreams, .cleanup = nes_cleanup_colordreams,
+    .read = nes_mem_read_colordreams, .write = nes_mem_write_colordreams,
+    .vread = nes_vmem_read_colordreams, .vwrite = nes_vmem_write_colordreams,
+  };
+
+  nes_reg_mapper(NES_MAPPER_ID_COLORDREAMS, mapper_name, &mapper_funcs);
+}
+
+MAPPER_UNREG_FUNC
+static void nes_unregister_colordreams() {
+  nes_unreg_mapper(NES_MAPPER_ID_COLORDREAMS);
+}
@@ -0,0 +1,400 @@
+#pragma once
+
+#include "../nes_mappers.h"
+#include "../nes_mem.h"
+#include "../nes_apu.h"
+#include "../nes_cpu.h"
+#include "../nes_input.h"
+#include "../nes_ppu.h"
+#include "../nes_cart.h"
+
+#define NES_MAPPER_ID_FME7 69
+
+#define NES_FME7_AUDIO_SCALE 0.15 // full volume tone ~ 2A03 square
+
+// 5B output levels, 1.5dB per step; the envelope walks all 32 of them,
+// a fixed volume v plays at level v * 2 + 1
+static const float nes_fme7_vol_tbl[32] = {
+  0.0, 0.0056, 0.0067, 0.0079, 0.0094, 0.0112, 0.0133, 0.0158,
+  0.0188, 0.0224, 0.0266, 0.0316, 0.0376, 0.0447, 0.0531, 0.0631,
+  0.0750, 0.0891, 0.1059, 0.1259, 0.1496, 0.1778, 0.2113, 0.2512,
+  0.2985, 0.3548, 0.4217, 0.5012, 0.5957, 0.7079, 0.8414, 1.0,
+};
+
+// extra mapper data for Sunsoft FME-7 (and 5B, which adds audio)
+typedef struct {
+  uint8_t cmd; // $8000: register written through $A000
+  uint8_t low; // command 8: $6000 bank, bit 6 selects RAM, bit 7 enables it
+  uint8_t *low_rom; // ROM page at $6000 when RAM isn't selected
+
+  uint8_t irq_ctrl; // command D: bit 0 enables IRQ, bit 7 the counter
+  uint16_t irq_counter; // 16-bit, counts down
+  uint8_t irq_pending; // 1 once the counter wrapped, until delivered
+  uint64_t irq_cycle; // APU cycle the counter was last brought up to
+
+  uint8_t addr; // $C000: audio register select
+  uint8_t reg[16]; // audio registers
+  uint32_t tmr[3]; // cycles until each tone flips
+  uint8_t tone[3]; // current tone output
+  uint32_t noise_tmr; // cycles until the noise LFSR shifts
+  uint32_t noise; // 17-bit LFSR, bit 0 is the output
+  uint32_t env_tmr; // cycles until the next envelope step
+  uint8_t env_step; // 0-31 through the current ramp
+  uint8_t env_inv; // $1F while the ramp goes down
+  uint8_t env_hold; // 1 once a one-shot shape has finished
+  nes_apu_ext_t ext;
+} nes_fme7_extra_t;
+
+// maps the 8k PRG bank with the given index into an 8k slot
+static inline void nes_fme7_map_prg(nes_t *nes, uint8_t slot, uint32_t idx) {
+  if (!nes->cart.rom16_count) return;
+  idx %= nes->cart.rom16_count * 2;
+  nes_prg_map(nes, slot, 1, nes->cart.prg + idx * 0x2000);
+}
+
+// maps the 1k CHR bank with the given index into a 1k slot
+static inline void nes_fme7_map_chr(nes_t *nes, uint8_t slot, uint32_t idx) {
+  idx %= nes->cart.vram8_count * 8;
+  nes_chr_map(nes, slot, 1, nes->cart.chr + idx * 0x0400);
+}
+
+// updates the $6000 window after a write to command 8
+static inline void nes_fme7_update_low(nes_t *nes) {
+  nes_fme7_extra_t *mmc = nes->cart.mapper.extra;
+  uint32_t idx = mmc->low & 0x3F;
+
+  if (nes->cart.rom16_count)
+    mmc->low_rom = nes->cart.prg + (idx % (nes->cart.rom16_count * 2)) * 0x2000;
+  nes->mem.wram = ((mmc->low & 0xC0) == 0xC0) ? nes->mem.prgram : NULL;
+}
+
+// audio
+
+// returns the tone period of a channel in CPU cycles
+static inline uint32_t nes_fme7_period(nes_fme7_extra_t *mmc, int i) {
+  uint32_t period = mmc->reg[i * 2] | ((mmc->reg[i * 2 + 1] & 0x0F) << 8);
+  return (period ? period : 1) * 16;
+}
+
+// returns the noise LFSR period in CPU cycles
+static inline uint32_t nes_fme7_noise_period(nes_fme7_extra_t *mmc) {
+  uint32_t period = mmc->reg[6] & 0x1F;
+  return (period ? period : 1) * 32;
+}
+
+// returns the envelope step period in CPU cycles, a ramp takes 32 steps
+static inline uint32_t nes_fme7_env_period(nes_fme7_extra_t *mmc) {
+  uint32_t period = mmc->reg[11] | (mmc->reg[12] << 8);
+  return (period ? period : 1) * 16;
+}
+
+// restarts the envelope after a write to the shape register
+static inline void nes_fme7_env_reset(nes_fme7_extra_t *mmc) {
+  mmc->env_tmr = nes_fme7_env_period(mmc);
+  mmc->env_step = 0;
+  mmc->env_inv = (mmc->reg[13] & 0x04) ? 0x00 : 0x1F; // attack bit
+  mmc->env_hold = 0;
+}
+
+// moves the envelope one step, at the end of a ramp the shape's continue,
+// alternate and hold bits pick what comes next
+static inline void nes_fme7_env_clock(nes_fme7_extra_t *mmc) {
+  uint8_t shape = mmc->reg[13];
+
+  if (mmc->env_hold || ++mmc->env_step < 32)
+    return;
+
+  if (!(shape & 0x08)) {
+    // one-shot, drops to 0 and stays there
+    mmc->env_step = 0;
+    mmc->env_inv = 0x00;
+    mmc->env_hold = 1;
+  } else if (shape & 0x01) {
+    // holds the last level, or its opposite when alternating
+    mmc->env_step = 31;
+    if (shape & 0x02) mmc->env_inv ^= 0x1F;
+    mmc->env_hold = 1;
+  } else {
+    mmc->env_step = 0;
+    if (shape & 0x02) mmc->env_inv ^= 0x1F;
+  }
+}
+
+// returns the mixed output of the three channels; a channel is high when
+// both its tone and noise are (or are disabled in the mixer)
+static inline float nes_fme7_output(nes_fme7_extra_t *mmc) {
+  uint8_t mix = mmc->reg[7];
+  float res = 0.0;
+
+  for (int i = 0; i < 3; ++i) {
+    uint8_t vol = mmc->reg[8 + i];
+    if (!((mmc->tone[i] | (mix >> i)) & (mmc->noise | (mix >> (i + 3))) & 1))
+      continue;
+    if (vol & 0x10)
+      res += nes_fme7_vol_tbl[mmc->env_step ^ mmc->env_inv];
+    else if (vol & 0x0F)
+      res += nes_fme7_vol_tbl[(vol & 0x0F) * 2 + 1];
+  }
+
+  return res;
+}
+
+// brings the channels up to the APU, the output is summed over the stretches
+// between tone, noise and envelope steps
+static inline void nes_fme7_run(nes_t *nes) {
+  nes_fme7_extra_t *mmc = nes->cart.mapper.extra;
+  uint32_t left = nes_apu_ext_span(nes, &mmc->ext);
+  float sum = 0.0;
+
+  while (left) {
+    uint32_t step = left;
+    if (mmc->noise_tmr < step) step = mmc->noise_tmr;
+    if (mmc->env_tmr < step) step = mmc->env_tmr;
+    for (int i = 0; i < 3; ++i)
+      if (mmc->tmr[i] < step) step = mmc->tmr[i];
+
+    sum += step * nes_fme7_output(mmc);
+    left -= step;
+
+    for (int i = 0; i < 3; ++i) {
+      mmc->tmr[i] -= step;
+      if (!mmc->tmr[i]) {
+        mmc->tmr[i] = nes_fme7_period(mmc, i);
+        mmc->tone[i] ^= 1;
+      }
+    }
+    mmc->noise_tmr -= step;
+    if (!mmc->noise_tmr) {
+      // taps at bits 0 and 3, the new bit comes in at the top
+      mmc->noise_tmr = nes_fme7_noise_period(mmc);
+      mmc->noise = (mmc->noise >> 1) | (((mmc->noise ^ (mmc->noise >> 3)) & 1) << 16);
+    }
+    mmc->env_tmr -= step;
+    if (!mmc->env_tmr) {
+      mmc->env_tmr = nes_fme7_env_period(mmc);
+      nes_fme7_env_clock(mmc);
+    }
+  }
+
+  mmc->ext.sum += sum * NES_FME7_AUDIO_SCALE;
+}
+
+static float nes_audio_fme7(nes_t *nes) {
+  nes_fme7_extra_t *mmc = nes->cart.mapper.extra;
+  nes_fme7_run(nes);
+  return nes_apu_ext_sample(&mmc->ext);
+}
+
+// IRQ
+
+// brings the counter up to the current cycle, the IRQ is latched when it
+// wraps from 0 to $FFFF
+static inline void nes_fme7_irq_run(nes_t *nes) {
+  nes_fme7_extra_t *mmc = nes->cart.mapper.extra;
+  uint64_t n = nes->apu.cycle - mmc->irq_cycle;
+  mmc->irq_cycle = nes->apu.cycle;
+
+  if (!(mmc->irq_ctrl & 0x80))
+    return;
+
+  int wrap = n > mmc->irq_counter;
+  mmc->irq_counter -= n;
+  if (wrap && (mmc->irq_ctrl & 0x01))
+    mmc->irq_pending = 1;
+}
+
+// sets the mapper timer for the cycle the counter wraps, or right away if
+// the IRQ is waiting to be delivered
+static inline void nes_fme7_irq_schedule(nes_t *nes) {
+  nes_fme7_extra_t *mmc = nes->cart.mapper.extra;
+
+  if (mmc->irq_pending)
+    nes_mapper_timer_set(nes, nes->apu.cycle);
+  else if ((mmc->irq_ctrl & 0x81) == 0x81)
+    nes_mapper_timer_set(nes, mmc->irq_cycle + mmc->irq_counter + 1);
+  else
+    nes_mapper_timer_set(nes, NES_MAPPER_TIMER_OFF);
+}
+
+// the counter runs on the CPU clock, it's caught up and the IRQ delivered
+// when it's due
+static void nes_timer_fme7(nes_t *nes) {
+  nes_fme7_extra_t *mmc = nes->cart.mapper.extra;
+
+  nes_fme7_irq_run(nes);
+  if (mmc->irq_pending) {
+    mmc->irq_pending = 0;
+    nes_cpu_irq(nes);
+  }
+  nes_fme7_irq_schedule(nes);
+}
+
+// registers
+
+// writes the parameter of the current command
+static inline void nes_fme7_command(nes_t *nes, uint8_t val) {
+  nes_fme7_extra_t *mmc = nes->cart.mapper.extra;
+
+  switch (mmc->cmd) {
+    case 0x0: case 0x1: case 0x2: case 0x3:
+    case 0x4: case 0x5: case 0x6: case 0x7:
+      nes_fme7_map_chr(nes, mmc->cmd, val);
+      break;
+    case 0x8:
+      mmc->low = val;
+      nes_fme7_update_low(nes);
+      break;
+    case 0x9: case 0xA: case 0xB:
+      nes_fme7_map_prg(nes, mmc->cmd - 0x9, val & 0x3F);
+      break;
+    case 0xC:
+      switch (val & 0x03) {
+        case 0: nes_cart_set_mirroring(nes, MIRROR_VERTICAL); break;
+        case 1: nes_cart_set_mirroring(nes, MIRROR_HORIZONTAL); break;
+        case 2: nes_cart_set_mirroring(nes, MIRROR_SINGLESCREEN0); break;
+        case 3: nes_cart_set_mirroring(nes, MIRROR_SINGLESCREEN1); break;
+      }
+      break;
+    case 0xD:
+      // also acknowledges the IRQ
+      nes_fme7_irq_run(nes);
+      mmc->irq_pending = 0;
+      mmc->irq_ctrl = val;
+      nes_fme7_irq_schedule(nes);
+      break;
+    case 0xE:
+      nes_fme7_irq_run(nes);
+      mmc->irq_counter = (mmc->irq_counter & 0xFF00) | val;
+      nes_fme7_irq_schedule(nes);
+      break;
+    case 0xF:
+      nes_fme7_irq_run(nes);
+      mmc->irq_counter = (mmc->irq_counter & 0x00FF) | (val << 8);
+      nes_fme7_irq_schedule(nes);
+      break;
+  }
+}
+
+static uint8_t nes_mem_read_fme7(nes_t *nes, uint16_t addr) {
+  nes_fme7_extra_t *mmc = nes->cart.mapper.extra;
+
+  if (addr < 0x2000) return nes_ram_read(nes, addr & 0x07FF);
+  if ((addr == 0x4016) || (addr == 0x4017))
+    return nes_input_read(nes, addr - 0x4016);
+  if (addr < 0x4000) return nes_ppu_read(nes, addr & 0x0007);
+  if (addr < 0x4020) return nes_apu_read(nes, addr - 0x4000);
+  if (addr >= 0x8000) return nes_prg_read(nes, addr);
+  if (addr >= 0x6000) {
+    if (mmc->low & 0x40)
+      return nes_prgram_read(nes, addr - 0x6000);
+    return mmc->low_rom ? mmc->low_rom[addr - 0x6000] : 0x00;
+  }
+
+  return 0x00;
+}
+
+static void nes_mem_write_fme7(nes_t *nes, uint16_t addr, uint8_t val) {
+  nes_fme7_extra_t *mmc = nes->cart.mapper.extra;
+
+  if (addr < 0x2000) {nes_ram_write(nes, addr & 0x07FF, val); return;}
+  if (addr < 0x4000) {nes_ppu_write(nes, addr & 0x0007, val); return;}
+  if (addr == 0x4014) {nes_ppu_oamdma(nes, val); return;}
+  if (addr == 0x4016) {
+    nes_input_write(nes, addr - 0x4016, val);
+    return;
+  }
+  if (addr < 0x4020) {nes_apu_write(nes, addr - 0x4000, val); return;}
+  if (addr < 0x6000) return;
+  if (addr < 0x8000) {nes_prgram_write(nes, addr - 0x6000, val); return;}
+
+  switch (addr >> 13) {
+    case 0x4: mmc->cmd = val & 0x0F; break; // $8000
+    case 0x5: nes_fme7_command(nes, val); break; // $A000
+    case 0x6: mmc->addr = val; break; // $C000
+    case 0x7: // $E000
+      if (mmc->addr > 0x0F)
+        break; // upper nibble must be 0
+      nes_fme7_run(nes);
+      mmc->reg[mmc->addr] = val;
+      if (mmc->addr == 13)
+        nes_fme7_env_reset(mmc);
+      break;
+  }
+}
+
+static uint8_t nes_vmem_read_fme7(nes_t *nes, uint16_t addr) {
+  addr &= 0x3FFF;
+  if (addr >= 0x3F00) {
+    addr &= 0x001F;
+    if (addr >= 0x10 && (addr & 0x03) == 0)
+      addr -= 0x10;
+    return nes->vmem.pal[addr];
+  }
+  if (addr < 0x2000) return nes_chr_read(nes, addr);
+  return nes_nt_read(nes, addr);
+}
+
+static void nes_vmem_write_fme7(nes_t *nes, uint16_t addr, uint8_t val) {
+  addr &= 0x3FFF;
+  if (addr >= 0x3F00) {
+    addr &= 0x001F;
+    if (addr >= 0x10 && (addr & 0x03) == 0)
+      addr -= 0x10;
+    nes->vmem.pal[addr] = val;
+  } else if (addr < 0x2000) {
+    nes_chr_write(nes, addr, val);
+  } else {
+    nes_nt_write(nes, addr, val);
+  }
+}
+
+static void nes_init_fme7(nes_t *nes) {
+  nes_fme7_extra_t *mmc = calloc(1, sizeof(nes_fme7_extra_t));
+  nes->cart.mapper.extra = mmc;
+
+  for (int i = 0; i < 3; ++i)
+    mmc->tmr[i] = nes_fme7_period(mmc, i);
+  mmc->noise_tmr = nes_fme7_noise_period(mmc);
+  mmc->noise = 1;
+  mmc->env_tmr = nes_fme7_env_period(mmc);
+  mmc->env_hold = 1;
+  mmc->ext.cycle = mmc->ext.start = nes->apu.cycle;
+  mmc->irq_cycle = nes->apu.cycle;
+
+  for (int i = 0; i < 4; ++i)
+    nes_fme7_map_prg(nes, i, (i < 3) ? i : nes->cart.rom16_count * 2 - 1);
+  for (int i = 0; i < 8; ++i)
+    nes_fme7_map_chr(nes, i, i);
+  nes_fme7_update_low(nes);
+}
+
+static void nes_cleanup_fme7(nes_t *nes) {
+  free(nes->cart.mapper.extra);
+  nes->cart.mapper.extra = NULL;
+}
+
+static void nes_clone_fme7(nes_t *nes, nes_t *src) {
+  nes->cart.mapper.extra = nes_mapper_copy_extra(src, sizeof(nes_fme7_extra_t));
+}
+
+// registry stuff
+
+MAPPER_REG_FUNC
+static void nes_register_fme7() {
+  static const char *mapper_name = "Sunsoft FME-7";
+  static nes_mapper_funcs_t mapper_funcs = {
+    .init = nes_init_fme7, .cleanup = nes_cleanup_fme7,
+    .clone = nes_clone_fme7,
+    .read = nes_mem_read_fme7, .write = nes_mem_write_fme7,
+    .vread = nes_vmem_read_fme7, .vwrite = nes_vmem_write_fme7,
+    .timer = nes_timer_fme7,
+    .audio = nes_audio_fme7,
+  };
+
+  nes_reg_mapper(NES_MAPPER_ID_FME7, mapper_name, &mapper_funcs);
+}
+
+MAPPER_UNREG_FUNC
+static void nes_unregister_fme7() {
+  nes_unreg_mapper(NES_MAPPER_ID_FME7);
+}
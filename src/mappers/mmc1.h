@@ -62,13 +62,23 @@ static uint8_t nes_mem_read_mmc1(nes_t *nes, uint16_t addr) {
     return nes_input_read(nes, addr - 0x4016);
   if (addr < 0x4000) return nes_ppu_read(nes, addr & 0x0007);
   if (addr < 0x4020) return nes_apu_read(nes, addr - 0x4000);
-  if (addr >= 0xC000) return nes_prg_read(nes, 0, addr - 0xC000);
-  if (addr >= 0x8000) return nes_prg_read(nes, 1, addr - 0x8000);
+  if (addr >= 0x8000) return nes_prg_read(nes, addr);
   if (addr >= 0x6000) return nes_prgram_read(nes, addr - 0x6000);
 
   return 0x00;
 }
 
+// maps the selected 4k CHR banks (CHR-RAM is never switched)
+static inline void nes_mmc1_map_chr(nes_t *nes) {
+  nes_mmc1_extra_t *ex = nes->cart.mapper.extra;
+  uint32_t count = nes->cart.vram8_count * 2;
+
+  for (int i = 0; i < 2; ++i) {
+    uint32_t bank = (nes->cart.chr_ram) ? i : (uint8_t)ex->chr_bank[i] % count;
+    nes_chr_map(nes, i * 4, 4, nes->cart.chr + bank * 0x1000);
+  }
+}
+
 // applies MMC1 settings, changing mirroring and banks
 static inline void nes_mmc1_apply(nes_t *nes) {
   nes_mmc1_extra_t *ex = nes->cart.mapper.extra;
@@ -83,11 +93,11 @@ static inline void nes_mmc1_apply(nes_t *nes) {
   if ((ex->old_switch_area != (ex->r0 & MMC1_R0_PRGAREA)) &&
       (ex->r0 & MMC1_R0_PRGSIZE)) {
     if (ex->r0 & MMC1_R0_PRGAREA) {
-      nes->mem.prg[1] = nes->cart.rom[ex->cur_bank];
-      nes->mem.prg[0] = nes->cart.rom[nes->cart.rom16_count - 1];
+      nes_prg_map(nes, 0, 2, nes->cart.rom[ex->cur_bank]);
+      nes_prg_map(nes, 2, 2, nes->cart.rom[nes->cart.rom16_count - 1]);
     } else {
-      nes->mem.prg[1] = nes->cart.rom[0];
-      nes->mem.prg[0] = nes->cart.rom[ex->cur_bank];
+      nes_prg_map(nes, 0, 2, nes->cart.rom[0]);
+      nes_prg_map(nes, 2, 2, nes->cart.rom[ex->cur_bank]);
     }
   }
 
@@ -133,6 +143,8 @@ static inline void nes_mmc1_write_r1(nes_t *nes, uint8_t val) {
         ex->chr_bank[0] = ex->chr_bank_sw;
       else
         ex->chr_bank[0] = ex->chr_bank_sw >> 1;
+
+      nes_mmc1_map_chr(nes);
     }
   }
 }
@@ -157,6 +169,8 @@ static inline void nes_mmc1_write_r2(nes_t *nes, uint8_t val) {
         ex->chr_bank[1] = ex->chr_bank_sw;
       else
         ex->chr_bank[1] = ex->chr_bank_sw >> 1;
+
+      nes_mmc1_map_chr(nes);
     }
   }
 }
@@ -180,13 +194,13 @@ static inline void nes_mmc1_write_r3(nes_t *nes, uint8_t val) {
 
       if (ex->r0 & MMC1_R0_PRGSIZE) {
         if (ex->r0 & MMC1_R0_PRGAREA) {
-          nes->mem.prg[1] = nes->cart.rom[ex->r3];
+          nes_prg_map(nes, 0, 2, nes->cart.rom[ex->r3]);
         } else {
-          nes->mem.prg[0] = nes->cart.rom[ex->r3];
+          nes_prg_map(nes, 2, 2, nes->cart.rom[ex->r3]);
         }
       } else {
-        nes->mem.prg[1] = nes->cart.rom[ex->r3 >> 1];
-        nes->mem.prg[0] = nes->cart.rom[(ex->r3 >> 1) + 1];
+        nes_prg_map(nes, 0, 2, nes->cart.rom[ex->r3 >> 1]);
+        nes_prg_map(nes, 2, 2, nes->cart.rom[(ex->r3 >> 1) + 1]);
       }
 
       if (ex->r3 & MMC1_R3_SAVECE)
@@ -219,8 +233,6 @@ static void nes_mem_write_mmc1(nes_t *nes, uint16_t addr, uint8_t val) {
 }
 
 static uint8_t nes_vmem_read_mmc1(nes_t *nes, uint16_t addr) {
-  nes_mmc1_extra_t *ex = nes->cart.mapper.extra;
-
   addr &= 0x3FFF;
   if (addr >= 0x3F00) {
     addr &= 0x001F;
@@ -228,25 +240,8 @@ static uint8_t nes_vmem_read_mmc1(nes_t *nes, uint16_t addr) {
       addr -= 0x10;
     return nes->vmem.pal[addr];
   }
-  if (addr < 0x1000) {
-    if (nes->cart.vram8_count) {
-      uint8_t bank = (nes->cart.chr_ram) ? 0 : ex->chr_bank[0];
-      uint16_t offset = (bank % 2) * 0x1000;
-
-      return nes->cart.vram[bank / 2][(addr & 0x0FFF) + offset];
-    } else
-      return 0x00;
-  }
-  if (addr < 0x2000) {
-    if (nes->cart.vram8_count) {
-      uint8_t bank = (nes->cart.chr_ram) ? 1 : ex->chr_bank[1];
-      uint16_t offset = (bank % 2) * 0x1000;
-
-      return nes->cart.vram[bank / 2][(addr & 0x0FFF) + offset];
-    } else
-      return 0x00;
-  }
-  return nes->vmem.vram[nes->cart.mirror(addr)];
+  if (addr < 0x2000) return nes_chr_read(nes, addr);
+  return nes_nt_read(nes, addr);
 }
 
 static void nes_vmem_write_mmc1(nes_t *nes, uint16_t addr, uint8_t val) {
@@ -257,10 +252,9 @@ static void nes_vmem_write_mmc1(nes_t *nes, uint16_t addr, uint8_t val) {
       addr -= 0x10;
     nes->vmem.pal[addr] = val;
   } else if (addr < 0x2000) {
-    if (nes->cart.vram8_count && nes->cart.chr_ram)
-      nes->cart.vram[0][addr & 0x1FFF] = val;
+    nes_chr_write(nes, addr, val);
   } else {
-    nes->vmem.vram[nes->cart.mirror(addr)] = val;
+    nes_nt_write(nes, addr, val);
   }
 }
 
@@ -289,9 +283,13 @@ static void nes_init_mmc1(nes_t *nes) {
   nes->cart.mapper.extra = ex;
 
   if (nes->cart.rom16_count) {
-    nes->mem.prg[0] = nes->cart.rom[nes->cart.rom16_count - 1];
-    nes->mem.prg[1] = nes->cart.rom[0];
+    nes_prg_map(nes, 0, 2, nes->cart.rom[0]);
+    nes_prg_map(nes, 2, 2, nes->cart.rom[nes->cart.rom16_count - 1]);
   }
+
+  nes_mmc1_map_chr(nes);
+
+  nes->mem.wram = nes->mem.prgram;
 }
 
 static void nes_cleanup_mmc1(nes_t *nes) {
@@ -299,6 +297,10 @@ static void nes_cleanup_mmc1(nes_t *nes) {
   nes->cart.mapper.extra = NULL;
 }
 
+static void nes_clone_mmc1(nes_t *nes, nes_t *src) {
+  nes->cart.mapper.extra = nes_mapper_copy_extra(src, sizeof(nes_mmc1_extra_t));
+}
+
 // registry stuff
 
 MAPPER_REG_FUNC
@@ -306,6 +308,7 @@ static void nes_register_mmc1() {
   static const char *mapper_name = "MMC1";
   static nes_mapper_funcs_t mapper_funcs = {
     .init = nes_init_mmc1, .cleanup = nes_cleanup_mmc1,
+    .clone = nes_clone_mmc1,
     .read = nes_mem_read_mmc1, .write = nes_mem_write_mmc1,
     .vread = nes_vmem_read_mmc1, .vwrite = nes_vmem_write_mmc1,
   };
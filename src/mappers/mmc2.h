@@ -0,0 +1,190 @@
+#pragma once
+
+#include "../nes_mappers.h"
+#include "../nes_mem.h"
+#include "../nes_apu.h"
+#include "../nes_input.h"
+#include "../nes_ppu.h"
+#include "../nes_cart.h"
+
+#define NES_MAPPER_ID_MMC2 9
+
+// extra mapper data for MMC2 (and MMC4, which only differs in PRG banking)
+typedef struct {
+  uint8_t chr[4]; // 4k CHR banks: $0000 FD, $0000 FE, $1000 FD, $1000 FE
+  uint8_t latch[2]; // 0 if the FD bank is selected, 1 if the FE one is
+} nes_mmc2_extra_t;
+
+// maps the 8k PRG bank with the given index into an 8k slot
+static inline void nes_mmc2_map_prg(nes_t *nes, uint8_t slot, uint32_t idx) {
+  if (!nes->cart.rom16_count) return;
+  idx %= nes->cart.rom16_count * 2;
+  nes_prg_map(nes, slot, 1, nes->cart.prg + idx * 0x2000);
+}
+
+// maps the 4k CHR banks picked by the latches
+static inline void nes_mmc2_update_chr(nes_t *nes) {
+  nes_mmc2_extra_t *mmc = nes->cart.mapper.extra;
+  uint32_t count = nes->cart.vram8_count * 2;
+
+  for (int i = 0; i < 2; ++i) {
+    uint32_t idx = mmc->chr[i * 2 + mmc->latch[i]] % count;
+    nes_chr_map(nes, i * 4, 4, nes->cart.chr + idx * 0x1000);
+  }
+}
+
+// sets a latch, remapping CHR only if it actually flips
+static inline void nes_mmc2_set_latch(nes_t *nes, int i, uint8_t val) {
+  nes_mmc2_extra_t *mmc = nes->cart.mapper.extra;
+  if (mmc->latch[i] == val) return;
+
+  mmc->latch[i] = val;
+  nes_mmc2_update_chr(nes);
+}
+
+// the latches flip after the PPU reads the high bitplane of tiles $FD/$FE;
+// MMC2 only watches the first row for the $0000 table, MMC4 watches all
+static inline void nes_mmc2_latch(nes_t *nes, uint16_t addr, int any_row) {
+  if ((addr & 0x0FC0) != 0x0FC0)
+    return; // not tile $FC-$FF, which is almost always the case
+
+  uint16_t tile = addr & 0x0FF8;
+  if (!(addr & 0x1000) && !any_row && (addr & 0x07) != 0)
+    return;
+
+  if (tile == 0x0FD8)
+    nes_mmc2_set_latch(nes, addr >> 12, 0);
+  else if (tile == 0x0FE8)
+    nes_mmc2_set_latch(nes, addr >> 12, 1);
+}
+
+// writes to the MMC2/MMC4 register at given address, except the PRG one
+static inline void nes_mmc2_write(nes_t *nes, uint16_t addr, uint8_t val) {
+  nes_mmc2_extra_t *mmc = nes->cart.mapper.extra;
+
+  switch (addr >> 12) {
+    case 0xB: case 0xC: case 0xD: case 0xE:
+      mmc->chr[(addr >> 12) - 0xB] = val & 0x1F;
+      nes_mmc2_update_chr(nes);
+      break;
+    case 0xF:
+      // four-screen boards have the mirroring hardwired
+      if (nes_cart_get_mirroring(nes) == MIRROR_NONE)
+        break;
+      if (val & 0x01)
+        nes_cart_set_mirroring(nes, MIRROR_HORIZONTAL);
+      else
+        nes_cart_set_mirroring(nes, MIRROR_VERTICAL);
+      break;
+  }
+}
+
+static uint8_t nes_mem_read_mmc2(nes_t *nes, uint16_t addr) {
+  if (addr < 0x2000) return nes_ram_read(nes, addr & 0x07FF);
+  if ((addr == 0x4016) || (addr == 0x4017))
+    return nes_input_read(nes, addr - 0x4016);
+  if (addr < 0x4000) return nes_ppu_read(nes, addr & 0x0007);
+  if (addr < 0x4020) return nes_apu_read(nes, addr - 0x4000);
+  if (addr >= 0x8000) return nes_prg_read(nes, addr);
+  if (addr >= 0x6000) return nes_prgram_read(nes, addr - 0x6000);
+
+  return 0x00;
+}
+
+static void nes_mem_write_mmc2(nes_t *nes, uint16_t addr, uint8_t val) {
+  if (addr < 0x2000) {nes_ram_write(nes, addr & 0x07FF, val); return;}
+  if (addr < 0x4000) {nes_ppu_write(nes, addr & 0x0007, val); return;}
+  if (addr == 0x4014) {nes_ppu_oamdma(nes, val); return;}
+  if (addr == 0x4016) {
+    nes_input_write(nes, addr - 0x4016, val);
+    return;
+  }
+  if (addr < 0x4020) {nes_apu_write(nes, addr - 0x4000, val); return;}
+  if (addr >= 0xA000) {
+    // $A000 switches the 8k bank at $8000, the rest is fixed to the last three
+    if (addr < 0xB000) nes_mmc2_map_prg(nes, 0, val & 0x0F);
+    else nes_mmc2_write(nes, addr, val);
+    return;
+  }
+  if (addr >= 0x8000) return;
+  if (addr >= 0x6000) {nes_prgram_write(nes, addr - 0x6000, val); return;}
+}
+
+static uint8_t nes_vmem_read_mmc2(nes_t *nes, uint16_t addr) {
+  addr &= 0x3FFF;
+  if (addr >= 0x3F00) {
+    addr &= 0x001F;
+    if (addr >= 0x10 && (addr & 0x03) == 0)
+      addr -= 0x10;
+    return nes->vmem.pal[addr];
+  }
+  if (addr < 0x2000) return nes_chr_read(nes, addr);
+  return nes_nt_read(nes, addr);
+}
+
+static void nes_vmem_write_mmc2(nes_t *nes, uint16_t addr, uint8_t val) {
+  addr &= 0x3FFF;
+  if (addr >= 0x3F00) {
+    addr &= 0x001F;
+    if (addr >= 0x10 && (addr & 0x03) == 0)
+      addr -= 0x10;
+    nes->vmem.pal[addr] = val;
+  } else if (addr < 0x2000) {
+    nes_chr_write(nes, addr, val);
+  } else {
+    nes_nt_write(nes, addr, val);
+  }
+}
+
+static void nes_fetch_mmc2(nes_t *nes, uint16_t addr) {
+  nes_mmc2_latch(nes, addr, 0);
+}
+
+// sets up CHR and the latches, shared with MMC4
+static inline void nes_mmc2_init_chr(nes_t *nes) {
+  nes_mmc2_extra_t *mmc = calloc(1, sizeof(nes_mmc2_extra_t));
+  nes->cart.mapper.extra = mmc;
+  mmc->latch[0] = 1;
+  mmc->latch[1] = 1;
+  nes_mmc2_update_chr(nes);
+
+  nes->mem.wram = nes->mem.prgram;
+}
+
+static void nes_init_mmc2(nes_t *nes) {
+  nes_mmc2_init_chr(nes);
+  nes_mmc2_map_prg(nes, 0, 0);
+  nes_mmc2_map_prg(nes, 1, nes->cart.rom16_count * 2 - 3);
+  nes_mmc2_map_prg(nes, 2, nes->cart.rom16_count * 2 - 2);
+  nes_mmc2_map_prg(nes, 3, nes->cart.rom16_count * 2 - 1);
+}
+
+static void nes_cleanup_mmc2(nes_t *nes) {
+  free(nes->cart.mapper.extra);
+  nes->cart.mapper.extra = NULL;
+}
+
+static void nes_clone_mmc2(nes_t *nes, nes_t *src) {
+  nes->cart.mapper.extra = nes_mapper_copy_extra(src, sizeof(nes_mmc2_extra_t));
+}
+
+// registry stuff
+
+MAPPER_REG_FUNC
+static void nes_register_mmc2() {
+  static const char *mapper_name = "MMC2";
+  static nes_mapper_funcs_t mapper_funcs = {
+    .init = nes_init_mmc2, .cleanup = nes_cleanup_mmc2,
+    .clone = nes_clone_mmc2,
+    .read = nes_mem_read_mmc2, .write = nes_mem_write_mmc2,
+    .vread = nes_vmem_read_mmc2, .vwrite = nes_vmem_write_mmc2,
+    .fetch = nes_fetch_mmc2,
+  };
+
+  nes_reg_mapper(NES_MAPPER_ID_MMC2, mapper_name, &mapper_funcs);
+}
+
+MAPPER_UNREG_FUNC
+static void nes_unregister_mmc2() {
+  nes_unreg_mapper(NES_MAPPER_ID_MMC2);
+}
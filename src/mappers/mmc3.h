@@ -6,6 +6,7 @@
 #include "../nes_cpu.h"
 #include "../nes_input.h"
 #include "../nes_ppu.h"
+#include "../nes_cart.h"
 
 #define NES_MAPPER_ID_MMC3 4
 
@@ -15,8 +16,6 @@ typedef struct {
   uint8_t reg[8];
   uint8_t prg_mode;
   uint8_t chr_mode;
-  uint32_t prg_offset[4];
-  uint32_t chr_offset[8];
   uint8_t reload;
   uint8_t counter;
   uint8_t irq;
@@ -40,46 +39,37 @@ static inline uint32_t nes_mmc3_chr_offset(nes_t *nes, int32_t idx) {
   return offset;
 }
 
-// updates bank offsets
-static inline void nes_mmc3_update_offsets(nes_t *nes) {
+// maps the 8k PRG bank with the given index into an 8k slot
+static inline void nes_mmc3_map_prg(nes_t *nes, uint8_t slot, int32_t idx) {
+  nes_prg_map(nes, slot, 1, nes->cart.prg + nes_mmc3_prg_offset(nes, idx));
+}
+
+// maps the 1k CHR bank with the given index into a 1k slot
+static inline void nes_mmc3_map_chr(nes_t *nes, uint8_t slot, int32_t idx) {
+  nes_chr_map(nes, slot, 1, nes->cart.chr + nes_mmc3_chr_offset(nes, idx));
+}
+
+// updates the PRG/CHR page tables from the bank registers
+static inline void nes_mmc3_update_banks(nes_t *nes) {
   nes_mmc3_extra_t *mmc = nes->cart.mapper.extra;
-  switch (mmc->prg_mode) {
-    case 0:
-      mmc->prg_offset[0] = nes_mmc3_prg_offset(nes, mmc->reg[6]);
-      mmc->prg_offset[1] = nes_mmc3_prg_offset(nes, mmc->reg[7]);
-      mmc->prg_offset[2] = nes_mmc3_prg_offset(nes, -2);
-      mmc->prg_offset[3] = nes_mmc3_prg_offset(nes, -1);
-      break;
-    case 1:
-      mmc->prg_offset[2] = nes_mmc3_prg_offset(nes, mmc->reg[6]);
-      mmc->prg_offset[1] = nes_mmc3_prg_offset(nes, mmc->reg[7]);
-      mmc->prg_offset[0] = nes_mmc3_prg_offset(nes, -2);
-      mmc->prg_offset[3] = nes_mmc3_prg_offset(nes, -1);
-      break;
-  }
 
-  switch (mmc->chr_mode) {
-    case 0:
-      mmc->chr_offset[0] = nes_mmc3_chr_offset(nes, mmc->reg[0] & 0xFE);
-      mmc->chr_offset[1] = nes_mmc3_chr_offset(nes, mmc->reg[0] | 0x01);
-      mmc->chr_offset[2] = nes_mmc3_chr_offset(nes, mmc->reg[1] & 0xFE);
-      mmc->chr_offset[3] = nes_mmc3_chr_offset(nes, mmc->reg[1] | 0x01);
-      mmc->chr_offset[4] = nes_mmc3_chr_offset(nes, mmc->reg[2]);
-      mmc->chr_offset[5] = nes_mmc3_chr_offset(nes, mmc->reg[3]);
-      mmc->chr_offset[6] = nes_mmc3_chr_offset(nes, mmc->reg[4]);
-      mmc->chr_offset[7] = nes_mmc3_chr_offset(nes, mmc->reg[5]);
-      break;
-    case 1:
-      mmc->chr_offset[4] = nes_mmc3_chr_offset(nes, mmc->reg[0] & 0xFE);
-      mmc->chr_offset[5] = nes_mmc3_chr_offset(nes, mmc->reg[0] | 0x01);
-      mmc->chr_offset[6] = nes_mmc3_chr_offset(nes, mmc->reg[1] & 0xFE);
-      mmc->chr_offset[7] = nes_mmc3_chr_offset(nes, mmc->reg[1] | 0x01);
-      mmc->chr_offset[0] = nes_mmc3_chr_offset(nes, mmc->reg[2]);
-      mmc->chr_offset[1] = nes_mmc3_chr_offset(nes, mmc->reg[3]);
-      mmc->chr_offset[2] = nes_mmc3_chr_offset(nes, mmc->reg[4]);
-      mmc->chr_offset[3] = nes_mmc3_chr_offset(nes, mmc->reg[5]);
-      break;
-  }
+  // in mode 1 the switchable $8000 slot and the fixed $C000 slot swap places
+  uint8_t prg_slot = mmc->prg_mode ? 2 : 0;
+  nes_mmc3_map_prg(nes, prg_slot, mmc->reg[6]);
+  nes_mmc3_map_prg(nes, 1, mmc->reg[7]);
+  nes_mmc3_map_prg(nes, prg_slot ^ 2, -2);
+  nes_mmc3_map_prg(nes, 3, -1);
+
+  // in mode 1 the 2k and 1k halves of the CHR space swap places
+  uint8_t chr_slot = mmc->chr_mode ? 4 : 0;
+  nes_mmc3_map_chr(nes, chr_slot + 0, mmc->reg[0] & 0xFE);
+  nes_mmc3_map_chr(nes, chr_slot + 1, mmc->reg[0] | 0x01);
+  nes_mmc3_map_chr(nes, chr_slot + 2, mmc->reg[1] & 0xFE);
+  nes_mmc3_map_chr(nes, chr_slot + 3, mmc->reg[1] | 0x01);
+  nes_mmc3_map_chr(nes, (chr_slot ^ 4) + 0, mmc->reg[2]);
+  nes_mmc3_map_chr(nes, (chr_slot ^ 4) + 1, mmc->reg[3]);
+  nes_mmc3_map_chr(nes, (chr_slot ^ 4) + 2, mmc->reg[4]);
+  nes_mmc3_map_chr(nes, (chr_slot ^ 4) + 3, mmc->reg[5]);
 }
 
 // checks for and triggers scanline IRQ
@@ -100,18 +90,21 @@ static inline void nes_mmc3_write_bankselect(nes_t *nes, uint8_t val) {
   mmc->prg_mode = (val >> 6) & 0x01;
   mmc->chr_mode = (val >> 7) & 0x01;
   mmc->reg_idx = val & 0x07;
-  nes_mmc3_update_offsets(nes);
+  nes_mmc3_update_banks(nes);
 }
 
 // writes to MMC3 BANKDATA register
 static inline void nes_mmc3_write_bankdata(nes_t *nes, uint8_t val) {
   nes_mmc3_extra_t *mmc = nes->cart.mapper.extra;
   mmc->reg[mmc->reg_idx] = val;
-  nes_mmc3_update_offsets(nes);
+  nes_mmc3_update_banks(nes);
 }
 
 // writes to MMC3 MIRROR register
 static inline void nes_mmc3_write_mirror(nes_t *nes, uint8_t val) {
+  // four-screen boards have the mirroring hardwired
+  if (nes_cart_get_mirroring(nes) == MIRROR_NONE)
+    return;
   if (val & 0x01)
     nes_cart_set_mirroring(nes, MIRROR_HORIZONTAL);
   else
@@ -138,20 +131,12 @@ static inline void nes_mmc3_write(nes_t *nes, uint16_t addr, uint8_t val) {
 }
 
 static uint8_t nes_mem_read_mmc3(nes_t *nes, uint16_t addr) {
-  nes_mmc3_extra_t *mmc = nes->cart.mapper.extra;
   if (addr < 0x2000) return nes_ram_read(nes, addr & 0x07FF);
   if ((addr == 0x4016) || (addr == 0x4017))
     return nes_input_read(nes, addr - 0x4016);
   if (addr < 0x4000) return nes_ppu_read(nes, addr & 0x0007);
   if (addr < 0x4020) return nes_apu_read(nes, addr - 0x4000);
-  if (addr >= 0x8000) {
-    addr -= 0x8000;
-    uint16_t bank8 = addr / 0x2000;
-    uint16_t offset = addr & 0x1FFF;
-    uint16_t bank16 = mmc->prg_offset[bank8] / 0x4000;
-    uint16_t bank8_base = 0x2000 * ((mmc->prg_offset[bank8] / 0x2000) & 0x01);
-    return nes->cart.rom[bank16][bank8_base + offset];
-  }
+  if (addr >= 0x8000) return nes_prg_read(nes, addr);
   if (addr >= 0x6000) return nes_prgram_read(nes, addr - 0x6000);
 
   return 0x00;
@@ -171,7 +156,6 @@ static void nes_mem_write_mmc3(nes_t *nes, uint16_t addr, uint8_t val) {
 }
 
 static uint8_t nes_vmem_read_mmc3(nes_t *nes, uint16_t addr) {
-  nes_mmc3_extra_t *mmc = nes->cart.mapper.extra;
   addr &= 0x3FFF;
   if (addr >= 0x3F00) {
     addr &= 0x001F;
@@ -179,18 +163,11 @@ static uint8_t nes_vmem_read_mmc3(nes_t *nes, uint16_t addr) {
       addr -= 0x10;
     return nes->vmem.pal[addr];
   }
-  if (addr < 0x2000) {
-    uint16_t bank1 = addr / 0x0400;
-    uint16_t offset = addr % 0x0400;
-    uint16_t bank8 = mmc->chr_offset[bank1] / 0x2000;
-    uint16_t bank1_base = 0x0400 * ((mmc->chr_offset[bank1] / 0x0400) & 0x07);
-    return nes->cart.vram[bank8][bank1_base + offset];
-  }
-  return nes->vmem.vram[nes->cart.mirror(addr)];
+  if (addr < 0x2000) return nes_chr_read(nes, addr);
+  return nes_nt_read(nes, addr);
 }
 
 static void nes_vmem_write_mmc3(nes_t *nes, uint16_t addr, uint8_t val) {
-  nes_mmc3_extra_t *mmc = nes->cart.mapper.extra;
   addr &= 0x3FFF;
   if (addr >= 0x3F00) {
     addr &= 0x001F;
@@ -198,36 +175,29 @@ static void nes_vmem_write_mmc3(nes_t *nes, uint16_t addr, uint8_t val) {
       addr -= 0x10;
     nes->vmem.pal[addr] = val;
   } else if (addr < 0x2000) {
-    if (!nes->cart.chr_ram) return;
-    uint16_t bank1 = addr / 0x0400;
-    uint16_t offset = addr % 0x0400;
-    uint16_t bank8 = mmc->chr_offset[bank1] / 0x2000;
-    uint16_t bank1_base = 0x0400 * ((mmc->chr_offset[bank1] / 0x0400) & 0x07);
-    nes->cart.vram[bank8][bank1_base + offset] = val;
+    nes_chr_write(nes, addr, val);
   } else {
-    nes->vmem.vram[nes->cart.mirror(addr)] = val;
+    nes_nt_write(nes, addr, val);
   }
 }
 
 static void nes_init_mmc3(nes_t *nes) {
   nes_mmc3_extra_t *mmc = calloc(1, sizeof(nes_mmc3_extra_t));
   nes->cart.mapper.extra = mmc;
-  mmc->prg_offset[0] = nes_mmc3_prg_offset(nes, 0);
-  mmc->prg_offset[1] = nes_mmc3_prg_offset(nes, 1);
-  mmc->prg_offset[2] = nes_mmc3_prg_offset(nes, -2);
-  mmc->prg_offset[3] = nes_mmc3_prg_offset(nes, -1);
-  nes->mem.prg[0] = NULL;
-  nes->mem.prg[1] = NULL;
+  nes_mmc3_map_prg(nes, 0, 0);
+  nes_mmc3_map_prg(nes, 1, 1);
+  nes_mmc3_map_prg(nes, 2, -2);
+  nes_mmc3_map_prg(nes, 3, -1);
+  for (int i = 0; i < 8; ++i)
+    nes_mmc3_map_chr(nes, i, 0);
+
+  nes->mem.wram = nes->mem.prgram;
 }
 
-static void nes_tick_mmc3(nes_t *nes) {
-  if (nes->ppu.cycle != 260)
-    return;
-  if (nes->ppu.scanline > 239 && nes->ppu.scanline < 261)
-    return;
-  if (!BITGET(nes->ppu.mask, NES_PPU_MASK_BG) &&
-      !BITGET(nes->ppu.mask, NES_PPU_MASK_SPR))
-    return;
+// the IRQ counter is clocked by rises of PPU address line A12, which
+// normally happens once per line when sprites and background use
+// different pattern tables
+static void nes_event_mmc3(nes_t *nes, uint8_t ev) {
   nes_mmc3_scanline(nes);
 }
 
@@ -236,6 +206,10 @@ static void nes_cleanup_mmc3(nes_t *nes) {
   nes->cart.mapper.extra = NULL;
 }
 
+static void nes_clone_mmc3(nes_t *nes, nes_t *src) {
+  nes->cart.mapper.extra = nes_mapper_copy_extra(src, sizeof(nes_mmc3_extra_t));
+}
+
 // registry stuff
 
 MAPPER_REG_FUNC
@@ -243,9 +217,10 @@ static void nes_register_mmc3() {
   static const char *mapper_name = "MMC3";
   static nes_mapper_funcs_t mapper_funcs = {
     .init = nes_init_mmc3, .cleanup = nes_cleanup_mmc3,
+    .clone = nes_clone_mmc3,
     .read = nes_mem_read_mmc3, .write = nes_mem_write_mmc3,
     .vread = nes_vmem_read_mmc3, .vwrite = nes_vmem_write_mmc3,
-    .tick = nes_tick_mmc3,
+    .event = nes_event_mmc3, .events = BIT(NES_MAPPER_EVENT_A12),
   };
 
   nes_reg_mapper(NES_MAPPER_ID_MMC3, mapper_name, &mapper_funcs);
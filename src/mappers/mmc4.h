@@ -0,0 +1,53 @@
+#pragma once
+
+#include "mmc2.h"
+
+#define NES_MAPPER_ID_MMC4 10
+
+// MMC4 is MMC2 with 16k PRG banking and wider latch 0 triggers
+
+// maps the 16k PRG bank with the given index into a 16k slot
+static inline void nes_mmc4_map_prg(nes_t *nes, uint8_t slot, uint32_t idx) {
+  if (!nes->cart.rom16_count) return;
+  nes_prg_map(nes, slot * 2, 2, nes->cart.rom[idx % nes->cart.rom16_count]);
+}
+
+static void nes_mem_write_mmc4(nes_t *nes, uint16_t addr, uint8_t val) {
+  if (addr >= 0xA000 && addr < 0xB000) {
+    nes_mmc4_map_prg(nes, 0, val & 0x0F);
+    return;
+  }
+
+  nes_mem_write_mmc2(nes, addr, val);
+}
+
+static void nes_fetch_mmc4(nes_t *nes, uint16_t addr) {
+  nes_mmc2_latch(nes, addr, 1);
+}
+
+static void nes_init_mmc4(nes_t *nes) {
+  nes_mmc2_init_chr(nes);
+  nes_mmc4_map_prg(nes, 0, 0);
+  nes_mmc4_map_prg(nes, 1, nes->cart.rom16_count - 1);
+}
+
+// registry stuff
+
+MAPPER_REG_FUNC
+static void nes_register_mmc4() {
+  static const char *mapper_name = "MMC4";
+  static nes_mapper_funcs_t mapper_funcs = {
+    .init = nes_init_mmc4, .cleanup = nes_cleanup_mmc2,
+    .clone = nes_clone_mmc2,
+    .read = nes_mem_read_mmc2, .write = nes_mem_write_mmc4,
+    .vread = nes_vmem_read_mmc2, .vwrite = nes_vmem_write_mmc2,
+    .fetch = nes_fetch_mmc4,
+  };
+
+  nes_reg_mapper(NES_MAPPER_ID_MMC4, mapper_name, &mapper_funcs);
+}
+
+MAPPER_UNREG_FUNC
+static void nes_unregister_mmc4() {
+  nes_unreg_mapper(NES_MAPPER_ID_MMC4);
+}
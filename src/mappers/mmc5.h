@@ -0,0 +1,470 @@
+#pragma once
+
+#include "../nes_mappers.h"
+#include "../nes_mem.h"
+#include "../nes_apu.h"
+#include "../nes_cpu.h"
+#include "../nes_input.h"
+#include "../nes_ppu.h"
+#include "../nes_cart.h"
+
+#define NES_MAPPER_ID_MMC5 5
+
+// extra mapper data for MMC5
+typedef struct {
+  uint8_t prg_mode; // $5100
+  uint8_t chr_mode; // $5101
+  uint8_t protect[2]; // $5102-$5103, PRG-RAM is writable when they're 2, 1
+  uint8_t ex_mode; // $5104
+  uint8_t nt_map; // $5105
+  uint8_t fill_tile; // $5106
+  uint8_t fill_attr; // $5107
+  uint8_t prg[5]; // $5113-$5117, bit 7 selects ROM over RAM
+  uint16_t chr[12]; // $5120-$512B with the $5130 bits on top
+  uint8_t chr_hi; // $5130
+  uint8_t last_b; // 1 if $5128-$512B were written last
+  uint8_t split_ctrl; // $5200
+  uint8_t split_scroll; // $5201
+  uint8_t split_bank; // $5202
+  uint8_t irq_target; // $5203
+  uint8_t irq_enable;
+  uint8_t irq_pending;
+  uint8_t in_frame;
+  uint8_t counter;
+  uint8_t mul[2]; // $5205-$5206
+
+  uint8_t prg_ram[4]; // 1 if the 8k slot at $8000+ maps PRG-RAM
+
+  // fetch state for the tile being fetched
+  uint8_t ex_tile; // its ExRAM byte (extended attribute mode)
+  uint8_t in_split; // 1 if it's in the split region
+  uint8_t split_x; // its column in the split region
+  uint8_t split_y; // current line in the split region
+
+  uint8_t *chr_a[8]; // $5120-$5127 banks (sprites in 8x16 mode)
+  uint8_t *chr_b[8]; // $5128-$512B banks (background in 8x16 mode)
+
+  uint8_t exram[0x400]; // expansion RAM
+  uint8_t fill[0x400]; // fill mode nametable
+} nes_mmc5_extra_t;
+
+// maps an 8k PRG-ROM or PRG-RAM bank into an 8k slot
+static inline void nes_mmc5_map_prg_page(nes_t *nes, uint8_t slot, uint8_t rom, uint8_t idx) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+
+  mmc->prg_ram[slot] = !rom;
+  if (rom) {
+    uint32_t count = nes->cart.rom16_count * 2;
+    nes_prg_map(nes, slot, 1, nes->cart.prg + (idx % count) * 0x2000);
+  } else if (nes->mem.prgram_size >= 0x2000) {
+    uint32_t count = nes->mem.prgram_size / 0x2000;
+    nes_prg_map(nes, slot, 1, nes->mem.prgram + (idx % count) * 0x2000);
+  } else {
+    nes_prg_map(nes, slot, 1, NULL);
+  }
+}
+
+// maps count 8k pages from a bank register, starting at slot
+static inline void nes_mmc5_map_prg(nes_t *nes, uint8_t slot, uint8_t count, uint8_t reg) {
+  uint8_t idx = (reg & 0x7F) & ~(count - 1);
+  for (int i = 0; i < count; ++i)
+    nes_mmc5_map_prg_page(nes, slot + i, reg & 0x80, idx + i);
+}
+
+// updates the PRG page tables and the $6000 window from the bank registers
+static inline void nes_mmc5_update_prg(nes_t *nes) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+  if (!nes->cart.rom16_count) return;
+
+  // $E000 is always ROM
+  uint8_t last = mmc->prg[4] | 0x80;
+  switch (mmc->prg_mode) {
+    case 0:
+      nes_mmc5_map_prg(nes, 0, 4, last);
+      break;
+    case 1:
+      nes_mmc5_map_prg(nes, 0, 2, mmc->prg[2]);
+      nes_mmc5_map_prg(nes, 2, 2, last);
+      break;
+    case 2:
+      nes_mmc5_map_prg(nes, 0, 2, mmc->prg[2]);
+      nes_mmc5_map_prg(nes, 2, 1, mmc->prg[3]);
+      nes_mmc5_map_prg(nes, 3, 1, last);
+      break;
+    case 3:
+      nes_mmc5_map_prg(nes, 0, 1, mmc->prg[1]);
+      nes_mmc5_map_prg(nes, 1, 1, mmc->prg[2]);
+      nes_mmc5_map_prg(nes, 2, 1, mmc->prg[3]);
+      nes_mmc5_map_prg(nes, 3, 1, last);
+      break;
+  }
+
+  if (nes->mem.prgram_size >= 0x2000) {
+    uint32_t count = nes->mem.prgram_size / 0x2000;
+    nes->mem.wram = nes->mem.prgram + ((mmc->prg[0] & 0x07) % count) * 0x2000;
+  }
+}
+
+// maps a bank of count 1k pages into one of the CHR sets
+static inline void nes_mmc5_map_chr(nes_t *nes, uint8_t **set, uint8_t slot,
+                                    uint8_t count, uint16_t bank) {
+  uint32_t size = nes->cart.vram8_count * 0x2000;
+  uint8_t *data = nes->cart.chr + ((uint32_t)bank * count * 0x0400) % size;
+
+  for (int i = 0; i < count; ++i) {
+    if (set[slot + i] != data + i * 0x0400) {
+      set[slot + i] = data + i * 0x0400;
+      nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_CHR);
+    }
+  }
+}
+
+// updates both CHR sets from the bank registers; the CPU ($2007) sees the
+// last written one
+static inline void nes_mmc5_update_chr(nes_t *nes) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+  uint8_t count = 8 >> mmc->chr_mode;
+
+  // each bank uses the last register of its range; set B only has
+  // the four for $0000-$0FFF and repeats them at $1000
+  for (int i = 0; i < 8; i += count) {
+    nes_mmc5_map_chr(nes, mmc->chr_a, i, count, mmc->chr[i + count - 1]);
+    nes_mmc5_map_chr(nes, mmc->chr_b, i, count, mmc->chr[8 + ((i + count - 1) & 0x03)]);
+  }
+
+  for (int i = 0; i < 8; ++i)
+    nes_chr_map(nes, i, 1, mmc->last_b ? mmc->chr_b[i] : mmc->chr_a[i]);
+}
+
+// refills the fill mode nametable
+static inline void nes_mmc5_update_fill(nes_t *nes) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+  memset(mmc->fill, mmc->fill_tile, 0x3C0);
+  memset(mmc->fill + 0x3C0, mmc->fill_attr * 0x55, 0x40);
+  nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_VRAM);
+}
+
+// points the nametables where $5105 says
+static inline void nes_mmc5_update_nt(nes_t *nes) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+
+  for (int i = 0; i < 4; ++i) {
+    switch ((mmc->nt_map >> (i * 2)) & 0x03) {
+      case 0: nes_cart_set_nametable(nes, i, nes->vmem.vram); break;
+      case 1: nes_cart_set_nametable(nes, i, nes->vmem.vram + 0x400); break;
+      case 2: nes_cart_set_nametable(nes, i, mmc->exram); break;
+      case 3: nes_cart_set_nametable(nes, i, mmc->fill); break;
+    }
+  }
+}
+
+// 1 if PRG-RAM writes are enabled
+static inline int nes_mmc5_ram_writable(nes_mmc5_extra_t *mmc) {
+  return mmc->protect[0] == 0x02 && mmc->protect[1] == 0x01;
+}
+
+// reads MMC5 registers and ExRAM at $5000-$5FFF
+static inline uint8_t nes_mmc5_read(nes_t *nes, uint16_t addr) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+
+  if (addr == 0x5204) {
+    uint8_t res = (mmc->irq_pending << 7) | (mmc->in_frame << 6);
+    mmc->irq_pending = 0;
+    return res;
+  }
+  if (addr == 0x5205) return (mmc->mul[0] * mmc->mul[1]) & 0xFF;
+  if (addr == 0x5206) return (mmc->mul[0] * mmc->mul[1]) >> 8;
+  if (addr >= 0x5C00 && mmc->ex_mode >= 2) return mmc->exram[addr - 0x5C00];
+
+  return 0x00;
+}
+
+// writes MMC5 registers and ExRAM at $5000-$5FFF
+// NOTE: the audio registers at $5000-$5015 are not emulated
+static inline void nes_mmc5_write(nes_t *nes, uint16_t addr, uint8_t val) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+
+  if (addr >= 0x5C00) {
+    if (mmc->ex_mode != 3) {
+      mmc->exram[addr - 0x5C00] = val;
+      nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_VRAM);
+    }
+  } else if (addr >= 0x5113 && addr <= 0x5117) {
+    mmc->prg[addr - 0x5113] = val;
+    nes_mmc5_update_prg(nes);
+  } else if (addr >= 0x5120 && addr <= 0x512B) {
+    mmc->chr[addr - 0x5120] = val | (mmc->chr_hi << 8);
+    mmc->last_b = addr >= 0x5128;
+    nes_mmc5_update_chr(nes);
+  } else {
+    switch (addr) {
+      case 0x5100: mmc->prg_mode = val & 0x03; nes_mmc5_update_prg(nes); break;
+      case 0x5101: mmc->chr_mode = val & 0x03; nes_mmc5_update_chr(nes); break;
+      case 0x5102: mmc->protect[0] = val & 0x03; break;
+      case 0x5103: mmc->protect[1] = val & 0x03; break;
+      case 0x5104:
+        mmc->ex_mode = val & 0x03;
+        nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_VRAM);
+        break;
+      case 0x5105: mmc->nt_map = val; nes_mmc5_update_nt(nes); break;
+      case 0x5106: mmc->fill_tile = val; nes_mmc5_update_fill(nes); break;
+      case 0x5107: mmc->fill_attr = val & 0x03; nes_mmc5_update_fill(nes); break;
+      case 0x5130: mmc->chr_hi = val & 0x03; break;
+      case 0x5200: mmc->split_ctrl = val; nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_REGS); break;
+      case 0x5201: mmc->split_scroll = val; nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_REGS); break;
+      case 0x5202: mmc->split_bank = val; nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_REGS); break;
+      case 0x5203: mmc->irq_target = val; break;
+      case 0x5204:
+        // a pending IRQ goes off once the write's instruction is done
+        mmc->irq_enable = val >> 7;
+        if (mmc->irq_enable && mmc->irq_pending)
+          nes_mapper_timer_set(nes, nes->apu.cycle);
+        break;
+      case 0x5205: mmc->mul[0] = val; break;
+      case 0x5206: mmc->mul[1] = val; break;
+    }
+  }
+}
+
+static uint8_t nes_mem_read_mmc5(nes_t *nes, uint16_t addr) {
+  if (addr < 0x2000) return nes_ram_read(nes, addr & 0x07FF);
+  if ((addr == 0x4016) || (addr == 0x4017))
+    return nes_input_read(nes, addr - 0x4016);
+  if (addr < 0x4000) return nes_ppu_read(nes, addr & 0x0007);
+  if (addr < 0x4020) return nes_apu_read(nes, addr - 0x4000);
+  if (addr >= 0x8000) return nes_prg_read(nes, addr);
+  if (addr >= 0x6000) return nes_prgram_read(nes, addr - 0x6000);
+  if (addr >= 0x5000) return nes_mmc5_read(nes, addr);
+
+  return 0x00;
+}
+
+static void nes_mem_write_mmc5(nes_t *nes, uint16_t addr, uint8_t val) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+
+  if (addr < 0x2000) {nes_ram_write(nes, addr & 0x07FF, val); return;}
+  if (addr < 0x4000) {nes_ppu_write(nes, addr & 0x0007, val); return;}
+  if (addr == 0x4014) {nes_ppu_oamdma(nes, val); return;}
+  if (addr == 0x4016) {
+    nes_input_write(nes, addr - 0x4016, val);
+    return;
+  }
+  if (addr < 0x4020) {nes_apu_write(nes, addr - 0x4000, val); return;}
+  if (addr >= 0x8000) {
+    // PRG-RAM can be banked in at $8000-$DFFF too
+    uint8_t slot = (addr >> 13) & 0x03;
+    if (mmc->prg_ram[slot] && nes->mem.prg[slot] && nes_mmc5_ram_writable(mmc)) {
+      nes->mem.prg[slot][addr & 0x1FFF] = val;
+      nes->mem.wram_dirty = 1;
+    }
+    return;
+  }
+  if (addr >= 0x6000) {
+    if (nes_mmc5_ram_writable(mmc))
+      nes_prgram_write(nes, addr - 0x6000, val);
+    return;
+  }
+  if (addr >= 0x5000) nes_mmc5_write(nes, addr, val);
+}
+
+static uint8_t nes_vmem_read_mmc5(nes_t *nes, uint16_t addr) {
+  addr &= 0x3FFF;
+  if (addr >= 0x3F00) {
+    addr &= 0x001F;
+    if (addr >= 0x10 && (addr & 0x03) == 0)
+      addr -= 0x10;
+    return nes->vmem.pal[addr];
+  }
+  if (addr < 0x2000) return nes_chr_read(nes, addr);
+  return nes_nt_read(nes, addr);
+}
+
+static void nes_vmem_write_mmc5(nes_t *nes, uint16_t addr, uint8_t val) {
+  addr &= 0x3FFF;
+  if (addr >= 0x3F00) {
+    addr &= 0x001F;
+    if (addr >= 0x10 && (addr & 0x03) == 0)
+      addr -= 0x10;
+    nes->vmem.pal[addr] = val;
+  } else if (addr < 0x2000) {
+    nes_chr_write(nes, addr, val);
+  } else {
+    nes_nt_write(nes, addr, val);
+  }
+}
+
+// rendering fetch hooks
+
+// nametable fetch: decides whether the tile is in the split region and
+// picks up its ExRAM byte for extended attribute mode
+static uint8_t nes_nt_fetch_mmc5(nes_t *nes, uint16_t addr) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+
+  mmc->in_split = 0;
+  if ((mmc->split_ctrl & 0x80) && mmc->ex_mode <= 1) {
+    // dots 321-336 fetch the first two tiles of the next line
+    int tile, line;
+    if (nes->ppu.cycle >= 321) {
+      tile = (nes->ppu.cycle - 321) >> 3;
+      line = (nes->ppu.scanline == 261) ? 0 : nes->ppu.scanline + 1;
+    } else {
+      tile = ((nes->ppu.cycle - 1) >> 3) + 2;
+      line = nes->ppu.scanline;
+    }
+
+    int threshold = mmc->split_ctrl & 0x1F;
+    if (tile < 32 && ((mmc->split_ctrl & 0x40) ? tile >= threshold : tile < threshold)) {
+      mmc->in_split = 1;
+      mmc->split_x = tile;
+      mmc->split_y = (mmc->split_scroll + line) % 240;
+      return mmc->exram[(mmc->split_y >> 3) * 32 + tile];
+    }
+  }
+
+  if (mmc->ex_mode == 1)
+    mmc->ex_tile = mmc->exram[addr & 0x03FF];
+
+  return nes_nt_read(nes, addr);
+}
+
+// attribute fetch; ExRAM palettes get repeated in all four positions, so
+// whatever quadrant the PPU picks gets the right one
+static uint8_t nes_at_fetch_mmc5(nes_t *nes, uint16_t addr) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+
+  if (mmc->in_split) {
+    uint8_t attr = mmc->exram[0x3C0 + (mmc->split_y >> 5) * 8 + (mmc->split_x >> 2)];
+    uint8_t shift = ((mmc->split_y >> 2) & 0x04) | (mmc->split_x & 0x02);
+    return ((attr >> shift) & 0x03) * 0x55;
+  }
+  if (mmc->ex_mode == 1)
+    return (mmc->ex_tile >> 6) * 0x55;
+
+  return nes_nt_read(nes, addr);
+}
+
+// background pattern fetch: split region and extended attribute tiles come
+// from their own 4k banks, 8x16 sprite mode uses set B
+static uint8_t nes_bg_fetch_mmc5(nes_t *nes, uint16_t addr) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+  uint32_t size = nes->cart.vram8_count * 0x2000;
+
+  if (mmc->in_split) {
+    uint32_t offset = (mmc->split_bank * 0x1000) % size;
+    return nes->cart.chr[offset + ((addr & 0x0FF8) | (mmc->split_y & 0x07))];
+  }
+  if (mmc->ex_mode == 1) {
+    uint32_t bank = (mmc->ex_tile & 0x3F) | (mmc->chr_hi << 6);
+    return nes->cart.chr[(bank * 0x1000) % size + (addr & 0x0FFF)];
+  }
+  if (BITGET(nes->ppu.ctrl, NES_PPU_CTRL_SPRSIZE))
+    return mmc->chr_b[(addr >> 10) & 0x07][addr & 0x03FF];
+
+  return nes_chr_read(nes, addr);
+}
+
+// sprite pattern fetch: 8x16 sprite mode uses set A
+static uint8_t nes_spr_fetch_mmc5(nes_t *nes, uint16_t addr) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+
+  if (BITGET(nes->ppu.ctrl, NES_PPU_CTRL_SPRSIZE))
+    return mmc->chr_a[(addr >> 10) & 0x07][addr & 0x03FF];
+
+  return nes_chr_read(nes, addr);
+}
+
+// delivers the IRQ a $5204 write enabled while it was pending
+static void nes_timer_mmc5(nes_t *nes) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+
+  nes_mapper_timer_set(nes, NES_MAPPER_TIMER_OFF);
+  if (mmc->irq_enable && mmc->irq_pending)
+    nes_cpu_irq(nes);
+}
+
+// the scanline counter runs while rendering visible lines and gets reset
+// in vblank or when rendering is off
+static void nes_event_mmc5(nes_t *nes, uint8_t ev) {
+  nes_mmc5_extra_t *mmc = nes->cart.mapper.extra;
+
+  int render = BITGET(nes->ppu.mask, NES_PPU_MASK_BG) ||
+               BITGET(nes->ppu.mask, NES_PPU_MASK_SPR);
+  if (!render || nes->ppu.scanline >= 240) {
+    mmc->in_frame = 0;
+    return;
+  }
+
+  if (!mmc->in_frame) {
+    mmc->in_frame = 1;
+    mmc->counter = 0;
+    return;
+  }
+
+  mmc->counter++;
+  if (mmc->counter == mmc->irq_target) {
+    mmc->irq_pending = 1;
+    if (mmc->irq_enable)
+      nes_cpu_irq(nes);
+  }
+}
+
+static void nes_init_mmc5(nes_t *nes) {
+  nes_mmc5_extra_t *mmc = calloc(1, sizeof(nes_mmc5_extra_t));
+  nes->cart.mapper.extra = mmc;
+
+  mmc->prg_mode = 3;
+  for (int i = 0; i < 5; ++i)
+    mmc->prg[i] = 0xFF;
+
+  nes->mem.wram = nes->mem.prgram;
+  nes_mmc5_update_prg(nes);
+  nes_mmc5_update_chr(nes);
+  nes_mmc5_update_fill(nes);
+}
+
+static void nes_cleanup_mmc5(nes_t *nes) {
+  free(nes->cart.mapper.extra);
+  nes->cart.mapper.extra = NULL;
+}
+
+// the CHR banks may be CHR-RAM, and nametables may be the ones in here
+static void nes_clone_mmc5(nes_t *nes, nes_t *src) {
+  nes_mmc5_extra_t *from = src->cart.mapper.extra;
+  nes_mmc5_extra_t *mmc = nes_mapper_copy_extra(src, sizeof(nes_mmc5_extra_t));
+  nes->cart.mapper.extra = mmc;
+  if (!mmc) return;
+
+  for (int i = 0; i < 8; ++i) {
+    mmc->chr_a[i] = nes_cart_clone_ptr(nes, src, from->chr_a[i]);
+    mmc->chr_b[i] = nes_cart_clone_ptr(nes, src, from->chr_b[i]);
+  }
+
+  for (int i = 0; i < 4; ++i) {
+    if (src->cart.nt[i] == from->exram) nes->cart.nt[i] = mmc->exram;
+    if (src->cart.nt[i] == from->fill) nes->cart.nt[i] = mmc->fill;
+  }
+}
+
+// registry stuff
+
+MAPPER_REG_FUNC
+static void nes_register_mmc5() {
+  static const char *mapper_name = "MMC5";
+  static nes_mapper_funcs_t mapper_funcs = {
+    .init = nes_init_mmc5, .cleanup = nes_cleanup_mmc5,
+    .clone = nes_clone_mmc5,
+    .read = nes_mem_read_mmc5, .write = nes_mem_write_mmc5,
+    .vread = nes_vmem_read_mmc5, .vwrite = nes_vmem_write_mmc5,
+    .event = nes_event_mmc5, .events = BIT(NES_MAPPER_EVENT_LINE),
+    .timer = nes_timer_mmc5,
+    .nt_fetch = nes_nt_fetch_mmc5, .at_fetch = nes_at_fetch_mmc5,
+    .bg_fetch = nes_bg_fetch_mmc5, .spr_fetch = nes_spr_fetch_mmc5,
+  };
+
+  nes_reg_mapper(NES_MAPPER_ID_MMC5, mapper_name, &mapper_funcs);
+}
+
+MAPPER_UNREG_FUNC
+static void nes_unregister_mmc5() {
+  nes_unreg_mapper(NES_MAPPER_ID_MMC5);
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+#include "../nes_mappers.h"
+#include "../nes_mem.h"
+#include "../nes_apu.h"
+#include "../nes_cpu.h"
+#include "../nes_input.h"
+#include "../nes_ppu.h"
+#include "../nes_cart.h"
+
+#define NES_MAPPER_ID_N163 19
+
+#define NES_N163_AUDIO_SCALE 0.001 // level of one output unit (sample * volume)
+#define NES_N163_AUDIO_PERIOD 15 // CPU cycles between channel updates
+
+// extra mapper data for Namco 163
+typedef struct {
+  uint8_t chr[8]; // 1k CHR banks, $E0 and up select CIRAM unless disabled
+  uint8_t nt[4]; // nametable banks, same deal
+  uint8_t prg0; // $E000: PRG bank at $8000, bit 6 disables sound
+  uint8_t prg1; // $E800: PRG bank at $A000, bits 6-7 disable CIRAM in CHR
+
+  uint16_t irq_counter; // 15-bit, counts up
+  uint8_t irq_enable;
+  uint8_t irq_pending; // 1 once the counter got to $7FFF, until delivered
+  uint64_t irq_cycle; // APU cycle the counter was last brought up to
+
+  uint8_t addr; // $F800: sound RAM address, bit 7 is auto-increment
+  uint8_t ram[0x80]; // sound RAM, waveforms and channel registers
+  uint8_t cur; // channel updated next
+  uint8_t tmr; // cycles until the next channel update
+  uint8_t out[8]; // last output of every channel
+  uint16_t level; // sum of the outputs of the active channels
+  nes_apu_ext_t ext;
+} nes_n163_extra_t;
+
+// maps the 8k PRG bank with the given index into an 8k slot
+static inline void nes_n163_map_prg(nes_t *nes, uint8_t slot, uint32_t idx) {
+  if (!nes->cart.rom16_count) return;
+  idx %= nes->cart.rom16_count * 2;
+  nes_prg_map(nes, slot, 1, nes->cart.prg + idx * 0x2000);
+}
+
+// returns the 1k page selected by a CHR or nametable bank value
+static inline uint8_t *nes_n163_page(nes_t *nes, uint8_t val, int ciram) {
+  if (ciram && val >= 0xE0)
+    return nes->vmem.vram + (val & 0x01) * 0x0400;
+  return nes->cart.chr + (val % (nes->cart.vram8_count * 8)) * 0x0400;
+}
+
+static inline void nes_n163_update_chr(nes_t *nes) {
+  nes_n163_extra_t *mmc = nes->cart.mapper.extra;
+
+  for (int i = 0; i < 8; ++i) {
+    int ciram = !(mmc->prg1 & ((i < 4) ? 0x40 : 0x80));
+    nes_chr_map(nes, i, 1, nes_n163_page(nes, mmc->chr[i], ciram));
+  }
+}
+
+// audio
+
+// returns the number of active channels, which are the last ones
+static inline uint8_t nes_n163_channels(nes_n163_extra_t *mmc) {
+  return ((mmc->ram[0x7F] >> 4) & 0x07) + 1;
+}
+
+// recounts the mixed level, needed when the number of channels changes
+static inline void nes_n163_update_level(nes_n163_extra_t *mmc) {
+  mmc->level = 0;
+  for (int i = 8 - nes_n163_channels(mmc); i < 8; ++i)
+    mmc->level += mmc->out[i];
+}
+
+// advances the phase of a channel and fetches its next sample
+static inline void nes_n163_update_chan(nes_n163_extra_t *mmc, uint8_t i) {
+  uint8_t *reg = mmc->ram + 0x40 + i * 8;
+
+  uint32_t freq = reg[0] | (reg[2] << 8) | ((reg[4] & 0x03) << 16);
+  uint32_t phase = reg[1] | (reg[3] << 8) | (reg[5] << 16);
+  uint32_t len = (256 - (reg[4] & 0xFC)) << 16;
+
+  phase = (phase + freq) % len;
+  reg[1] = phase;
+  reg[3] = phase >> 8;
+  reg[5] = phase >> 16;
+
+  uint8_t pos = (phase >> 16) + reg[6];
+  uint8_t sample = (mmc->ram[pos >> 1] >> ((pos & 0x01) * 4)) & 0x0F;
+  uint8_t out = sample * (reg[7] & 0x0F);
+
+  mmc->level += out - mmc->out[i];
+  mmc->out[i] = out;
+}
+
+// brings the sound channels up to the APU; only one channel is updated at
+// a time, so the level stays put between updates and is summed in steps
+static inline void nes_n163_run(nes_t *nes) {
+  nes_n163_extra_t *mmc = nes->cart.mapper.extra;
+  uint32_t n = nes_apu_ext_span(nes, &mmc->ext);
+  if (mmc->prg0 & 0x40)
+    return; // sound disabled
+
+  uint8_t count = nes_n163_channels(mmc);
+  uint32_t sum = 0;
+
+  while (n) {
+    uint32_t step = (n < mmc->tmr) ? n : mmc->tmr;
+    sum += step * mmc->level;
+    n -= step;
+    mmc->tmr -= step;
+    if (!mmc->tmr) {
+      mmc->tmr = NES_N163_AUDIO_PERIOD;
+      if (mmc->cur < 8 - count)
+        mmc->cur = 7;
+      nes_n163_update_chan(mmc, mmc->cur);
+      mmc->cur = (mmc->cur <= 8 - count) ? 7 : mmc->cur - 1;
+    }
+  }
+
+  // the chip multiplexes its channels, so each is heard 1/count of the time
+  mmc->ext.sum += sum * NES_N163_AUDIO_SCALE / count;
+}
+
+static float nes_audio_n163(nes_t *nes) {
+  nes_n163_extra_t *mmc = nes->cart.mapper.extra;
+  nes_n163_run(nes);
+  return nes_apu_ext_sample(&mmc->ext);
+}
+
+// accesses the sound RAM through the data port
+static inline uint8_t nes_n163_data(nes_t *nes, int write, uint8_t val) {
+  nes_n163_extra_t *mmc = nes->cart.mapper.extra;
+  uint8_t i = mmc->addr & 0x7F;
+
+  if (write) {
+    nes_n163_run(nes);
+    mmc->ram[i] = val;
+    if (i == 0x7F)
+      nes_n163_update_level(mmc);
+  } else {
+    val = mmc->ram[i];
+  }
+
+  if (mmc->addr & 0x80)
+    mmc->addr = 0x80 | ((mmc->addr + 1) & 0x7F);
+  return val;
+}
+
+// IRQ
+
+// brings the counter up to the current cycle, it stops at $7FFF and
+// latches the IRQ there
+static inline void nes_n163_irq_run(nes_t *nes) {
+  nes_n163_extra_t *mmc = nes->cart.mapper.extra;
+  uint64_t n = nes->apu.cycle - mmc->irq_cycle;
+  mmc->irq_cycle = nes->apu.cycle;
+
+  if (!mmc->irq_enable || mmc->irq_counter == 0x7FFF)
+    return;
+
+  if (n >= 0x7FFFu - mmc->irq_counter) {
+    mmc->irq_counter = 0x7FFF;
+    mmc->irq_pending = 1;
+  } else {
+    mmc->irq_counter += n;
+  }
+}
+
+// sets the mapper timer for the cycle the counter gets to $7FFF, or right
+// away if the IRQ is waiting to be delivered
+static inline void nes_n163_irq_schedule(nes_t *nes) {
+  nes_n163_extra_t *mmc = nes->cart.mapper.extra;
+
+  if (mmc->irq_pending)
+    nes_mapper_timer_set(nes, nes->apu.cycle);
+  else if (mmc->irq_enable && mmc->irq_counter != 0x7FFF)
+    nes_mapper_timer_set(nes, mmc->irq_cycle + (0x7FFFu - mmc->irq_counter));
+  else
+    nes_mapper_timer_set(nes, NES_MAPPER_TIMER_OFF);
+}
+
+// the counter runs on the CPU clock, it's caught up and the IRQ delivered
+// when it's due
+static void nes_timer_n163(nes_t *nes) {
+  nes_n163_extra_t *mmc = nes->cart.mapper.extra;
+
+  nes_n163_irq_run(nes);
+  if (mmc->irq_pending) {
+    mmc->irq_pending = 0;
+    nes_cpu_irq(nes);
+  }
+  nes_n163_irq_schedule(nes);
+}
+
+// registers
+
+static uint8_t nes_mem_read_n163(nes_t *nes, uint16_t addr) {
+  nes_n163_extra_t *mmc = nes->cart.mapper.extra;
+
+  if (addr < 0x2000) return nes_ram_read(nes, addr & 0x07FF);
+  if ((addr == 0x4016) || (addr == 0x4017))
+    return nes_input_read(nes, addr - 0x4016);
+  if (addr < 0x4000) return nes_ppu_read(nes, addr & 0x0007);
+  if (addr < 0x4020) return nes_apu_read(nes, addr - 0x4000);
+  if (addr >= 0x8000) return nes_prg_read(nes, addr);
+  if (addr >= 0x6000) return nes_prgram_read(nes, addr - 0x6000);
+  if (addr >= 0x5000) {
+    // a latched IRQ is delivered by the timer, after this instruction
+    nes_n163_irq_run(nes);
+    nes_n163_irq_schedule(nes);
+    if (addr >= 0x5800)
+      return (mmc->irq_counter >> 8) | (mmc->irq_enable << 7);
+    return mmc->irq_counter & 0xFF;
+  }
+  if (addr >= 0x4800) return nes_n163_data(nes, 0, 0);
+
+  return 0x00;
+}
+
+static void nes_mem_write_n163(nes_t *nes, uint16_t addr, uint8_t val) {
+  nes_n163_extra_t *mmc = nes->cart.mapper.extra;
+
+  if (addr < 0x2000) {nes_ram_write(nes, addr & 0x07FF, val); return;}
+  if (addr < 0x4000) {nes_ppu_write(nes, addr & 0x0007, val); return;}
+  if (addr == 0x4014) {nes_ppu_oamdma(nes, val); return;}
+  if (addr == 0x4016) {
+    nes_input_write(nes, addr - 0x4016, val);
+    return;
+  }
+  if (addr < 0x4020) {nes_apu_write(nes, addr - 0x4000, val); return;}
+  if (addr < 0x4800) return;
+  if (addr < 0x5000) {nes_n163_data(nes, 1, val); return;}
+  if (addr < 0x6000) {
+    // writing either half of the counter acknowledges the IRQ
+    nes_n163_irq_run(nes);
+    mmc->irq_pending = 0;
+    if (addr >= 0x5800) {
+      mmc->irq_counter = (mmc->irq_counter & 0x00FF) | ((val & 0x7F) << 8);
+      mmc->irq_enable = val >> 7;
+    } else {
+      mmc->irq_counter = (mmc->irq_counter & 0x7F00) | val;
+    }
+    nes_n163_irq_schedule(nes);
+    return;
+  }
+  if (addr < 0x8000) {nes_prgram_write(nes, addr - 0x6000, val); return;}
+
+  switch ((addr >> 11) & 0x0F) {
+    case 0x0: case 0x1: case 0x2: case 0x3:
+    case 0x4: case 0x5: case 0x6: case 0x7:
+      mmc->chr[(addr >> 11) & 0x07] = val;
+      nes_n163_update_chr(nes);
+      break;
+    case 0x8: case 0x9: case 0xA: case 0xB:
+      // nametables always take CIRAM for $E0 and up
+      mmc->nt[(addr >> 11) & 0x03] = val;
+      nes_cart_set_nametable(nes, (addr >> 11) & 0x03, nes_n163_page(nes, val, 1));
+      break;
+    case 0xC:
+      nes_n163_run(nes);
+      mmc->prg0 = val;
+      nes_n163_map_prg(nes, 0, val & 0x3F);
+      break;
+    case 0xD:
+      mmc->prg1 = val;
+      nes_n163_map_prg(nes, 1, val & 0x3F);
+      nes_n163_update_chr(nes);
+      break;
+    case 0xE:
+      nes_n163_map_prg(nes, 2, val & 0x3F);
+      break;
+    case 0xF:
+      mmc->addr = val;
+      break;
+  }
+}
+
+static uint8_t nes_vmem_read_n163(nes_t *nes, uint16_t addr) {
+  addr &= 0x3FFF;
+  if (addr >= 0x3F00) {
+    addr &= 0x001F;
+    if (addr >= 0x10 && (addr & 0x03) == 0)
+      addr -= 0x10;
+    return nes->vmem.pal[addr];
+  }
+  if (addr < 0x2000) return nes_chr_read(nes, addr);
+  return nes_nt_read(nes, addr);
+}
+
+static void nes_vmem_write_n163(nes_t *nes, uint16_t addr, uint8_t val) {
+  addr &= 0x3FFF;
+  if (addr >= 0x3F00) {
+    addr &= 0x001F;
+    if (addr >= 0x10 && (addr & 0x03) == 0)
+      addr -= 0x10;
+    nes->vmem.pal[addr] = val;
+  } else if (addr < 0x2000) {
+    nes_chr_write(nes, addr, val);
+  } else {
+    nes_nt_write(nes, addr, val);
+  }
+}
+
+static void nes_init_n163(nes_t *nes) {
+  nes_n163_extra_t *mmc = calloc(1, sizeof(nes_n163_extra_t));
+  nes->cart.mapper.extra = mmc;
+
+  mmc->tmr = NES_N163_AUDIO_PERIOD;
+  mmc->cur = 7;
+  mmc->ext.cycle = mmc->ext.start = nes->apu.cycle;
+  mmc->irq_cycle = nes->apu.cycle;
+
+  for (int i = 0; i < 8; ++i)
+    mmc->chr[i] = i;
+  nes_n163_update_chr(nes);
+
+  for (int i = 0; i < 4; ++i)
+    nes_n163_map_prg(nes, i, (i < 3) ? i : nes->cart.rom16_count * 2 - 1);
+
+  nes->mem.wram = nes->mem.prgram;
+}
+
+static void nes_cleanup_n163(nes_t *nes) {
+  free(nes->cart.mapper.extra);
+  nes->cart.mapper.extra = NULL;
+}
+
+static void nes_clone_n163(nes_t *nes, nes_t *src) {
+  nes->cart.mapper.extra = nes_mapper_copy_extra(src, sizeof(nes_n163_extra_t));
+}
+
+// registry stuff
+
+MAPPER_REG_FUNC
+static void nes_register_n163() {
+  static const char *mapper_name = "Namco 163";
+  static nes_mapper_funcs_t mapper_funcs = {
+    .init = nes_init_n163, .cleanup = nes_cleanup_n163,
+    .clone = nes_clone_n163,
+    .read = nes_mem_read_n163, .write = nes_mem_write_n163,
+    .vread = nes_vmem_read_n163, .vwrite = nes_vmem_write_n163,
+    .timer = nes_timer_n163,
+    .audio = nes_audio_n163,
+  };
+
+  nes_reg_mapper(NES_MAPPER_ID_N163, mapper_name, &mapper_funcs);
+}
+
+MAPPER_UNREG_FUNC
+static void nes_unregister_n163() {
+  nes_unreg_mapper(NES_MAPPER_ID_N163);
+}
@@ -14,8 +14,7 @@ static uint8_t nes_mem_read_unrom(nes_t *nes, uint16_t addr) {
     return nes_input_read(nes, addr - 0x4016);
   if (addr < 0x4000) return nes_ppu_read(nes, addr & 0x0007);
   if (addr < 0x4020) return nes_apu_read(nes, addr - 0x4000);
-  if (addr >= 0xC000) return nes_prg_read(nes, 0, addr - 0xC000);
-  if (addr >= 0x8000) return nes_prg_read(nes, 1, addr - 0x8000);
+  if (addr >= 0x8000) return nes_prg_read(nes, addr);
   if (addr >= 0x6000) return nes_prgram_read(nes, addr - 0x6000);
 
   return 0x00;
@@ -34,9 +33,9 @@ static void nes_mem_write_unrom(nes_t *nes, uint16_t addr, uint8_t val) {
     uint8_t bank_id = (nes->cart.rom16_count > 8) ? (val & 0x0F) : (val & 0x07);
 
     if (bank_id < nes->cart.rom16_count)
-      nes->mem.prg[1] = nes->cart.rom[bank_id];
+      nes_prg_map(nes, 0, 2, nes->cart.rom[bank_id]);
     else
-      nes->mem.prg[1] = NULL;
+      nes_prg_map(nes, 0, 2, NULL);
 
     return;
   }
@@ -51,14 +50,8 @@ static uint8_t nes_vmem_read_unrom(nes_t *nes, uint16_t addr) {
       addr -= 0x10;
     return nes->vmem.pal[addr];
   }
-  // NROM always has two 4k charbanks or none
-  if (addr < 0x2000) {
-    if (nes->cart.vram8_count)
-      return nes->cart.vram[0][addr & 0x1FFF];
-    else
-      return 0x00;
-  }
-  return nes->vmem.vram[nes->cart.mirror(addr)];
+  if (addr < 0x2000) return nes_chr_read(nes, addr);
+  return nes_nt_read(nes, addr);
 }
 
 static void nes_vmem_write_unrom(nes_t *nes, uint16_t addr, uint8_t val) {
@@ -69,19 +62,21 @@ static void nes_vmem_write_unrom(nes_t *nes, uint16_t addr, uint8_t val) {
       addr -= 0x10;
     nes->vmem.pal[addr] = val;
   } else if (addr < 0x2000) {
-    // NROM can have two 4k CHR-RAM banks
-    if (nes->cart.vram8_count && nes->cart.chr_ram)
-      nes->cart.vram[0][addr & 0x1FFF] = val;
+    nes_chr_write(nes, addr, val);
   } else {
-    nes->vmem.vram[nes->cart.mirror(addr)] = val;
+    nes_nt_write(nes, addr, val);
   }
 }
 
 static void nes_init_unrom(nes_t *nes) {
   if (nes->cart.rom16_count) {
-    nes->mem.prg[0] = nes->cart.rom[nes->cart.rom16_count - 1];
-    nes->mem.prg[1] = nes->cart.rom[0];
+    nes_prg_map(nes, 0, 2, nes->cart.rom[0]);
+    nes_prg_map(nes, 2, 2, nes->cart.rom[nes->cart.rom16_count - 1]);
   }
+
+  nes_chr_map(nes, 0, 8, nes->cart.chr);
+
+  nes->mem.wram = nes->mem.prgram;
 }
 
 static void nes_cleanup_unrom(nes_t *nes) {
@@ -0,0 +1,359 @@
+#pragma once
+
+#include "../nes_mappers.h"
+#include "../nes_mem.h"
+#include "../nes_apu.h"
+#include "../nes_cpu.h"
+#include "../nes_input.h"
+#include "../nes_ppu.h"
+#include "../nes_cart.h"
+
+#define NES_MAPPER_ID_VRC6A 24
+#define NES_MAPPER_ID_VRC6B 26 // same thing with A0 and A1 swapped
+
+#define NES_VRC6_AUDIO_SCALE 0.01 // level of one output step (15 ~ 2A03 square)
+
+// VRC6 sound channel (two pulses and a sawtooth)
+typedef struct {
+  uint8_t ctrl; // $x000: mode/duty/volume for pulses, rate for the saw
+  uint16_t period; // timer period
+  uint8_t enabled;
+  uint16_t tmr; // cycles left until the next step
+  uint8_t step; // duty step (pulse) or rate step (saw)
+  uint8_t acc; // saw accumulator
+} nes_vrc6_chan_t;
+
+// extra mapper data for VRC6
+typedef struct {
+  uint8_t swap; // 1 for VRC6b
+
+  uint8_t irq_latch;
+  uint8_t irq_counter;
+  uint8_t irq_ctrl;
+  uint64_t irq_cycle; // CPU cycle the counter was last brought up to
+
+  uint8_t halt; // $9003 bit 0, stops all channels
+  nes_vrc6_chan_t pulse[2];
+  nes_vrc6_chan_t saw;
+  nes_apu_ext_t ext;
+} nes_vrc6_extra_t;
+
+// maps the 8k PRG bank with the given index into an 8k slot
+static inline void nes_vrc6_map_prg(nes_t *nes, uint8_t slot, uint32_t idx) {
+  if (!nes->cart.rom16_count) return;
+  idx %= nes->cart.rom16_count * 2;
+  nes_prg_map(nes, slot, 1, nes->cart.prg + idx * 0x2000);
+}
+
+// maps the 1k CHR bank with the given index into a 1k slot
+static inline void nes_vrc6_map_chr(nes_t *nes, uint8_t slot, uint32_t idx) {
+  idx %= nes->cart.vram8_count * 8;
+  nes_chr_map(nes, slot, 1, nes->cart.chr + idx * 0x0400);
+}
+
+// audio
+
+// returns the current output of a pulse channel
+static inline uint8_t nes_vrc6_pulse_level(nes_vrc6_chan_t *ch) {
+  // bit 7 is the "digitized" mode: volume is output as is
+  if ((ch->ctrl & 0x80) || ch->step <= ((ch->ctrl >> 4) & 0x07))
+    return ch->ctrl & 0x0F;
+  return 0;
+}
+
+// runs a pulse channel for n cycles, returns its output summed over them
+static inline uint32_t nes_vrc6_run_pulse(nes_vrc6_chan_t *ch, uint32_t n) {
+  uint32_t sum = 0;
+
+  while (n) {
+    uint32_t step = (n < ch->tmr) ? n : ch->tmr;
+    sum += step * nes_vrc6_pulse_level(ch);
+    n -= step;
+    ch->tmr -= step;
+    if (!ch->tmr) {
+      ch->tmr = ch->period + 1;
+      ch->step = (ch->step - 1) & 0x0F;
+    }
+  }
+
+  return sum;
+}
+
+// runs the saw channel for n cycles, returns its output summed over them
+// the accumulator takes the rate on every second step and resets on the 14th
+static inline uint32_t nes_vrc6_run_saw(nes_vrc6_chan_t *ch, uint32_t n) {
+  uint32_t sum = 0;
+
+  while (n) {
+    uint32_t step = (n < ch->tmr) ? n : ch->tmr;
+    sum += step * (ch->acc >> 3);
+    n -= step;
+    ch->tmr -= step;
+    if (!ch->tmr) {
+      ch->tmr = ch->period + 1;
+      if (++ch->step == 14) {
+        ch->step = 0;
+        ch->acc = 0;
+      } else if (!(ch->step & 0x01)) {
+        ch->acc += ch->ctrl & 0x3F;
+      }
+    }
+  }
+
+  return sum;
+}
+
+// brings the sound channels up to the APU
+static inline void nes_vrc6_run(nes_t *nes) {
+  nes_vrc6_extra_t *mmc = nes->cart.mapper.extra;
+  uint32_t n = nes_apu_ext_span(nes, &mmc->ext);
+  uint32_t sum = 0;
+
+  if (mmc->halt) {
+    sum += n * nes_vrc6_pulse_level(&mmc->pulse[0]) * mmc->pulse[0].enabled;
+    sum += n * nes_vrc6_pulse_level(&mmc->pulse[1]) * mmc->pulse[1].enabled;
+    sum += n * (mmc->saw.acc >> 3) * mmc->saw.enabled;
+  } else {
+    if (mmc->pulse[0].enabled) sum += nes_vrc6_run_pulse(&mmc->pulse[0], n);
+    if (mmc->pulse[1].enabled) sum += nes_vrc6_run_pulse(&mmc->pulse[1], n);
+    if (mmc->saw.enabled) sum += nes_vrc6_run_saw(&mmc->saw, n);
+  }
+
+  mmc->ext.sum += sum * NES_VRC6_AUDIO_SCALE;
+}
+
+// writes a sound channel register, reg is 0-2
+static inline void nes_vrc6_chan_write(nes_vrc6_chan_t *ch, uint8_t reg, uint8_t val, int saw) {
+  switch (reg) {
+    case 0: ch->ctrl = val; break;
+    case 1: ch->period = (ch->period & 0x0F00) | val; break;
+    case 2:
+      ch->period = (ch->period & 0x00FF) | ((val & 0x0F) << 8);
+      ch->enabled = val >> 7;
+      if (!ch->enabled) {
+        ch->step = saw ? 0 : 15;
+        ch->acc = 0;
+      }
+      break;
+  }
+}
+
+static float nes_audio_vrc6(nes_t *nes) {
+  nes_vrc6_extra_t *mmc = nes->cart.mapper.extra;
+  nes_vrc6_run(nes);
+  return nes_apu_ext_sample(&mmc->ext);
+}
+
+// IRQ
+
+// clocks the IRQ counter n times; it counts up and reloads from the latch
+// on overflow, which is when the IRQ fires
+static inline void nes_vrc6_irq_clock(nes_t *nes, uint32_t n) {
+  nes_vrc6_extra_t *mmc = nes->cart.mapper.extra;
+  int fire = 0;
+
+  while (n >= 0x100u - mmc->irq_counter) {
+    n -= 0x100u - mmc->irq_counter;
+    mmc->irq_counter = mmc->irq_latch;
+    fire = 1;
+  }
+  mmc->irq_counter += n;
+
+  if (fire)
+    nes_cpu_irq(nes);
+}
+
+// the counter is clocked once per scanline (which is what the prescaler
+// divides the CPU clock down to) or once per CPU cycle in cycle mode;
+// cycle mode catches up here too, so its IRQs land on the line they're due
+static void nes_event_vrc6(nes_t *nes, uint8_t ev) {
+  nes_vrc6_extra_t *mmc = nes->cart.mapper.extra;
+  uint32_t n = (mmc->irq_ctrl & 0x04) ? nes->cpu.cycle - mmc->irq_cycle : 1;
+  mmc->irq_cycle = nes->cpu.cycle;
+
+  if (mmc->irq_ctrl & 0x02)
+    nes_vrc6_irq_clock(nes, n);
+}
+
+// registers
+
+// writes to the VRC6 register at given address
+static inline void nes_vrc6_write(nes_t *nes, uint16_t addr, uint8_t val) {
+  nes_vrc6_extra_t *mmc = nes->cart.mapper.extra;
+
+  uint8_t reg = addr & 0x03;
+  if (mmc->swap)
+    reg = ((reg & 0x01) << 1) | ((reg >> 1) & 0x01);
+
+  switch (addr >> 12) {
+    case 0x8:
+      nes_vrc6_map_prg(nes, 0, (val & 0x0F) * 2);
+      nes_vrc6_map_prg(nes, 1, (val & 0x0F) * 2 + 1);
+      break;
+    case 0x9:
+    case 0xA:
+      nes_vrc6_run(nes);
+      if (reg == 3) {
+        if ((addr >> 12) == 0x9)
+          mmc->halt = val & 0x01; // frequency scaling bits are ignored
+      } else
+        nes_vrc6_chan_write(&mmc->pulse[(addr >> 12) - 0x9], reg, val, 0);
+      break;
+    case 0xB:
+      if (reg == 3) {
+        // only the standard banking mode is supported
+        switch ((val >> 2) & 0x03) {
+          case 0: nes_cart_set_mirroring(nes, MIRROR_VERTICAL); break;
+          case 1: nes_cart_set_mirroring(nes, MIRROR_HORIZONTAL); break;
+          case 2: nes_cart_set_mirroring(nes, MIRROR_SINGLESCREEN0); break;
+          case 3: nes_cart_set_mirroring(nes, MIRROR_SINGLESCREEN1); break;
+        }
+        nes->mem.wram = (val & 0x80) ? nes->mem.prgram : NULL;
+      } else {
+        nes_vrc6_run(nes);
+        nes_vrc6_chan_write(&mmc->saw, reg, val, 1);
+      }
+      break;
+    case 0xC:
+      nes_vrc6_map_prg(nes, 2, val & 0x1F);
+      break;
+    case 0xD:
+      nes_vrc6_map_chr(nes, reg, val);
+      break;
+    case 0xE:
+      nes_vrc6_map_chr(nes, 4 + reg, val);
+      break;
+    case 0xF:
+      switch (reg) {
+        case 0: mmc->irq_latch = val; break;
+        case 1:
+          mmc->irq_ctrl = val & 0x07;
+          mmc->irq_cycle = nes->cpu.cycle;
+          if (val & 0x02)
+            mmc->irq_counter = mmc->irq_latch;
+          break;
+        case 2:
+          // acknowledge, enable goes back to the "enable after ack" bit
+          mmc->irq_ctrl = (mmc->irq_ctrl & 0x05) | ((mmc->irq_ctrl & 0x01) << 1);
+          break;
+      }
+      break;
+  }
+}
+
+static uint8_t nes_mem_read_vrc6(nes_t *nes, uint16_t addr) {
+  if (addr < 0x2000) return nes_ram_read(nes, addr & 0x07FF);
+  if ((addr == 0x4016) || (addr == 0x4017))
+    return nes_input_read(nes, addr - 0x4016);
+  if (addr < 0x4000) return nes_ppu_read(nes, addr & 0x0007);
+  if (addr < 0x4020) return nes_apu_read(nes, addr - 0x4000);
+  if (addr >= 0x8000) return nes_prg_read(nes, addr);
+  if (addr >= 0x6000) return nes_prgram_read(nes, addr - 0x6000);
+
+  return 0x00;
+}
+
+static void nes_mem_write_vrc6(nes_t *nes, uint16_t addr, uint8_t val) {
+  if (addr < 0x2000) {nes_ram_write(nes, addr & 0x07FF, val); return;}
+  if (addr < 0x4000) {nes_ppu_write(nes, addr & 0x0007, val); return;}
+  if (addr == 0x4014) {nes_ppu_oamdma(nes, val); return;}
+  if (addr == 0x4016) {
+    nes_input_write(nes, addr - 0x4016, val);
+    return;
+  }
+  if (addr < 0x4020) {nes_apu_write(nes, addr - 0x4000, val); return;}
+  if (addr >= 0x8000) {nes_vrc6_write(nes, addr, val); return;}
+  if (addr >= 0x6000) {nes_prgram_write(nes, addr - 0x6000, val); return;}
+}
+
+static uint8_t nes_vmem_read_vrc6(nes_t *nes, uint16_t addr) {
+  addr &= 0x3FFF;
+  if (addr >= 0x3F00) {
+    addr &= 0x001F;
+    if (addr >= 0x10 && (addr & 0x03) == 0)
+      addr -= 0x10;
+    return nes->vmem.pal[addr];
+  }
+  if (addr < 0x2000) return nes_chr_read(nes, addr);
+  return nes_nt_read(nes, addr);
+}
+
+static void nes_vmem_write_vrc6(nes_t *nes, uint16_t addr, uint8_t val) {
+  addr &= 0x3FFF;
+  if (addr >= 0x3F00) {
+    addr &= 0x001F;
+    if (addr >= 0x10 && (addr & 0x03) == 0)
+      addr -= 0x10;
+    nes->vmem.pal[addr] = val;
+  } else if (addr < 0x2000) {
+    nes_chr_write(nes, addr, val);
+  } else {
+    nes_nt_write(nes, addr, val);
+  }
+}
+
+static inline void nes_vrc6_init(nes_t *nes, uint8_t swap) {
+  nes_vrc6_extra_t *mmc = calloc(1, sizeof(nes_vrc6_extra_t));
+  nes->cart.mapper.extra = mmc;
+  mmc->swap = swap;
+
+  mmc->pulse[0] = mmc->pulse[1] = (nes_vrc6_chan_t){ .tmr = 1, .step = 15 };
+  mmc->saw = (nes_vrc6_chan_t){ .tmr = 1 };
+  mmc->ext.cycle = mmc->ext.start = nes->apu.cycle;
+
+  for (int i = 0; i < 4; ++i)
+    nes_vrc6_map_prg(nes, i, (i < 3) ? i : nes->cart.rom16_count * 2 - 1);
+  for (int i = 0; i < 8; ++i)
+    nes_vrc6_map_chr(nes, i, i);
+
+  nes->mem.wram = nes->mem.prgram;
+}
+
+static void nes_init_vrc6a(nes_t *nes) {
+  nes_vrc6_init(nes, 0);
+}
+
+static void nes_init_vrc6b(nes_t *nes) {
+  nes_vrc6_init(nes, 1);
+}
+
+static void nes_cleanup_vrc6(nes_t *nes) {
+  free(nes->cart.mapper.extra);
+  nes->cart.mapper.extra = NULL;
+}
+
+static void nes_clone_vrc6(nes_t *nes, nes_t *src) {
+  nes->cart.mapper.extra = nes_mapper_copy_extra(src, sizeof(nes_vrc6_extra_t));
+}
+
+// registry stuff
+
+MAPPER_REG_FUNC
+static void nes_register_vrc6() {
+  static const char *mapper_name = "VRC6";
+  static nes_mapper_funcs_t mapper_funcs_a = {
+    .init = nes_init_vrc6a, .cleanup = nes_cleanup_vrc6,
+    .clone = nes_clone_vrc6,
+    .read = nes_mem_read_vrc6, .write = nes_mem_write_vrc6,
+    .vread = nes_vmem_read_vrc6, .vwrite = nes_vmem_write_vrc6,
+    .event = nes_event_vrc6, .events = BIT(NES_MAPPER_EVENT_LINE),
+    .audio = nes_audio_vrc6,
+  };
+  static nes_mapper_funcs_t mapper_funcs_b = {
+    .init = nes_init_vrc6b, .cleanup = nes_cleanup_vrc6,
+    .clone = nes_clone_vrc6,
+    .read = nes_mem_read_vrc6, .write = nes_mem_write_vrc6,
+    .vread = nes_vmem_read_vrc6, .vwrite = nes_vmem_write_vrc6,
+    .event = nes_event_vrc6, .events = BIT(NES_MAPPER_EVENT_LINE),
+    .audio = nes_audio_vrc6,
+  };
+
+  nes_reg_mapper(NES_MAPPER_ID_VRC6A, mapper_name, &mapper_funcs_a);
+  nes_reg_mapper(NES_MAPPER_ID_VRC6B, mapper_name, &mapper_funcs_b);
+}
+
+MAPPER_UNREG_FUNC
+static void nes_unregister_vrc6() {
+  nes_unreg_mapper(NES_MAPPER_ID_VRC6A);
+  nes_unreg_mapper(NES_MAPPER_ID_VRC6B);
+}
@@ -11,6 +11,7 @@ void nes_init(nes_t *nes, pars_t *pars) {
   nes_mem_init(&nes->mem);
   nes_apu_init(&nes->apu, NES_APU_SAMPLE_BUF_SIZE);
   nes_cpu_init(&nes->cpu);
+  nes->cpu.idle.allowed = !pars->no_idle;
   nes_vmem_init(&nes->vmem);
   nes_ppu_init(&nes->ppu);
   nes_input_init(&nes->input);
@@ -21,6 +22,36 @@ void nes_cleanup(nes_t *nes) {
   nes_ppu_cleanup(&nes->ppu);
 }
 
+// makes nes a copy of src, a machine with a ROM loaded, that runs on its
+// own from here on, e.g. to try out different inputs from the same point;
+// the copy takes microseconds: the ROM image is shared, frame buffers are
+// only reserved, and what gets copied is the few KB of RAM and registers
+// clones don't draw deferred, start with no samples and never write the
+// battery save; they are let go of like any machine, with nes_unload_rom
+// and nes_cleanup, in any order relative to src
+// src must not be running on another thread meanwhile
+// returns 0 on success, -1 if out of memory (nes is left with nothing to
+// clean up then)
+int nes_clone(nes_t *nes, nes_t *src) {
+  *nes = *src;
+
+  int res = nes_apu_clone(&nes->apu, &src->apu);
+  res |= nes_ppu_clone(&nes->ppu, &src->ppu);
+
+  if (res || nes_cart_clone(nes, src)) {
+    // whatever is left of src's cart isn't ours to unload
+    nes->cart = (nes_cart_t){0};
+    nes->mem.prgram = NULL;
+    nes->mem.wram = NULL;
+    for (int i = 0; i < 4; ++i) nes->mem.prg[i] = NULL;
+    for (int i = 0; i < 8; ++i) nes->vmem.chr[i] = NULL;
+    nes_cleanup(nes);
+    return -1;
+  }
+
+  return 0;
+}
+
 void nes_load_rom(nes_t *nes, const char *fname) {
   nes_cart_load(nes, fname);
 }
@@ -18,22 +18,85 @@ void nes_cleanup(nes_t *nes);
 void nes_load_rom(nes_t *nes, const char *fname);
 void nes_unload_rom(nes_t *nes);
 
-// main emulator tick function
+int nes_clone(nes_t *nes, nes_t *src);
+
+#define NES_FRAME_CYCLES 29781 // CPU cycles in an NTSC frame, rounded up
+
+// steps everything but the CPU for the given number of CPU cycles
+// most mappers only need PPU events, so they don't get a per-dot tick
+static inline void nes_run_cycles(nes_t *nes, uint32_t cycles,
+                                  nes_map_tick_func_t tick,
+                                  void (*ppu_tick)(nes_t *nes)) {
+  if (tick) {
+    for (int i = 0; i < cycles; ++i) {
+      nes_apu_tick(nes);
+      ppu_tick(nes);
+      tick(nes);
+      ppu_tick(nes);
+      tick(nes);
+      ppu_tick(nes);
+      tick(nes);
+    }
+  } else {
+    for (int i = 0; i < cycles; ++i) {
+      nes_apu_tick(nes);
+      ppu_tick(nes);
+      ppu_tick(nes);
+      ppu_tick(nes);
+    }
+  }
+
+  // mapper timers are due between instructions (see nes_mapper_timer_set)
+  if (nes->apu.cycle >= nes->cart.mapper.timer_at)
+    nes->cart.mapper.funcs.timer(nes);
+}
+
+// runs one instruction and steps everything else along
+// returns the CPU cycles spent
+static inline uint32_t nes_step(nes_t *nes, nes_map_tick_func_t tick,
+                                void (*ppu_tick)(nes_t *nes)) {
+  // an armed idle loop only has its cycles spent
+  uint32_t cycles = nes->cpu.idle.state ? nes_cpu_idle_op(nes) : 0;
+  if (!cycles) cycles = nes_cpu_op(nes);
+  nes_run_cycles(nes, cycles, tick, ppu_tick);
+  return cycles;
+}
+
+// main emulator loop: runs instructions until a frame is ready or at least
+// budget CPU cycles were spent, stepping everything else after each one
+// tick and ppu_tick don't change while a ROM is loaded; mapper-specialized
+// loops (see nes_run.h) pass constants
 // returns 1 if a frame is ready for display
-static inline uint8_t nes_process(nes_t *nes) {
-  uint32_t cycles = nes_cpu_op(nes); // step CPU
-  // step everything else based on spent CPU cycles
-  for (int i = 0; i < cycles; ++i) {
-    nes_apu_tick(nes);
-    nes_ppu_tick(nes);
-    nes_mapper_tick(nes);
-    nes_ppu_tick(nes);
-    nes_mapper_tick(nes);
-    nes_ppu_tick(nes);
-    nes_mapper_tick(nes);
+static inline uint8_t nes_cpu_run_loop(nes_t *nes, uint32_t budget,
+                                       nes_map_tick_func_t tick,
+                                       void (*ppu_tick)(nes_t *nes)) {
+  uint32_t spent = 0;
+
+  while (spent < budget) {
+    uint32_t cycles = nes_step(nes, tick, ppu_tick);
+    spent += cycles;
+
+    if (BITGET(nes->ppu.flags, NES_PPU_FLAG_RENDER)) {
+      nes->ppu.flags = BITCLR(nes->ppu.flags, NES_PPU_FLAG_RENDER);
+      return 1;
+    }
   }
 
-  int render = BITGET(nes->ppu.flags, NES_PPU_FLAG_RENDER);
-  if (render) nes->ppu.flags = BITCLR(nes->ppu.flags, NES_PPU_FLAG_RENDER);
-  return render;
+  return 0;
+}
+
+// runs the main loop, the one built for the loaded mapper if there is one
+// returns 1 if a frame is ready for display
+static inline uint8_t nes_cpu_run(nes_t *nes, uint32_t budget) {
+  if (nes->cart.mapper.run)
+    return nes->cart.mapper.run(nes, budget);
+
+  return nes_cpu_run_loop(nes, budget, nes->cart.mapper.funcs.tick,
+                          nes->ppu.tick);
+}
+
+// runs a single instruction
+// returns 1 if a frame is ready for display
+static inline uint8_t nes_process(nes_t *nes) {
+  return nes_cpu_run(nes, 1);
 }
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "nes_apu.h"
 
 #include "bitops.h"
@@ -72,6 +74,50 @@ static inline void nes_apu_init_tbls() {
     tnd_tbl[i] = 163.67 / (24329.0 / (float)i + 100);
 }
 
+// returns the first cycle after the given one at which cycle / rate crosses
+// into the next integer, i.e. when the next frame counter step or sample is due
+static inline uint64_t nes_apu_next_boundary(uint64_t cycle, double rate) {
+  int64_t cur = (int64_t)((double)cycle / rate);
+  uint64_t next = (uint64_t)((double)(cur + 1) * rate);
+
+  // the product may be off by one either way, settle it with the division
+  while ((int64_t)((double)next / rate) <= cur)
+    next++;
+  while ((next > cycle + 1) && ((int64_t)((double)(next - 1) / rate) > cur))
+    next--;
+
+  return next;
+}
+
+// how nes_apu_step runs the APU, always a constant
+enum nes_apu_mode {
+  NES_APU_MODE_FULL, // everything on the emulation thread
+  NES_APU_MODE_SHADOW, // emulation thread, with a synthesis thread: only
+                       // what the CPU sees (length counters, frame IRQ,
+                       // DMC fetches), and writes and DMC bytes get queued
+  NES_APU_MODE_SYNTH, // synthesis thread: channels and output, fed from
+                      // the queue
+  NES_APU_MODE_MUTE, // like the shadow, but nothing is queued and no sound
+                     // is made at all (see nes_apu_mute)
+};
+
+// returns 1 if the mode runs the channels and takes samples
+static inline int nes_apu_audible(const int mode) {
+  return mode == NES_APU_MODE_FULL || mode == NES_APU_MODE_SYNTH;
+}
+
+// queues a record for the synthesis thread, waiting while the queue is full
+static inline void nes_apu_put(nes_apu_queue_t *q, uint64_t cycle,
+                               uint8_t kind, uint8_t val) {
+  uint32_t head = q->head;
+  while (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) ==
+         NES_APU_QUEUE_SIZE)
+    q->wait(q->ctx);
+
+  q->rec[head % NES_APU_QUEUE_SIZE] = (nes_apu_rec_t){cycle, kind, val};
+  __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+}
+
 void nes_apu_init(nes_apu_t *apu, uint32_t bsize) {
   *apu = (nes_apu_t) {
     .noi = (nes_apu_noi_t) { .shift = 1 },
@@ -81,6 +127,9 @@ void nes_apu_init(nes_apu_t *apu, uint32_t bsize) {
     .buf = malloc(bsize * sizeof(uint8_t)),
     .max_buf_size = bsize,
     .buf_size = 0,
+
+    .frame_next = nes_apu_next_boundary(0, nes_apu_frame_counter_rate),
+    .sample_next = nes_apu_next_boundary(0, nes_apu_sample_rate),
   };
 
   nes_apu_init_tbls();
@@ -90,6 +139,24 @@ void nes_apu_init(nes_apu_t *apu, uint32_t bsize) {
 void nes_apu_cleanup(nes_apu_t *apu) {
   if (apu->buf)
     free(apu->buf);
+  if (apu->queue) {
+    free(apu->queue->apu.buf);
+    free(apu->queue);
+  }
+}
+
+// sets up a clone's APU, which holds a plain copy of src's
+// the clone starts with an empty sample buffer of its own; if src has a
+// synthesis thread, what src holds is only the shadow APU, so the clone
+// comes out muted (see nes_apu_mute)
+// returns 0 on success, -1 if out of memory
+int nes_apu_clone(nes_apu_t *apu, const nes_apu_t *src) {
+  apu->buf = malloc(apu->max_buf_size * sizeof(uint8_t));
+  apu->buf_size = 0;
+  apu->queue = NULL;
+  if (src->queue)
+    apu->mute = 1;
+  return apu->buf ? 0 : -1;
 }
 
 // square (two channels)
@@ -138,14 +205,18 @@ static inline void nes_apu_sqr_write_tmr_high(nes_apu_sqr_t *sqr, uint8_t val) {
   sqr->duty_val = 0;
 }
 
-// steps timer and duty values
-static inline void nes_apu_sqr_step_tmr(nes_apu_sqr_t *sqr) {
-  if (sqr->tmr_val == 0) {
-    sqr->tmr_val = sqr->tmr_period;
-    sqr->duty_val = (sqr->duty_val + 1) % 8;
-  } else {
-    sqr->tmr_val--;
+// runs the timer for n clocks at once, stepping the duty value on every
+// reload, which happens once every tmr_period + 1 clocks
+static inline void nes_apu_sqr_run_tmr(nes_apu_sqr_t *sqr, uint32_t n) {
+  if (n <= sqr->tmr_val) {
+    sqr->tmr_val -= n;
+    return;
   }
+
+  uint32_t len = (uint32_t)sqr->tmr_period + 1;
+  n -= (uint32_t)sqr->tmr_val + 1;
+  sqr->duty_val = (sqr->duty_val + 1 + n / len) % 8;
+  sqr->tmr_val = sqr->tmr_period - n % len;
 }
 
 // steps envelope values
@@ -259,16 +330,21 @@ static inline void nes_apu_tri_write_tmr_high(nes_apu_tri_t *tri, uint8_t val) {
   tri->flags = BITMSET(tri->flags, NES_APU_FLAG_TRI_COUNTER_RELOAD);
 }
 
-// steps timer and duty values
-static inline void nes_apu_tri_step_tmr(nes_apu_tri_t *tri) {
-  if (tri->tmr_val == 0) {
-    tri->tmr_val = tri->tmr_period;
-    if ((tri->length > 0) && (tri->counter_val > 0)) {
-      tri->duty_val = (tri->duty_val + 1) % 32;
-      if (tri->tmr_val > 1) tri->duty_out = tri->duty_val;
-    }
-  } else {
-    tri->tmr_val--;
+// runs the timer for n clocks at once, same as for the squares; the length
+// and linear counters gate the sequencer, they can't change within a batch
+static inline void nes_apu_tri_run_tmr(nes_apu_tri_t *tri, uint32_t n) {
+  if (n <= (uint32_t)tri->tmr_val) {
+    tri->tmr_val -= n;
+    return;
+  }
+
+  uint32_t len = (uint32_t)tri->tmr_period + 1;
+  n -= (uint32_t)tri->tmr_val + 1;
+  tri->tmr_val = tri->tmr_period - n % len;
+
+  if ((tri->length > 0) && (tri->counter_val > 0)) {
+    tri->duty_val = (tri->duty_val + 1 + n / len) % 32;
+    if (tri->tmr_period > 1) tri->duty_out = tri->duty_val;
   }
 }
 
@@ -341,25 +417,37 @@ static inline void nes_apu_noi_write_len(nes_apu_noi_t *noi, uint8_t val) {
   noi->flags = BITMSET(noi->flags, NES_APU_FLAG_NOI_ENV_START);
 }
 
-// steps the timer value
-static inline void nes_apu_noi_step_tmr(nes_apu_noi_t *noi) {
-  noi->tmr_val--;
-    
-  if (noi->tmr_val == 0) {
-    uint16_t tmp;
-    
-    if (BITMGET(noi->flags, NES_APU_FLAG_NOI_MODE))
-      tmp = (noi->shift & 0x40) >> 6;
-    else
-      tmp = (noi->shift & 0x02) >> 1;
-    
-    uint16_t feedback;
-    
-    feedback = (noi->shift & 0x01) ^ tmp;
-    noi->shift = (noi->shift >> 1) | (feedback << 14);
-    
-    noi->tmr_val = noi->tmr_period;
+// steps the LFSR
+static inline void nes_apu_noi_step_shift(nes_apu_noi_t *noi) {
+  uint16_t tmp;
+
+  if (BITMGET(noi->flags, NES_APU_FLAG_NOI_MODE))
+    tmp = (noi->shift & 0x40) >> 6;
+  else
+    tmp = (noi->shift & 0x02) >> 1;
+
+  uint16_t feedback;
+
+  feedback = (noi->shift & 0x01) ^ tmp;
+  noi->shift = (noi->shift >> 1) | (feedback << 14);
+}
+
+// runs the timer for n clocks at once; the timer steps the LFSR when it
+// counts down to 0 and reloads, so a 0 value or period wraps around the
+// full 16 bits first
+static inline void nes_apu_noi_run_tmr(nes_apu_noi_t *noi, uint32_t n) {
+  uint32_t val = noi->tmr_val ? noi->tmr_val : 0x10000;
+  if (n < val) {
+    noi->tmr_val = val - n;
+    return;
   }
+
+  uint32_t len = noi->tmr_period ? noi->tmr_period : 0x10000;
+  n -= val;
+  noi->tmr_val = len - n % len;
+
+  for (uint32_t steps = 1 + n / len; steps > 0; --steps)
+    nes_apu_noi_step_shift(noi);
 }
 
 // steps envelope values
@@ -444,26 +532,53 @@ static inline void nes_apu_dmc_restart(nes_apu_dmc_t *dmc) {
   dmc->cur_length = dmc->sample_length;
 }
 
-// reads next byte of the sample, which takes 4 CPU clocks
+// returns how many CPU cycles a DMC sample fetch steals: 4 normally, but
+// fewer if it lands inside an OAM DMA, which already has the CPU halted;
+// the OAM DMA then ends that much later
+static inline uint8_t nes_apu_dmc_stall(nes_t *nes) {
+  uint8_t cycles;
+
+  if (nes->cpu.dma_oam == 0)
+    return 4;
+  else if (nes->cpu.dma_oam == 1)
+    cycles = 3; // on the last OAM put cycle
+  else if (nes->cpu.dma_oam == 2)
+    cycles = 1; // on the second to last OAM put cycle
+  else
+    cycles = 2;
+
+  nes->cpu.dma_oam += cycles;
+  return cycles;
+}
+
+// puts the next byte of the sample straight into the shift register
 // will reset playback after the end of the sample is reached,
 // if the loop flag is set
-// this reads the sample straight into the shift register
-static inline void nes_apu_dmc_step_reader(nes_t *nes) {
+static inline void nes_apu_dmc_load(nes_apu_dmc_t *dmc, uint8_t val) {
+  dmc->shift = val;
+  dmc->bit = 8;
+  dmc->cur_addr++;
+
+  if (dmc->cur_addr == 0)
+    dmc->cur_addr = 0x8000;
+
+  dmc->cur_length--;
+
+  if ((dmc->cur_length == 0) && BITMGET(dmc->flags, NES_APU_FLAG_DMC_LOOP))
+    nes_apu_dmc_restart(dmc);
+}
+
+// reads next byte of the sample, which takes up to 4 CPU clocks
+// with a synthesis thread, the byte is queued for it too
+static inline void nes_apu_dmc_step_reader(nes_t *nes, const int mode) {
   nes_apu_dmc_t *dmc = &nes->apu.dmc;
-  
+
   if ((dmc->cur_length > 0) && (dmc->bit == 0)) {
-    nes->cpu.stall += 4;
-    dmc->shift = nes_mem_readb(nes, dmc->cur_addr);
-    dmc->bit = 8;
-    dmc->cur_addr++;
-    
-    if (dmc->cur_addr == 0)
-      dmc->cur_addr = 0x8000;
-    
-    dmc->cur_length--;
-    
-    if ((dmc->cur_length == 0) && BITMGET(dmc->flags, NES_APU_FLAG_DMC_LOOP))
-      nes_apu_dmc_restart(dmc);
+    nes->cpu.stall += nes_apu_dmc_stall(nes);
+    uint8_t val = nes_mem_readb(nes, dmc->cur_addr);
+    if (mode == NES_APU_MODE_SHADOW)
+      nes_apu_put(nes->apu.queue, nes->apu.cycle, NES_APU_REC_DMC, val);
+    nes_apu_dmc_load(dmc, val);
   }
 }
 
@@ -490,17 +605,20 @@ static inline uint8_t nes_apu_dmc_get_output(nes_apu_dmc_t *dmc) {
 }
 
 // steps the timer value (and the whole channel)
-static inline void nes_apu_dmc_step_tmr(nes_t *nes) {
-  if (!BITMGET(nes->apu.dmc.flags, NES_APU_FLAG_DMC_ENABLED))
+// the synthesis thread gets sample bytes loaded from the queue instead
+static inline void nes_apu_dmc_step_tmr(nes_t *nes, nes_apu_t *apu,
+                                        const int mode) {
+  if (!BITMGET(apu->dmc.flags, NES_APU_FLAG_DMC_ENABLED))
     return;
-  
-  nes_apu_dmc_step_reader(nes);
-  
-  if (nes->apu.dmc.tick_value == 0) {
-    nes->apu.dmc.tick_value = nes->apu.dmc.tick_period;
-    nes_apu_dmc_step_shifter(&nes->apu.dmc);
+
+  if (mode != NES_APU_MODE_SYNTH)
+    nes_apu_dmc_step_reader(nes, mode);
+
+  if (apu->dmc.tick_value == 0) {
+    apu->dmc.tick_value = apu->dmc.tick_period;
+    nes_apu_dmc_step_shifter(&apu->dmc);
   } else {
-    nes->apu.dmc.tick_value--;
+    apu->dmc.tick_value--;
   }
 }
 
@@ -552,67 +670,77 @@ static inline void nes_apu_dmc_write(nes_apu_dmc_t *dmc, uint16_t addr,
 
 // tick functions
 
-// timer tick
-static inline void nes_apu_step_tmr(nes_t *nes) {
-  if (nes->apu.cycle % 2 == 0) {
-    nes_apu_sqr_step_tmr(&nes->apu.sq1);
-    nes_apu_sqr_step_tmr(&nes->apu.sq2);
-    nes_apu_noi_step_tmr(&nes->apu.noi);
-    nes_apu_dmc_step_tmr(nes);
-  }
+// brings the square, triangle and noise timers up to the current cycle
+// their state only matters for the output, register writes and frame
+// counter steps, so they are run in one go from one of those to the next
+// rather than on every cycle; the squares and noise are clocked on even
+// cycles, the triangle on every one
+static inline void nes_apu_run_tmr(nes_apu_t *apu) {
+  uint64_t from = apu->tmr_cycle;
+  uint64_t to = apu->cycle;
+  if (from == to)
+    return;
+
+  uint32_t even = to / 2 - from / 2;
+  nes_apu_sqr_run_tmr(&apu->sq1, even);
+  nes_apu_sqr_run_tmr(&apu->sq2, even);
+  nes_apu_noi_run_tmr(&apu->noi, even);
+  nes_apu_tri_run_tmr(&apu->tri, to - from);
 
-  nes_apu_tri_step_tmr(&nes->apu.tri);
+  apu->tmr_cycle = to;
 }
 
 // envelope tick
-static inline void nes_apu_step_env(nes_t *nes) {
-  nes_apu_sqr_step_env(&nes->apu.sq1);
-  nes_apu_sqr_step_env(&nes->apu.sq2);
-  nes_apu_tri_step_cnt(&nes->apu.tri);
-  nes_apu_noi_step_env(&nes->apu.noi);
+static inline void nes_apu_step_env(nes_apu_t *apu) {
+  nes_apu_sqr_step_env(&apu->sq1);
+  nes_apu_sqr_step_env(&apu->sq2);
+  nes_apu_tri_step_cnt(&apu->tri);
+  nes_apu_noi_step_env(&apu->noi);
 }
 
 // sweep tick
-static inline void nes_apu_step_sweep(nes_t *nes) {
-  nes_apu_sqr_step_sweep(&nes->apu.sq1);
-  nes_apu_sqr_step_sweep(&nes->apu.sq2);
+static inline void nes_apu_step_sweep(nes_apu_t *apu) {
+  nes_apu_sqr_step_sweep(&apu->sq1);
+  nes_apu_sqr_step_sweep(&apu->sq2);
 }
 
 // length tick
-static inline void nes_apu_step_len(nes_t *nes) {
-  nes_apu_sqr_step_len(&nes->apu.sq1);
-  nes_apu_sqr_step_len(&nes->apu.sq2);
-  nes_apu_tri_step_len(&nes->apu.tri);
-  nes_apu_noi_step_len(&nes->apu.noi);
+static inline void nes_apu_step_len(nes_apu_t *apu) {
+  nes_apu_sqr_step_len(&apu->sq1);
+  nes_apu_sqr_step_len(&apu->sq2);
+  nes_apu_tri_step_len(&apu->tri);
+  nes_apu_noi_step_len(&apu->noi);
 }
 
-// fires IRQ if required
-static inline void nes_apu_fire_irq(nes_t *nes) {
-  if (nes->apu.frame_irq)
+// fires IRQ if required (the synthesis thread's APU has no CPU to fire at)
+static inline void nes_apu_fire_irq(nes_t *nes, nes_apu_t *apu,
+                                    const int mode) {
+  if (mode != NES_APU_MODE_SYNTH && apu->frame_irq)
     nes_cpu_irq(nes);
 }
 
 // APU frame
-static inline void nes_apu_step_frame_counter(nes_t *nes) {
-  nes->apu.frame_val++;
+static inline void nes_apu_step_frame_counter(nes_t *nes, nes_apu_t *apu,
+                                              const int mode) {
+  apu->frame_val++;
   
-  if (nes->apu.frame_period == 4) {
-    switch (nes->apu.frame_val) {
+  if (apu->frame_period == 4) {
+    switch (apu->frame_val) {
       case 3:
-        nes_apu_fire_irq(nes);
+        nes_apu_fire_irq(nes, apu, mode);
       case 1:
-        nes_apu_step_len(nes);
-        nes_apu_step_sweep(nes);
+        nes_apu_step_len(apu);
+        nes_apu_step_sweep(apu);
       case 0:
       case 2: 
         break;
     }
-  } else if (nes->apu.frame_period == 5) {
-    switch (nes->apu.frame_val) {
+  } else if (apu->frame_period == 5) {
+    switch (apu->frame_val) {
       case 1:
       case 4:
-        nes_apu_step_len(nes);
-        nes_apu_step_sweep(nes);
+        nes_apu_step_len(apu);
+        nes_apu_step_sweep(apu);
       case 0:
       case 2: 
       case 3:
@@ -620,109 +748,267 @@ static inline void nes_apu_step_frame_counter(nes_t *nes) {
     }
   }
   
-  nes_apu_step_env(nes);
+  nes_apu_step_env(apu);
   
-  if (nes->apu.frame_val >= nes->apu.frame_period)
-    nes->apu.frame_val = 0;
+  if (apu->frame_val >= apu->frame_period)
+    apu->frame_val = 0;
 }
 
-// returns output value for the current APU tick
-static inline float nes_apu_get_output(nes_t *nes) {
-  uint8_t sq1 = nes_apu_sqr_get_output(&nes->apu.sq1);
-  uint8_t sq2 = nes_apu_sqr_get_output(&nes->apu.sq2);
-  uint8_t tri = nes_apu_tri_get_output(&nes->apu.tri);
-  uint8_t noi = nes_apu_noi_get_output(&nes->apu.noi);
-  uint8_t dmc = nes_apu_dmc_get_output(&nes->apu.dmc);
+// returns output value for the current APU tick, ext is the expansion audio
+// level; those are on the same scale, a full 2A03 square is ~0.15
+static inline float nes_apu_get_output(nes_apu_t *apu, float ext) {
+  nes_apu_run_tmr(apu);
+
+  uint8_t sq1 = nes_apu_sqr_get_output(&apu->sq1);
+  uint8_t sq2 = nes_apu_sqr_get_output(&apu->sq2);
+  uint8_t tri = nes_apu_tri_get_output(&apu->tri);
+  uint8_t noi = nes_apu_noi_get_output(&apu->noi);
+  uint8_t dmc = nes_apu_dmc_get_output(&apu->dmc);
 
   float sqs = sqr_tbl[(sq1 + sq2) % 31];
   float tnd = tnd_tbl[(3 * tri + 2 * noi + dmc) % 203];
-  
-  float res = 128.0 * (sqs + tnd);
+
+  float res = 128.0 * (sqs + tnd + ext);
   res = (res < 0.0) ? 0.0 : (res > 255.0) ? 255.0 : res;
   
   return res;
 }
 
 // appends current output to sample buffer unless it is full
-static inline void nes_apu_send_sample(nes_t *nes) {
-  if (nes->apu.buf == NULL)
+// expansion audio reads mapper state, so it's only mixed in on the
+// emulation thread (carts that have it don't get a synthesis thread)
+static inline void nes_apu_send_sample(nes_t *nes, nes_apu_t *apu,
+                                       const int mode) {
+  if (apu->buf == NULL)
     return;
 
-  if (nes->apu.buf_size == nes->apu.max_buf_size)
+  if (apu->buf_size == apu->max_buf_size)
     return;
 
-  nes->apu.buf[nes->apu.buf_size] = nes_apu_get_output(nes);
-  nes->apu.buf_size++;
-}
-
-void nes_apu_tick(nes_t *nes) {
-  uint64_t cycle1 = nes->apu.cycle;
-  nes->apu.cycle++;
-
-  uint64_t cycle2 = nes->apu.cycle;
-  nes_apu_step_tmr(nes);
+  float ext = 0.0;
+  if (mode == NES_APU_MODE_FULL && nes->cart.mapper.funcs.audio)
+    ext = nes->cart.mapper.funcs.audio(nes);
 
-  int f1 = (int)((double)cycle1 / nes_apu_frame_counter_rate);
-  int f2 = (int)((double)cycle2 / nes_apu_frame_counter_rate);
+  apu->buf[apu->buf_size] = nes_apu_get_output(apu, ext);
+  apu->buf_size++;
+}
 
-  if (f1 != f2)
-    nes_apu_step_frame_counter(nes);
+// one APU tick
+// only the DMC (which steals CPU cycles for its fetches) is stepped every
+// tick, everything else waits for the next frame counter step or sample
+// the shadow doesn't run the channel timers or take samples at all, but
+// tells the synthesis thread about each frame counter step, so it gets to
+// catch up even while nothing is written
+static inline void nes_apu_step(nes_t *nes, nes_apu_t *apu, const int mode) {
+  uint64_t cycle = ++apu->cycle;
+
+  if (cycle % 2 == 0)
+    nes_apu_dmc_step_tmr(nes, apu, mode);
+
+  if (cycle == apu->frame_next) {
+    if (mode == NES_APU_MODE_SHADOW)
+      nes_apu_put(apu->queue, cycle, NES_APU_REC_SYNC, 0);
+    else if (nes_apu_audible(mode))
+      nes_apu_run_tmr(apu);
+    nes_apu_step_frame_counter(nes, apu, mode);
+    apu->frame_next = nes_apu_next_boundary(cycle, nes_apu_frame_counter_rate);
+  }
 
-  int s1 = (int)((double)cycle1 / nes_apu_sample_rate);
-  int s2 = (int)((double)cycle2 / nes_apu_sample_rate);
+  if (nes_apu_audible(mode) && cycle == apu->sample_next) {
+    nes_apu_send_sample(nes, apu, mode);
+    apu->sample_next = nes_apu_next_boundary(cycle, nes_apu_sample_rate);
+  }
+}
 
-  if (s1 != s2)
-    nes_apu_send_sample(nes);
+void nes_apu_tick(nes_t *nes) {
+  if (nes->apu.queue)
+    nes_apu_step(nes, &nes->apu, NES_APU_MODE_SHADOW);
+  else if (nes->apu.mute)
+    nes_apu_step(nes, &nes->apu, NES_APU_MODE_MUTE);
+  else
+    nes_apu_step(nes, &nes->apu, NES_APU_MODE_FULL);
 }
 
 // APU control register write
-static inline void nes_apu_write_ctrl(nes_t *nes, uint8_t val) {
-  nes->apu.sq1.flags = BITMCHG(nes->apu.sq1.flags, NES_APU_FLAG_SQR_ENABLED,
+static inline void nes_apu_write_ctrl(nes_apu_t *apu, uint8_t val) {
+  apu->sq1.flags = BITMCHG(apu->sq1.flags, NES_APU_FLAG_SQR_ENABLED,
     BITMGET(val, 0x01));
-  nes->apu.sq2.flags = BITMCHG(nes->apu.sq2.flags, NES_APU_FLAG_SQR_ENABLED,
+  apu->sq2.flags = BITMCHG(apu->sq2.flags, NES_APU_FLAG_SQR_ENABLED,
     BITMGET(val, 0x02));
-  nes->apu.tri.flags = BITMCHG(nes->apu.tri.flags, NES_APU_FLAG_TRI_ENABLED,
+  apu->tri.flags = BITMCHG(apu->tri.flags, NES_APU_FLAG_TRI_ENABLED,
     BITMGET(val, 0x04));
-  nes->apu.noi.flags = BITMCHG(nes->apu.noi.flags, NES_APU_FLAG_NOI_ENABLED,
+  apu->noi.flags = BITMCHG(apu->noi.flags, NES_APU_FLAG_NOI_ENABLED,
     BITMGET(val, 0x08));
-  nes->apu.dmc.flags = BITMCHG(nes->apu.dmc.flags, NES_APU_FLAG_DMC_ENABLED,
+  apu->dmc.flags = BITMCHG(apu->dmc.flags, NES_APU_FLAG_DMC_ENABLED,
     BITMGET(val, 0x10));
 
-  if (!BITMGET(nes->apu.sq1.flags, NES_APU_FLAG_SQR_ENABLED))
-    nes->apu.sq1.length = 0;
-  if (!BITMGET(nes->apu.sq2.flags, NES_APU_FLAG_SQR_ENABLED))
-    nes->apu.sq2.length = 0;
-  if (!BITMGET(nes->apu.tri.flags, NES_APU_FLAG_TRI_ENABLED))
-    nes->apu.tri.length = 0;
-  if (!BITMGET(nes->apu.noi.flags, NES_APU_FLAG_NOI_ENABLED))
-    nes->apu.noi.length = 0;
-  if (!BITMGET(nes->apu.dmc.flags, NES_APU_FLAG_DMC_ENABLED)) {
-    nes->apu.dmc.cur_length = 0;
+  if (!BITMGET(apu->sq1.flags, NES_APU_FLAG_SQR_ENABLED))
+    apu->sq1.length = 0;
+  if (!BITMGET(apu->sq2.flags, NES_APU_FLAG_SQR_ENABLED))
+    apu->sq2.length = 0;
+  if (!BITMGET(apu->tri.flags, NES_APU_FLAG_TRI_ENABLED))
+    apu->tri.length = 0;
+  if (!BITMGET(apu->noi.flags, NES_APU_FLAG_NOI_ENABLED))
+    apu->noi.length = 0;
+  if (!BITMGET(apu->dmc.flags, NES_APU_FLAG_DMC_ENABLED)) {
+    apu->dmc.cur_length = 0;
   } else {
-    if (nes->apu.dmc.cur_length == 0)
-      nes_apu_dmc_restart(&nes->apu.dmc);
+    if (apu->dmc.cur_length == 0)
+      nes_apu_dmc_restart(&apu->dmc);
   }
 }
 
 // APU frame counter register write
-static inline void nes_apu_write_frame_counter(nes_t *nes, uint8_t val) {
-  nes->apu.frame_period = 4 + ((val >> 7) & 0x01);
+static inline void nes_apu_write_frame_counter(nes_t *nes, nes_apu_t *apu,
+                                               uint8_t val, const int mode) {
+  apu->frame_period = 4 + ((val >> 7) & 0x01);
 
-  if (nes->apu.frame_period == 5)
-    nes_apu_step_frame_counter(nes);
+  if (apu->frame_period == 5)
+    nes_apu_step_frame_counter(nes, apu, mode);
   
-  nes->apu.frame_irq = !((val >> 6) & 1);
+  apu->frame_irq = !((val >> 6) & 1);
 }
 
 // APU registers write, addr is the register index
+static inline void nes_apu_write_reg(nes_t *nes, nes_apu_t *apu,
+                                     uint16_t addr, uint8_t val,
+                                     const int mode) {
+  if (nes_apu_audible(mode))
+    nes_apu_run_tmr(apu);
+
+  if (addr < 0x04) {nes_apu_sqr_write(&apu->sq1, addr, val); return;}
+  if (addr < 0x08) {nes_apu_sqr_write(&apu->sq2, addr - 0x04, val); return;}
+  if (addr < 0x0C) {nes_apu_tri_write(&apu->tri, addr - 0x08, val); return;}
+  if (addr < 0x10) {nes_apu_noi_write(&apu->noi, addr - 0x0C, val); return;}
+  if (addr < 0x14) {nes_apu_dmc_write(&apu->dmc, addr - 0x10, val); return;}
+  if (addr == 0x15) {nes_apu_write_ctrl(apu, val); return;}
+  if (addr == 0x17) {nes_apu_write_frame_counter(nes, apu, val, mode); return;}
+}
+
 void nes_apu_write(nes_t *nes, uint16_t addr, uint8_t val) {
-  if (addr < 0x04) {nes_apu_sqr_write(&nes->apu.sq1, addr, val); return;}
-  if (addr < 0x08) {nes_apu_sqr_write(&nes->apu.sq2, addr - 0x04, val); return;}
-  if (addr < 0x0C) {nes_apu_tri_write(&nes->apu.tri, addr - 0x08, val); return;}
-  if (addr < 0x10) {nes_apu_noi_write(&nes->apu.noi, addr - 0x0C, val); return;}
-  if (addr < 0x14) {nes_apu_dmc_write(&nes->apu.dmc, addr - 0x10, val); return;}
-  if (addr == 0x15) {nes_apu_write_ctrl(nes, val); return;}
-  if (addr == 0x17) {nes_apu_write_frame_counter(nes, val); return;}
+  if (nes->apu.queue) {
+    nes_apu_put(nes->apu.queue, nes->apu.cycle, addr, val);
+    nes_apu_write_reg(nes, &nes->apu, addr, val, NES_APU_MODE_SHADOW);
+  } else if (nes->apu.mute) {
+    nes_apu_write_reg(nes, &nes->apu, addr, val, NES_APU_MODE_MUTE);
+  } else {
+    nes_apu_write_reg(nes, &nes->apu, addr, val, NES_APU_MODE_FULL);
+  }
+}
+
+// stops or restarts sound output; a muted APU still does what the CPU can
+// see ($4015 reads, the frame IRQ, DMC fetches), like the shadow one, so
+// emulation doesn't change, but skips the channels and makes no samples
+// the channels carry on from where they were once it's back on
+// does nothing while synthesis is on another thread (see nes_apu_split)
+void nes_apu_mute(nes_t *nes, int on) {
+  nes_apu_t *apu = &nes->apu;
+  if (apu->queue)
+    return;
+
+  if (apu->mute && !on) {
+    apu->tmr_cycle = apu->cycle;
+    apu->sample_next = nes_apu_next_boundary(apu->cycle, nes_apu_sample_rate);
+  }
+  apu->mute = !!on;
+}
+
+// synthesis thread
+
+// hands sound synthesis over to another thread: from here on, the emulation
+// thread only keeps a shadow APU for $4015 reads, the frame IRQ and DMC
+// fetches, and queues register writes and DMC sample bytes, stamped with
+// their cycle; the other thread runs its own copy of the APU from those
+// with nes_apu_synth, so the output doesn't change
+// wait gets called on the emulation thread while the queue is full
+// doesn't work for carts with expansion audio or while muted; returns 0 on
+// success
+int nes_apu_split(nes_t *nes, nes_apu_wait_func_t wait, void *ctx) {
+  if (nes->apu.queue || nes->apu.mute || nes->cart.mapper.funcs.audio)
+    return -1;
+
+  nes_apu_queue_t *q = calloc(1, sizeof(nes_apu_queue_t));
+  if (!q)
+    return -1;
+
+  q->apu = nes->apu;
+  q->apu.buf = malloc(q->apu.max_buf_size);
+  q->apu.buf_size = 0;
+  if (!q->apu.buf) {
+    free(q);
+    return -1;
+  }
+
+  q->wait = wait;
+  q->ctx = ctx;
+  nes->apu.queue = q;
+  return 0;
+}
+
+// runs the synthesis thread's APU up to the given cycle
+static inline void nes_apu_synth_run(nes_apu_t *apu, uint64_t cycle) {
+  while (apu->cycle < cycle)
+    nes_apu_step(NULL, apu, NES_APU_MODE_SYNTH);
+}
+
+// runs the queued records on the synthesis thread; samples go to
+// q->apu.buf, which the caller empties
+// returns 1 if it stopped early since the buffer is half full, 0 once the
+// queue is empty
+int nes_apu_synth(nes_apu_queue_t *q) {
+  nes_apu_t *apu = &q->apu;
+  uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+  for (uint32_t tail = q->tail; tail != head; ) {
+    if (apu->buf_size >= apu->max_buf_size / 2)
+      return 1;
+
+    nes_apu_rec_t *rec = &q->rec[tail % NES_APU_QUEUE_SIZE];
+    if (rec->kind == NES_APU_REC_DMC) {
+      // fetched on the tick it's stamped with, before the DMC timer steps
+      nes_apu_synth_run(apu, rec->cycle - 1);
+      nes_apu_dmc_load(&apu->dmc, rec->val);
+    } else {
+      nes_apu_synth_run(apu, rec->cycle);
+      if (rec->kind != NES_APU_REC_SYNC)
+        nes_apu_write_reg(NULL, apu, rec->kind, rec->val, NES_APU_MODE_SYNTH);
+    }
+
+    __atomic_store_n(&q->tail, ++tail, __ATOMIC_RELEASE);
+  }
+
+  return 0;
+}
+
+// takes synthesis back onto the emulation thread; call after the other
+// thread is done with the queue
+// whatever it still had queued is run, and its APU carries on from there
+void nes_apu_join(nes_t *nes) {
+  nes_apu_queue_t *q = nes->apu.queue;
+  if (!q)
+    return;
+
+  // samples made here go to the emulation thread's buffer, if they fit
+  nes_apu_t *apu = &nes->apu;
+  int more;
+  do {
+    more = nes_apu_synth(q);
+    if (!more)
+      nes_apu_synth_run(&q->apu, apu->cycle);
+
+    uint32_t n = apu->max_buf_size - apu->buf_size;
+    if (n > q->apu.buf_size) n = q->apu.buf_size;
+    memcpy(apu->buf + apu->buf_size, q->apu.buf, n);
+    apu->buf_size += n;
+    q->apu.buf_size = 0;
+  } while (more);
+
+  free(q->apu.buf);
+  q->apu.buf = nes->apu.buf;
+  q->apu.buf_size = nes->apu.buf_size;
+  q->apu.queue = NULL;
+  nes->apu = q->apu;
+  free(q);
 }
 
 // APU registers read, addr is the register index
@@ -2,9 +2,84 @@
 
 #include "nes_structs.h"
 
+// expansion audio chips are run in batches: a chip only catches up with
+// the APU when one of its registers is written or a sample is taken, and
+// adds up its output level over the cycles in between, so each sample gets
+// the average level over its period (a box filter, which also keeps the
+// worst of the aliasing out)
+typedef struct {
+  uint64_t cycle; // APU cycle the chip was run up to
+  uint64_t start; // APU cycle of the last sample
+  float sum; // output level summed over the cycles since then
+} nes_apu_ext_t;
+
+#define NES_APU_EXT_IDLE 0x8000 // cycles without a sample, far over a sample period
+
+// returns how many cycles the chip has to run to catch up with the APU;
+// once nothing was sampled for a while (muted, or an instance that doesn't
+// produce sound) the sum is dropped and the span cut short, so both stay
+// bounded and the first sample after that averages only the last stretch
+static inline uint32_t nes_apu_ext_span(nes_t *nes, nes_apu_ext_t *ext) {
+  uint64_t n = nes->apu.cycle - ext->cycle;
+  if (nes->apu.cycle - ext->start > NES_APU_EXT_IDLE) {
+    if (n > NES_APU_EXT_IDLE) n = NES_APU_EXT_IDLE;
+    ext->start = nes->apu.cycle - n;
+    ext->sum = 0.0;
+  }
+  ext->cycle = nes->apu.cycle;
+  return n;
+}
+
+// returns the average level since the last sample and starts a new one
+// (call after the chip has caught up)
+static inline float nes_apu_ext_sample(nes_apu_ext_t *ext) {
+  uint32_t n = ext->cycle - ext->start;
+  float res = n ? ext->sum / n : 0.0;
+  ext->start = ext->cycle;
+  ext->sum = 0.0;
+  return res;
+}
+
+#define NES_APU_QUEUE_SIZE 8192 // records, a power of 2
+
+// queue record kinds besides register writes, whose kind is the register
+// index
+enum nes_apu_rec_kind {
+  NES_APU_REC_DMC = 0x20, // DMC sample byte fetch, val is the byte
+  NES_APU_REC_SYNC = 0x21, // nothing happened, synthesis can catch up
+};
+
+// something that happened to the APU on a given cycle
+typedef struct {
+  uint64_t cycle;
+  uint8_t kind; // register index or nes_apu_rec_kind
+  uint8_t val;
+} nes_apu_rec_t;
+
+typedef void (*nes_apu_wait_func_t)(void *ctx);
+
+// lock-free single producer, single consumer queue from the emulation
+// thread to the synthesis thread (see nes_apu_split)
+struct nes_apu_queue {
+  nes_apu_rec_t rec[NES_APU_QUEUE_SIZE];
+  uint32_t head; // next record to write, only the emulation thread moves it
+  uint32_t tail __attribute__((aligned(64))); // next record to read, only
+                                               // the synthesis thread moves it
+  nes_apu_wait_func_t wait; // called while the queue is full
+  void *ctx;
+
+  nes_apu_t apu; // the APU as the synthesis thread runs it
+};
+
 void nes_apu_init(nes_apu_t *apu, uint32_t buf_size);
 void nes_apu_cleanup(nes_apu_t *apu);
+int nes_apu_clone(nes_apu_t *apu, const nes_apu_t *src);
 void nes_apu_tick(nes_t *nes);
 
 uint8_t nes_apu_read(nes_t *nes, uint16_t addr);
 void nes_apu_write(nes_t *nes, uint16_t addr, uint8_t val);
+void nes_apu_mute(nes_t *nes, int on);
+
+int nes_apu_split(nes_t *nes, nes_apu_wait_func_t wait, void *ctx);
+int nes_apu_synth(nes_apu_queue_t *q);
+void nes_apu_join(nes_t *nes);
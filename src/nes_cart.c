@@ -1,157 +1,474 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 #include "nes_cart.h"
 #include "nes_mappers.h"
+#include "nes_run.h"
 #include "nes_cpu.h"
 #include "nes_mem.h"
+#include "nes_romdb.h"
 #include "error.h"
 #include "errcodes.h"
 
-// video memory address translation functions for different mirroring modes
+// nametable RAM pages used for each of the four nametables in different
+// mirroring modes
+static const uint8_t nes_cart_mirrors[][4] = {
+  {0, 1, 0, 1}, // vertical
+  {0, 0, 1, 1}, // horizontal
+  {0, 1, 2, 3}, // none (four-screen)
+  {0, 0, 0, 0}, // single screen (page 0)
+  {1, 1, 1, 1}, // single screen (page 1)
+};
 
-// single screen (page 0)
-uint16_t nes_cart_mirror_single0(uint16_t addr) {
-  return addr & 0x03FF;
+void nes_cart_set_mirroring(nes_t *nes, enum mirror_mode mode) {
+  for (int i = 0; i < 4; ++i)
+    nes_cart_set_nametable(nes, i, nes->vmem.vram + nes_cart_mirrors[mode][i] * 0x400);
+  nes->cart.mirroring = mode;
 }
 
-// single screen (page 1)
-uint16_t nes_cart_mirror_single1(uint16_t addr) {
-  return 0x400 + (addr & 0x03FF);
+// points one of the four nametables at any 1k page (e.g. mapper RAM)
+void nes_cart_set_nametable(nes_t *nes, uint8_t slot, uint8_t *page) {
+  if (nes->cart.nt[slot] != page)
+    nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_VRAM);
+  nes->cart.nt[slot] = page;
+  nes->cart.mirroring = MIRROR_CUSTOM;
 }
 
-// no mirroring (2x2 pages)
-uint16_t nes_cart_mirror_none(uint16_t addr) {
-  return addr & 0x0FFF;
+enum mirror_mode nes_cart_get_mirroring(nes_t *nes) {
+  return nes->cart.mirroring;
 }
 
-// horizontal mirroring
-uint16_t nes_cart_mirror_hor(uint16_t addr) {
-  return (addr < 0x2800) ? (addr & 0x03FF) : ((addr & 0x03FF) | 0x0400);
+// rom functions
+
+#define NES_CART_HEADER_SIZE 16
+#define NES_CART_TRAINER_SIZE 512
+#define NES_CART_MAX_ROM_SIZE 0x4000000 // 64M, way more than anything real
+
+// reserves a zeroed block of size bytes and, if src is given, puts the
+// first fsize bytes of the file at its start; mmap is used when possible,
+// so file data is never copied, nothing is cleared by hand and writes are
+// copy-on-write; without it, the file is read in one go
+static inline uint8_t *nes_cart_alloc(FILE *src, size_t fsize, size_t size, uint8_t *mapped) {
+  uint8_t *mem;
+
+#ifndef _WIN32
+  mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (mem != MAP_FAILED) {
+    if (!src || !fsize || mmap(mem, fsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                               fileno(src), 0) != MAP_FAILED) {
+      *mapped = 1;
+      return mem;
+    }
+
+    munmap(mem, size);
+  }
+#endif
+
+  if (!(mem = calloc(1, size)))
+    return NULL;
+
+  if (src) {
+    rewind(src);
+
+    if (fread(mem, 1, fsize, src) != fsize) {
+      free(mem);
+      return NULL;
+    }
+  }
+
+  *mapped = 0;
+  return mem;
 }
 
-// vertical mirroring
-uint16_t nes_cart_mirror_vert(uint16_t addr) {
-  return addr & 0x07FF;
+// frees a block from nes_cart_alloc
+static inline void nes_cart_free(uint8_t *mem, size_t size, uint8_t mapped) {
+  if (!mem)
+    return;
+
+#ifndef _WIN32
+  if (mapped)
+    munmap(mem, size);
+  else
+#endif
+    free(mem);
 }
 
-static const nes_mirror_func_t nes_cart_mirrors[] = {
-  nes_cart_mirror_vert,
-  nes_cart_mirror_hor,
-  nes_cart_mirror_none,
-  nes_cart_mirror_single0,
-  nes_cart_mirror_single1,
-};
+// frees the ROM image and cartridge RAM
+// an image shared with clones is only freed by the last one to let go
+static inline void nes_cart_free_image(nes_t *nes) {
+  if (!nes->cart.image_users ||
+      !__atomic_sub_fetch(nes->cart.image_users, 1, __ATOMIC_ACQ_REL)) {
+    nes_cart_free(nes->cart.image, nes->cart.image_size, nes->cart.image_mapped);
+    free(nes->cart.image_users);
+  }
 
-void nes_cart_set_mirroring(nes_t *nes, enum mirror_mode mode) {
-  nes->cart.mirror = nes_cart_mirrors[mode];
+  nes->cart.image_users = NULL;
+  nes_cart_free(nes->cart.ram, nes->cart.ram_size, nes->cart.ram_mapped);
+  nes->cart.image = NULL;
+  nes->cart.ram = NULL;
+  nes->mem.prgram = NULL;
+  nes->mem.wram = NULL;
 }
 
-enum mirror_mode nes_cart_get_mirroring(nes_t *nes) {
-  for (int m = MIRROR_NONE; m < MIRROR_CUSTOM; m++) {
-    if (nes->cart.mirror == nes_cart_mirrors[m])
-      return m;
+// decodes a NES 2.0 ROM size: a 12-bit count of units, or 2^E * (M * 2 + 1)
+// bytes if the high nibble is $F
+static inline uint32_t nes_cart_nes2_rom_size(uint8_t lsb, uint8_t msb, uint32_t unit) {
+  if (msb == 0x0F) {
+    if ((lsb >> 2) > 28) return UINT32_MAX; // way bigger than we can handle
+    return (1u << (lsb >> 2)) * ((lsb & 0x03) * 2 + 1);
   }
-  return MIRROR_CUSTOM;
+
+  return (((uint32_t)msb << 8) | lsb) * unit;
 }
 
-// rom functions
+// decodes a NES 2.0 RAM size nibble (64 << n bytes, 0 means none)
+static inline uint32_t nes_cart_nes2_ram_size(uint8_t n) {
+  return n ? (64u << n) : 0;
+}
+
+// fills ROM info from an iNES or NES 2.0 header
+static inline void nes_cart_parse_header(const uint8_t *hdr, nes_rom_info_t *info) {
+  memset(info, 0, sizeof(nes_rom_info_t));
+
+  info->mapper = (hdr[6] >> 4) | (hdr[7] & 0xF0);
+  info->battery = !!BITGET(hdr[6], 1);
+
+  if (BITGET(hdr[6], 3))
+    info->mirroring = MIRROR_NONE;
+  else if (BITGET(hdr[6], 0))
+    info->mirroring = MIRROR_VERTICAL;
+  else
+    info->mirroring = MIRROR_HORIZONTAL;
+
+  if ((hdr[7] & 0x0C) == 0x08) {
+    info->nes2 = 1;
+    info->mapper |= (uint16_t)(hdr[8] & 0x0F) << 8;
+    info->submapper = hdr[8] >> 4;
+    info->prg_size = nes_cart_nes2_rom_size(hdr[4], hdr[9] & 0x0F, 0x4000);
+    info->chr_size = nes_cart_nes2_rom_size(hdr[5], hdr[9] >> 4, 0x2000);
+    // volatile and battery-backed RAM are simply put together
+    info->prgram_size = nes_cart_nes2_ram_size(hdr[10] & 0x0F) +
+                        nes_cart_nes2_ram_size(hdr[10] >> 4);
+    info->chrram_size = nes_cart_nes2_ram_size(hdr[11] & 0x0F) +
+                        nes_cart_nes2_ram_size(hdr[11] >> 4);
+  } else {
+    // old tools left junk like "DiskDude!" in bytes 7-15, so nothing past
+    // byte 6 can be trusted if there's anything there
+    int junk = (hdr[7] & 0x0C) || hdr[12] || hdr[13] || hdr[14] || hdr[15];
+    if (junk)
+      info->mapper &= 0x0F;
+    info->prg_size = hdr[4] * 0x4000;
+    info->chr_size = hdr[5] * 0x2000;
+    // iNES has no real PRG-RAM size, assume 8k unless byte 8 says more
+    info->prgram_size = (hdr[8] && !junk ? hdr[8] : 1) * 0x2000;
+    info->chrram_size = hdr[5] ? 0 : 0x2000;
+  }
+}
 
-// reads an iNES ROM from stream
+// reads an iNES or NES 2.0 ROM from stream
 static inline void nes_cart_read_rom(nes_t *nes, FILE *src) {
+  uint8_t hdr[NES_CART_HEADER_SIZE];
+
   rewind(src);
 
-  if (!(fgetc(src) == 'N' && fgetc(src) == 'E' && fgetc(src) == 'S' &&
-        fgetc(src) == '\32')) {
+  if (fread(hdr, 1, sizeof(hdr), src) != sizeof(hdr) ||
+      !(hdr[0] == 'N' && hdr[1] == 'E' && hdr[2] == 'S' && hdr[3] == '\32')) {
     error_set_code(ERR_ROM_LOAD);
     error_log_write("Corrupted ROM file\n");
     return;
   }
 
-  uint8_t rom16_count = fgetc(src);
-  uint8_t vram8_count = fgetc(src);
-  uint8_t ctrlbyte = fgetc(src);
-  uint8_t mapper = fgetc(src) | (ctrlbyte >> 4);
+  nes_rom_info_t info;
+  nes_cart_parse_header(hdr, &info);
 
-  fgetc(src); fgetc(src); fgetc(src); fgetc(src);
-  fgetc(src); fgetc(src); fgetc(src); fgetc(src);
+  if (info.prg_size > NES_CART_MAX_ROM_SIZE || info.chr_size > NES_CART_MAX_ROM_SIZE) {
+    error_set_code(ERR_ROM_LOAD);
+    error_log_write("Corrupted ROM file\n");
+    return;
+  }
 
-  if (mapper > 0x40) mapper &= 0x0F;
+  fseek(src, 0, SEEK_END);
+  long fsize = ftell(src);
 
-  if (rom16_count) {
-    if (!(nes->cart.rom = malloc(sizeof(uint8_t *) * rom16_count))) {
-      error_set_code(ERR_ROM_LOAD);
-      error_log_write("Out of memory on ROM reading!\n");
-      return;
-    }
+  if (fsize < 0) {
+    error_set_code(ERR_ROM_LOAD);
+    error_log_write("Could not get ROM file size\n");
+    return;
+  }
 
-    for (int i = 0; i < rom16_count; ++i) {
-      if (!(nes->cart.rom[i] = malloc(0x4000))) {
-        for (int j = 0; j < i; ++j)
-          free(nes->cart.rom[j]);
+  // PRG and CHR-ROM are used right where they are in the file, which is
+  // padded with zeroes if it is shorter than the header says, plus 16k so
+  // partial banks at the end don't go out of bounds
+  size_t prg_ofs = NES_CART_HEADER_SIZE + (BITGET(hdr[6], 2) ? NES_CART_TRAINER_SIZE : 0);
+  size_t size = prg_ofs + (size_t)info.prg_size + info.chr_size + 0x4000;
 
-        free(nes->cart.rom);
+  if (size < (size_t)fsize)
+    size = fsize;
 
-        error_set_code(ERR_ROM_LOAD);
-        error_log_write("Out of memory on ROM bank reading!\n");
-        return;
-      }
-    }
+  if (!(nes->cart.image = nes_cart_alloc(src, fsize, size, &nes->cart.image_mapped))) {
+    error_set_code(ERR_ROM_LOAD);
+    error_log_write("Out of memory on ROM reading!\n");
+    return;
   }
 
-  if (!vram8_count) {
-    // one 8k CHR-RAM present
-    vram8_count = 1;
-    nes->cart.chr_ram = 1;
-  }
+  nes->cart.image_size = size;
+
+  // headers are often wrong, the database knows better
+  size_t data_size = ((size_t)fsize > prg_ofs) ? fsize - prg_ofs : 0;
+  uint32_t crc = nes_romdb_crc32(0, nes->cart.image + prg_ofs, data_size);
+  const nes_romdb_entry_t *entry = nes_romdb_find(crc);
 
-  if (vram8_count) {
-    if (!(nes->cart.vram = malloc(sizeof(uint8_t *) * vram8_count))) {
+  if (entry) {
+    info = entry->info;
+
+    if (prg_ofs + (size_t)info.prg_size + info.chr_size > size) {
+      nes_cart_free_image(nes);
       error_set_code(ERR_ROM_LOAD);
-      error_log_write("Out of memory on VRAM reading!\n");
+      error_log_write("ROM is smaller than its database entry says\n");
       return;
     }
+  }
 
-    for (int i = 0; i < vram8_count; ++i) {
-      if (!(nes->cart.vram[i] = malloc(0x2000))) {
-        for (int j = 0; j < i; ++j)
-          free(nes->cart.vram[j]);
+  if (info.mapper >= NES_MAX_MAPPERS) {
+    nes_cart_free_image(nes);
+    error_set_code(ERR_ROM_LOAD);
+    error_log_write("Unknown or unsupported mapper!\n");
+    return;
+  }
 
-        free(nes->cart.vram);
+  uint16_t rom16_count = (info.prg_size + 0x3FFF) / 0x4000;
+  uint16_t vram8_count;
+  size_t chrram_size = 0;
 
-        for (int j = 0; j < rom16_count; ++j)
-          free(nes->cart.rom[j]);
+  if (info.chr_size) {
+    vram8_count = (info.chr_size + 0x1FFF) / 0x2000;
+  } else {
+    // mappers expect at least one 8k CHR-RAM bank
+    vram8_count = (info.chrram_size > 0x2000) ? (info.chrram_size + 0x1FFF) / 0x2000 : 1;
+    chrram_size = (size_t)vram8_count * 0x2000;
+    nes->cart.chr_ram = 1;
+  }
 
-        free(nes->cart.rom);
+  // CHR-RAM and PRG-RAM get their own zeroed block, sized exactly
+  nes->cart.ram_size = chrram_size + info.prgram_size;
 
-        error_set_code(ERR_ROM_LOAD);
-        error_log_write("Out of memory on VRAM bank reading!\n");
-        return;
-      }
-    }
+  if (nes->cart.ram_size &&
+      !(nes->cart.ram = nes_cart_alloc(NULL, 0, nes->cart.ram_size, &nes->cart.ram_mapped))) {
+    nes_cart_free_image(nes);
+    error_set_code(ERR_ROM_LOAD);
+    error_log_write("Out of memory on cartridge RAM allocation!\n");
+    return;
+  }
+
+  nes->cart.prg = nes->cart.image + prg_ofs;
+  nes->cart.chr = chrram_size ? nes->cart.ram : nes->cart.prg + info.prg_size;
+
+  nes->mem.prgram = info.prgram_size ? nes->cart.ram + chrram_size : NULL;
+  nes->mem.prgram_size = info.prgram_size;
+  nes->mem.wram_mask = (info.prgram_size >= 0x2000) ? 0x1FFF : info.prgram_size - 1;
+
+  nes->cart.rom = malloc(sizeof(uint8_t *) * (rom16_count ? rom16_count : 1));
+  nes->cart.vram = malloc(sizeof(uint8_t *) * vram8_count);
+
+  if (!nes->cart.rom || !nes->cart.vram) {
+    free(nes->cart.rom);
+    free(nes->cart.vram);
+    nes->cart.rom = NULL;
+    nes->cart.vram = NULL;
+    nes_cart_free_image(nes);
+
+    error_set_code(ERR_ROM_LOAD);
+    error_log_write("Out of memory on ROM bank reading!\n");
+    return;
   }
 
   for (int i = 0; i < rom16_count; ++i)
-    fread(nes->cart.rom[i], 1, 0x4000, src);
+    nes->cart.rom[i] = nes->cart.prg + i * 0x4000;
 
   for (int i = 0; i < vram8_count; ++i)
-    fread(nes->cart.vram[i], 1, 0x2000, src);
+    nes->cart.vram[i] = nes->cart.chr + i * 0x2000;
 
   nes->cart.rom16_count = rom16_count;
   nes->cart.vram8_count = vram8_count;
+  nes->cart.mapper_id = info.mapper;
+  nes->cart.submapper = info.submapper;
+  nes->cart.battery = info.battery;
+  nes->cart.crc = crc;
 
-  if (BITGET(ctrlbyte, 4))
-    nes_cart_set_mirroring(nes, MIRROR_NONE);
-  else if (BITGET(ctrlbyte, 0))
-    nes_cart_set_mirroring(nes, MIRROR_VERTICAL);
-  else
-    nes_cart_set_mirroring(nes, MIRROR_HORIZONTAL);
+  nes->cpu.idle.enabled = nes->cpu.idle.allowed && !info.no_idle;
+  nes->cpu.idle.state = NES_CPU_IDLE_NONE;
+  nes->cpu.idle.reject_head = nes->cpu.idle.reject_tail = 0;
+  nes->cpu.idle.skipped = 0;
+
+  nes_cart_set_mirroring(nes, info.mirroring);
+
+  nes_get_mapper_funcs(info.mapper, &nes->cart.mapper.funcs);
+
+  fprintf(stdout, "%d 16KB ROM, %d 8KB VR%cM, %uKB PRG-RAM%s, Mapper %d (%s), "
+          "%s, CRC32 %08X%s\n", rom16_count, vram8_count, nes->cart.chr_ram ? 'A' : 'O',
+          info.prgram_size / 1024, info.battery ? " (battery)" : "", info.mapper,
+          nes_get_mapper_name(info.mapper), info.nes2 ? "NES 2.0" : "iNES", crc,
+          entry ? " (from database)" : "");
+}
+
+
+// battery save functions
+
+// makes the save file name by swapping the ROM file extension for .sav
+static inline char *nes_cart_save_fname(const char *fname) {
+  const char *ext = strrchr(fname, '.');
+  const char *dir = strrchr(fname, '/');
+  const char *dir2 = strrchr(fname, '\\');
+
+  if (dir2 > dir) dir = dir2;
+  size_t len = (ext && ext > dir) ? (size_t)(ext - fname) : strlen(fname);
+
+  char *res = malloc(len + sizeof(".sav"));
+  if (!res) return NULL;
+
+  memcpy(res, fname, len);
+  memcpy(res + len, ".sav", sizeof(".sav"));
+  return res;
+}
+
+// loads battery-backed PRG-RAM from the save file, if there is one
+static inline void nes_cart_load_save(nes_t *nes, const char *fname) {
+  if (!nes->cart.battery || !nes->mem.prgram)
+    return;
+
+  if (!(nes->cart.sav_fname = nes_cart_save_fname(fname)))
+    return;
+
+  FILE *sav = fopen(nes->cart.sav_fname, "rb");
+  if (!sav)
+    return; // no save yet
+
+  size_t len = fread(nes->mem.prgram, 1, nes->mem.prgram_size, sav);
+  fclose(sav);
+
+  fprintf(stdout, "Loaded %u bytes of PRG-RAM from %s\n", (uint32_t)len, nes->cart.sav_fname);
+}
+
+// returns 1 if battery-backed PRG-RAM has changed since the last snapshot
+int nes_cart_save_dirty(nes_t *nes) {
+  return nes->cart.sav_fname && nes->mem.wram_dirty;
+}
+
+// copies battery-backed PRG-RAM (mem.prgram_size bytes) to buf and marks
+// it as saved; the copy can then be written out on another thread
+void nes_cart_save_snapshot(nes_t *nes, uint8_t *buf) {
+  memcpy(buf, nes->mem.prgram, nes->mem.prgram_size);
+  nes->mem.wram_dirty = 0;
+}
+
+// writes a PRG-RAM snapshot to the save file
+// goes through a temp file, so a crash can't leave a half-written save
+void nes_cart_write_save(const char *fname, const uint8_t *buf, uint32_t size) {
+  size_t len = strlen(fname);
+  char *tmp = malloc(len + sizeof(".tmp"));
+  if (!tmp) return;
 
-  nes_get_mapper_funcs(mapper, &nes->cart.mapper.funcs);
+  memcpy(tmp, fname, len);
+  memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+
+  FILE *sav = fopen(tmp, "wb");
+  int ok = sav && fwrite(buf, 1, size, sav) == size;
+  if (sav && fclose(sav)) ok = 0;
+
+#ifdef _WIN32
+  // rename can't replace files here
+  if (ok) remove(fname);
+#endif
+
+  if (!ok || rename(tmp, fname)) {
+    fprintf(stderr, "Could not write save file %s\n", fname);
+    remove(tmp);
+  }
 
-  fprintf(stdout, "%d 16KB ROM, %d 8KB VR%cM, Mapper %d (%s), CTRL %d\n", rom16_count,
-          vram8_count, nes->cart.chr_ram ? 'A' : 'O', mapper, nes_get_mapper_name(mapper), ctrlbyte);
+  free(tmp);
 }
 
+// cloning
+
+// points p, which may be into src's cartridge or nametable RAM, at the same
+// place in nes's; anything else (ROM, NULL) is shared as it is
+uint8_t *nes_cart_clone_ptr(nes_t *nes, nes_t *src, uint8_t *p) {
+  if (p >= src->cart.ram && p < src->cart.ram + src->cart.ram_size)
+    return nes->cart.ram + (p - src->cart.ram);
+  if (p >= src->vmem.vram && p < src->vmem.vram + sizeof(src->vmem.vram))
+    return nes->vmem.vram + (p - src->vmem.vram);
+  return p;
+}
+
+// gives nes, which holds a plain copy of src, src's cartridge: the ROM
+// image is shared, cartridge RAM and mapper data are copied, and whatever
+// pointed into src's RAM is moved over to nes's
+// clones never write the battery save
+// returns 0 on success, -1 if out of memory (then nes has no cartridge)
+int nes_cart_clone(nes_t *nes, nes_t *src) {
+  nes_cart_t *cart = &nes->cart;
+
+  cart->sav_fname = NULL;
+  cart->ram = NULL;
+  cart->rom = malloc(sizeof(uint8_t *) * (cart->rom16_count ? cart->rom16_count : 1));
+  cart->vram = malloc(sizeof(uint8_t *) * cart->vram8_count);
+
+  if (!src->cart.image_users && (src->cart.image_users = malloc(sizeof(uint32_t))))
+    *src->cart.image_users = 1;
+
+  // it's all written right away, so mmap has nothing to save here
+  if (cart->ram_size) {
+    cart->ram = malloc(cart->ram_size);
+    cart->ram_mapped = 0;
+  }
+
+  if (!cart->rom || !cart->vram || !src->cart.image_users ||
+      (cart->ram_size && !cart->ram)) {
+    free(cart->rom);
+    free(cart->vram);
+    nes_cart_free(cart->ram, cart->ram_size, cart->ram_mapped);
+    *cart = (nes_cart_t){0};
+    return -1;
+  }
+
+  cart->image_users = src->cart.image_users;
+  __atomic_add_fetch(cart->image_users, 1, __ATOMIC_RELAXED);
+
+  if (cart->ram_size)
+    memcpy(cart->ram, src->cart.ram, cart->ram_size);
+
+  memcpy(cart->rom, src->cart.rom, sizeof(uint8_t *) * cart->rom16_count);
+  for (int i = 0; i < cart->vram8_count; ++i)
+    cart->vram[i] = nes_cart_clone_ptr(nes, src, src->cart.vram[i]);
+
+  cart->chr = nes_cart_clone_ptr(nes, src, src->cart.chr);
+  for (int i = 0; i < 4; ++i)
+    cart->nt[i] = nes_cart_clone_ptr(nes, src, src->cart.nt[i]);
+
+  nes->mem.prgram = nes_cart_clone_ptr(nes, src, src->mem.prgram);
+  nes->mem.wram = nes_cart_clone_ptr(nes, src, src->mem.wram);
+  for (int i = 0; i < 4; ++i)
+    nes->mem.prg[i] = nes_cart_clone_ptr(nes, src, src->mem.prg[i]);
+  for (int i = 0; i < 8; ++i)
+    nes->vmem.chr[i] = nes_cart_clone_ptr(nes, src, src->vmem.chr[i]);
+
+  if (nes_mapper_clone(nes, src)) {
+    // not nes_cart_unload, the mapper has nothing to clean up
+    free(cart->rom);
+    free(cart->vram);
+    nes_cart_free_image(nes);
+    *cart = (nes_cart_t){0};
+    return -1;
+  }
+
+  return 0;
+}
 
 // attempts to load the given ROM file
 void nes_cart_load(nes_t *nes, const char *fname) {
@@ -165,6 +482,7 @@ void nes_cart_load(nes_t *nes, const char *fname) {
 
   nes_cart_read_rom(nes, src);
 
+  // the mapping stays valid after the file is closed
   fclose(src);
 
   if (error_get_code() != NO_ERR)
@@ -175,6 +493,11 @@ void nes_cart_load(nes_t *nes, const char *fname) {
   if (error_get_code() != NO_ERR)
     return;
 
+  nes_ppu_attach(nes);
+  nes->cart.mapper.run = nes_run_get(nes->cart.mapper_id);
+
+  nes_cart_load_save(nes, fname);
+
   fprintf(stdout, "VEC_NMI: %04X, VEC_RESET: %04X, VEC_IRQ: %04X\n",
           nes_mem_readw(nes, NES_VEC_NMI),
           nes_mem_readw(nes, NES_VEC_RESET),
@@ -183,24 +506,24 @@ void nes_cart_load(nes_t *nes, const char *fname) {
   nes->cpu.pc = nes_mem_readw(nes, NES_VEC_RESET);
 }
 
-// frees rom banks
-static inline void nes_cart_free_rom(nes_t *nes) {
-  for (int i = 0; i < nes->cart.rom16_count; ++i)
-    free(nes->cart.rom[i]);
+void nes_cart_unload(nes_t *nes) {
+  nes_mapper_cleanup(nes);
+  nes->cart.mapper.run = NULL;
 
-  free(nes->cart.rom);
-}
+  // whatever the frontend hasn't flushed yet
+  if (nes_cart_save_dirty(nes)) {
+    nes->mem.wram_dirty = 0;
+    nes_cart_write_save(nes->cart.sav_fname, nes->mem.prgram, nes->mem.prgram_size);
+  }
 
-// frees video memory banks
-static inline void nes_cart_free_vram(nes_t *nes) {
-  for (int i = 0; i < nes->cart.vram8_count; ++i)
-    free(nes->cart.vram[i]);
+  free(nes->cart.sav_fname);
+  nes->cart.sav_fname = NULL;
 
+  // banks are only views into the arena
+  free(nes->cart.rom);
   free(nes->cart.vram);
-}
+  nes->cart.rom = NULL;
+  nes->cart.vram = NULL;
 
-void nes_cart_unload(nes_t *nes) {
-  nes_mapper_cleanup(nes);
-  nes_cart_free_rom(nes);
-  nes_cart_free_vram(nes);
+  nes_cart_free_image(nes);
 }
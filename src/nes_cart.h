@@ -6,7 +6,7 @@
 enum mirror_mode {
   MIRROR_VERTICAL,
   MIRROR_HORIZONTAL,
-  MIRROR_NONE,
+  MIRROR_NONE, // four-screen, all 4k of nametable RAM is used
   MIRROR_SINGLESCREEN0,
   MIRROR_SINGLESCREEN1,
   MIRROR_CUSTOM, // for funky custom mapper modes
@@ -14,5 +14,12 @@ enum mirror_mode {
 
 void nes_cart_load(nes_t *nes, const char *fname);
 void nes_cart_set_mirroring(nes_t *nes, enum mirror_mode mode);
+void nes_cart_set_nametable(nes_t *nes, uint8_t slot, uint8_t *page);
 enum mirror_mode nes_cart_get_mirroring(nes_t *nes);
 void nes_cart_unload(nes_t *nes);
+int nes_cart_clone(nes_t *nes, nes_t *src);
+uint8_t *nes_cart_clone_ptr(nes_t *nes, nes_t *src, uint8_t *p);
+
+int nes_cart_save_dirty(nes_t *nes);
+void nes_cart_save_snapshot(nes_t *nes, uint8_t *buf);
+void nes_cart_write_save(const char *fname, const uint8_t *buf, uint32_t size);
@@ -36,11 +36,155 @@ enum nes_cpu_flag {
   NES_CPU_FLAG_N, // N (Negative)
 };
 
+#define FLAG_MASK_NZCV \
+  (FLAG_MASK_N | FLAG_MASK_Z | FLAG_MASK_C | FLAG_MASK_V)
+
+// flag access
+// with NES_CPU_LAZY_FLAGS ops don't update p, they only store the result and
+// the carry/overflow bits; p is put together when it's read as a whole (PHP,
+// BRK, interrupts, debug output)
+#ifdef NES_CPU_LAZY_FLAGS
+
+static inline uint8_t nes_cpu_get_p(nes_cpu_t *cpu) {
+  uint8_t p = BITMCLR(cpu->p, FLAG_MASK_NZCV);
+  p |= cpu->flag_n & FLAG_MASK_N;
+  if (!cpu->flag_z) p |= FLAG_MASK_Z;
+  if (cpu->flag_c) p |= FLAG_MASK_C;
+  if (cpu->flag_v) p |= FLAG_MASK_V;
+  return p;
+}
+
+static inline void nes_cpu_set_p(nes_cpu_t *cpu, uint8_t p) {
+  cpu->p = p;
+  cpu->flag_n = p;
+  cpu->flag_z = !BITMGET(p, FLAG_MASK_Z);
+  cpu->flag_c = BITMGET(p, FLAG_MASK_C) ? 1 : 0;
+  cpu->flag_v = BITMGET(p, FLAG_MASK_V) ? 1 : 0;
+}
+
+static inline uint8_t nes_cpu_get_n(nes_t *nes) {
+  return nes->cpu.flag_n & FLAG_MASK_N;
+}
+
+static inline uint8_t nes_cpu_get_z(nes_t *nes) {
+  return !nes->cpu.flag_z;
+}
+
+static inline uint8_t nes_cpu_get_c(nes_t *nes) {
+  return nes->cpu.flag_c;
+}
+
+static inline uint8_t nes_cpu_get_v(nes_t *nes) {
+  return nes->cpu.flag_v;
+}
+
+static inline void nes_cpu_set_n(nes_t *nes, int val) {
+  nes->cpu.flag_n = val ? FLAG_MASK_N : 0;
+}
+
+static inline void nes_cpu_set_z(nes_t *nes, int val) {
+  nes->cpu.flag_z = !val;
+}
+
+static inline void nes_cpu_set_c(nes_t *nes, int val) {
+  nes->cpu.flag_c = val ? 1 : 0;
+}
+
+static inline void nes_cpu_set_v(nes_t *nes, int val) {
+  nes->cpu.flag_v = val ? 1 : 0;
+}
+
+// sets Z and N flags based on given value
+static inline void nes_cpu_set_zn(nes_t *nes, uint8_t val) {
+  nes->cpu.flag_n = val;
+  nes->cpu.flag_z = val;
+}
+
+#else
+
+static inline uint8_t nes_cpu_get_p(nes_cpu_t *cpu) {
+  return cpu->p;
+}
+
+static inline void nes_cpu_set_p(nes_cpu_t *cpu, uint8_t p) {
+  cpu->p = p;
+}
+
+static inline uint8_t nes_cpu_get_n(nes_t *nes) {
+  return BITMGET(nes->cpu.p, FLAG_MASK_N);
+}
+
+static inline uint8_t nes_cpu_get_z(nes_t *nes) {
+  return BITMGET(nes->cpu.p, FLAG_MASK_Z);
+}
+
+static inline uint8_t nes_cpu_get_c(nes_t *nes) {
+  return BITMGET(nes->cpu.p, FLAG_MASK_C);
+}
+
+static inline uint8_t nes_cpu_get_v(nes_t *nes) {
+  return BITMGET(nes->cpu.p, FLAG_MASK_V);
+}
+
+static inline void nes_cpu_set_n(nes_t *nes, int val) {
+  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_N, val);
+}
+
+static inline void nes_cpu_set_z(nes_t *nes, int val) {
+  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_Z, val);
+}
+
+static inline void nes_cpu_set_c(nes_t *nes, int val) {
+  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, val);
+}
+
+static inline void nes_cpu_set_v(nes_t *nes, int val) {
+  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_V, val);
+}
+
+// sets Z and N flags based on given value
+static inline void nes_cpu_set_zn(nes_t *nes, uint8_t val) {
+  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_N, (val & 0x80));
+  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_Z, !val);
+}
+
+#endif
+
 #if defined(DEBUG) && !defined(DEBUG_SDL)
 #include <stdio.h>
 #include "nes_cpu_debug.h"
 #endif
 
+// cycle costs for each opcode
+static const uint8_t nes_cpu_op_cycles[256] = {
+  7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6, 2, 5, 2, 8, 4, 4, 6, 6,
+  2, 4, 2, 7, 4, 4, 7, 7, 6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,
+  6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6, 2, 5, 2, 8, 4, 4, 6, 6,
+  2, 4, 2, 7, 4, 4, 7, 7, 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+  6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6, 2, 5, 2, 8, 4, 4, 6, 6,
+  2, 4, 2, 7, 4, 4, 7, 7, 2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,
+  2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5, 2, 6, 2, 6, 3, 3, 3, 3,
+  2, 2, 2, 2, 4, 4, 4, 4, 2, 5, 2, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4,
+  2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6, 2, 5, 2, 8, 4, 4, 6, 6,
+  2, 4, 2, 7, 4, 4, 7, 7, 2, 6, 3, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,
+  2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
+};
+
+// page cross costs for each opcode
+static const uint8_t nes_cpu_op_page_cycles[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0,
+  0, 1, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0,
+  0, 1, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 1, 0, 0, 0, 0, 0, 1, 0, 1, 1, 1, 1, 1,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0,
+  0, 1, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 0, 0,
+};
+
 static inline void nes_cpu_init(nes_cpu_t *cpu) {
   cpu->pc = 0xC000;
   cpu->s = 0xFD;
@@ -49,13 +193,16 @@ static inline void nes_cpu_init(nes_cpu_t *cpu) {
   cpu->x = 0x00;
   cpu->y = 0x00;
 
-  cpu->p = 0x24;
+  nes_cpu_set_p(cpu, 0x24);
+
+  cpu->stall = 0;
+  cpu->dma_oam = 0;
 }
 
 // calls NMI vector, consumes 7 cycles
 static inline void nes_cpu_nmi(nes_t *nes) {
   nes_pushw(nes, nes->cpu.pc);
-  nes_pushb(nes, nes->cpu.p);
+  nes_pushb(nes, nes_cpu_get_p(&nes->cpu));
   nes->cpu.p = BITMSET(nes->cpu.p, FLAG_MASK_I);
   nes->cpu.pc = nes_mem_readw(nes, NES_VEC_NMI);
   nes->cpu.cycle += 7;
@@ -65,7 +212,7 @@ static inline void nes_cpu_nmi(nes_t *nes) {
 static inline void nes_cpu_irq(nes_t *nes) {
   if (BITMGET(nes->cpu.p, FLAG_MASK_I)) return;
   nes_pushw(nes, nes->cpu.pc);
-  nes_pushb(nes, nes->cpu.p);
+  nes_pushb(nes, nes_cpu_get_p(&nes->cpu));
   nes->cpu.p = BITMSET(nes->cpu.p, FLAG_MASK_I);
   nes->cpu.pc = nes_mem_readw(nes, NES_VEC_IRQ);
   nes->cpu.cycle += 7;
@@ -196,12 +343,6 @@ static inline uint16_t nes_v_zpy(nes_t *nes) {
   return nes_mem_readb_zp(nes, nes_a_zpy(nes));
 }
 
-// sets Z and N flags based on given value
-static inline void nes_cpu_set_zn(nes_t *nes, uint8_t val) {
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_N, (val & 0x80));
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_Z, !val);
-}
-
 // documented CPU instructions
 
 // LDA: load operand into A
@@ -239,12 +380,11 @@ static inline void nes_op_sty(nes_t *nes, uint16_t addr) {
 
 // ADC: add operand to A with carry (C flag)
 static inline void nes_op_adc(nes_t *nes, uint16_t val) {
-  uint16_t res = nes->cpu.a + val + ((nes->cpu.p & FLAG_MASK_C) ? 1 : 0);
+  uint16_t res = nes->cpu.a + val + (nes_cpu_get_c(nes) ? 1 : 0);
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, (res & 0x100));
-  nes->cpu.p =
-    BITMCHG(nes->cpu.p, FLAG_MASK_V,
-                 !((nes->cpu.a ^ val) & 0x80) && ((nes->cpu.a ^ res) & 0x80));
+  nes_cpu_set_c(nes, (res & 0x100));
+  nes_cpu_set_v(nes,
+                !((nes->cpu.a ^ val) & 0x80) && ((nes->cpu.a ^ res) & 0x80));
   nes_cpu_set_zn(nes, res & 0xFF);
 
   nes->cpu.a = res;
@@ -252,12 +392,11 @@ static inline void nes_op_adc(nes_t *nes, uint16_t val) {
 
 // SBC: sub operand from A with carry
 static inline void nes_op_sbc(nes_t *nes, uint16_t val) {
-  uint16_t res = nes->cpu.a - val - ((nes->cpu.p & FLAG_MASK_C) ? 0 : 1);
+  uint16_t res = nes->cpu.a - val - (nes_cpu_get_c(nes) ? 0 : 1);
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, !(res & 0x100));
-  nes->cpu.p =
-    BITMCHG(nes->cpu.p, FLAG_MASK_V,
-                 ((nes->cpu.a ^ val) & 0x80) && ((nes->cpu.a ^ res) & 0x80));
+  nes_cpu_set_c(nes, !(res & 0x100));
+  nes_cpu_set_v(nes,
+                ((nes->cpu.a ^ val) & 0x80) && ((nes->cpu.a ^ res) & 0x80));
   nes_cpu_set_zn(nes, res & 0xFF);
   nes->cpu.a = res;
 }
@@ -266,7 +405,7 @@ static inline void nes_op_sbc(nes_t *nes, uint16_t val) {
 static inline void nes_compare(nes_t *nes, uint8_t a, uint8_t b) {
   uint16_t res = a - b;
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, !(res & 0x100));
+  nes_cpu_set_c(nes, !(res & 0x100));
   nes_cpu_set_zn(nes, res & 0xFF);
 }
 
@@ -311,9 +450,9 @@ static inline void nes_op_eor(nes_t *nes, uint16_t val) {
 
 // BIT: AND A with operand, set V, N, Z flags based on result
 static inline void nes_op_bit(nes_t *nes, uint16_t val) {
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_V, (val & 0x40));
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_N, (val & 0x80));
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_Z, !(val & nes->cpu.a));
+  nes_cpu_set_v(nes, (val & 0x40));
+  nes_cpu_set_n(nes, (val & 0x80));
+  nes_cpu_set_z(nes, !(val & nes->cpu.a));
 }
 
 // ROL: bitwise rotate operand left by 1
@@ -321,9 +460,9 @@ static inline void nes_op_rol(nes_t *nes, uint16_t addr) {
   uint8_t val = nes_mem_readb(nes, addr);
   uint8_t res = val << 1;
 
-  if (BITMGET(nes->cpu.p, FLAG_MASK_C)) res |= 0x01;
+  if (nes_cpu_get_c(nes)) res |= 0x01;
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, (val & 0x80));
+  nes_cpu_set_c(nes, (val & 0x80));
   nes_cpu_set_zn(nes, res);
   nes_mem_writeb(nes, addr, res);
 }
@@ -333,9 +472,9 @@ static inline void nes_op_ror(nes_t *nes, uint16_t addr) {
   uint8_t val = nes_mem_readb(nes, addr);
   uint8_t res = val >> 1;
 
-  if (BITMGET(nes->cpu.p, FLAG_MASK_C)) res |= 0x80;
+  if (nes_cpu_get_c(nes)) res |= 0x80;
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, (val & 0x01));
+  nes_cpu_set_c(nes, (val & 0x01));
   nes_cpu_set_zn(nes, res);
   nes_mem_writeb(nes, addr, res);
 }
@@ -344,9 +483,9 @@ static inline void nes_op_ror(nes_t *nes, uint16_t addr) {
 static inline void nes_op_rola(nes_t *nes, uint16_t val) {
   uint8_t res = val << 1;
 
-  if (BITMGET(nes->cpu.p, FLAG_MASK_C)) res |= 0x01;
+  if (nes_cpu_get_c(nes)) res |= 0x01;
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, (val & 0x80));
+  nes_cpu_set_c(nes, (val & 0x80));
   nes_cpu_set_zn(nes, res);
   nes->cpu.a = res;
 }
@@ -355,9 +494,9 @@ static inline void nes_op_rola(nes_t *nes, uint16_t val) {
 static inline void nes_op_rora(nes_t *nes, uint16_t val) {
   uint8_t res = val >> 1;
 
-  if (BITMGET(nes->cpu.p, FLAG_MASK_C)) res |= 0x80;
+  if (nes_cpu_get_c(nes)) res |= 0x80;
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, (val & 0x01));
+  nes_cpu_set_c(nes, (val & 0x01));
   nes_cpu_set_zn(nes, res);
   nes->cpu.a = res;
 }
@@ -367,7 +506,7 @@ static inline void nes_op_asl(nes_t *nes, uint16_t addr) {
   uint8_t val = nes_mem_readb(nes, addr);
   uint8_t res = val << 1;
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, (val & 0x80));
+  nes_cpu_set_c(nes, (val & 0x80));
   nes_cpu_set_zn(nes, res);
   nes_mem_writeb(nes, addr, res);
 }
@@ -377,7 +516,7 @@ static inline void nes_op_lsr(nes_t *nes, uint16_t addr) {
   uint8_t val = nes_mem_readb(nes, addr);
   uint8_t res = val >> 1;
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, (val & 0x01));
+  nes_cpu_set_c(nes, (val & 0x01));
   nes_cpu_set_zn(nes, res);
   nes_mem_writeb(nes, addr, res);
 }
@@ -386,7 +525,7 @@ static inline void nes_op_lsr(nes_t *nes, uint16_t addr) {
 static inline void nes_op_asla(nes_t *nes, uint16_t val) {
   uint8_t res = val << 1;
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, (val & 0x80));
+  nes_cpu_set_c(nes, (val & 0x80));
   nes_cpu_set_zn(nes, res);
   nes->cpu.a = res;
 }
@@ -395,7 +534,7 @@ static inline void nes_op_asla(nes_t *nes, uint16_t val) {
 static inline void nes_op_lsra(nes_t *nes, uint16_t val) {
   uint8_t res = val >> 1;
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, (val & 0x01));
+  nes_cpu_set_c(nes, (val & 0x01));
   nes_cpu_set_zn(nes, res);
   nes->cpu.a = res;
 }
@@ -492,12 +631,12 @@ static inline void nes_op_tsx(nes_t *nes) {
 
 // CLC: clear C flag
 static inline void nes_op_clc(nes_t *nes) {
-  nes->cpu.p = BITMCLR(nes->cpu.p, FLAG_MASK_C);
+  nes_cpu_set_c(nes, 0);
 }
 
 // SEC: set C flag
 static inline void nes_op_sec(nes_t *nes) {
-  nes->cpu.p = BITMSET(nes->cpu.p, FLAG_MASK_C);
+  nes_cpu_set_c(nes, 1);
 }
 
 // CLI: clear I flag
@@ -512,7 +651,7 @@ static inline void nes_op_sei(nes_t *nes) {
 
 // CLV: clear V flag
 static inline void nes_op_clv(nes_t *nes) {
-  nes->cpu.p = BITMCLR(nes->cpu.p, FLAG_MASK_V);
+  nes_cpu_set_v(nes, 0);
 }
 
 // CLD: clear D flag
@@ -525,6 +664,209 @@ static inline void nes_op_sed(nes_t *nes) {
   nes->cpu.p = BITMSET(nes->cpu.p, FLAG_MASK_D);
 }
 
+// idle loops
+// games spend a good part of each frame spinning in loops like
+// LDA $2002 / BPL or LDA flag / BEQ until the NMI handler ends them
+// a taken backward branch (or JMP) to a short loop made only of loads,
+// compares and branches that read RAM or PPUSTATUS is armed for skipping:
+// - one pass is run normally, recording what every instruction reads
+// - if the registers are back where they were at the top, every further
+//   pass that reads the same values is the same pass again, so its
+//   instructions are skipped instead of run, only their cycles are spent
+// any difference (a value read, an interrupt moving PC, a DMA stall)
+// drops back to normal execution before the instruction that differs,
+// so timing and results stay exactly the same
+
+// idle loop states
+enum nes_cpu_idle_state {
+  NES_CPU_IDLE_NONE,   // looking for a loop
+  NES_CPU_IDLE_RECORD, // running the recorded pass
+  NES_CPU_IDLE_SKIP,   // skipping passes
+};
+
+// what an idle loop instruction reads
+enum nes_cpu_idle_read {
+  NES_CPU_IDLE_READ_NONE,
+  NES_CPU_IDLE_READ_RAM,
+  NES_CPU_IDLE_READ_STATUS, // PPUSTATUS
+};
+
+// returns the value a read of an idle loop instruction would get, without
+// the side effects of the read
+static inline uint8_t nes_cpu_idle_peek(nes_t *nes, nes_cpu_idle_op_t *op) {
+  if (op->read == NES_CPU_IDLE_READ_RAM)
+    return nes->mem.ram[op->addr & 0x07FF];
+
+  uint8_t res = nes->ppu.status | (nes->ppu.bus & 0x1F);
+  if (BITGET(nes->ppu.flags, NES_PPU_FLAG_NMI))
+    res = BITSET(res, NES_PPU_STATUS_VBLANK);
+  return res;
+}
+
+// reads a byte of loop code, which has to be in RAM or PRG-ROM
+static inline int nes_cpu_idle_code(nes_t *nes, uint16_t addr, uint8_t *val) {
+  if (addr < 0x2000) *val = nes->mem.ram[addr & 0x07FF];
+  else if (addr >= 0x8000) *val = nes_prg_read(nes, addr);
+  else return 0;
+  return 1;
+}
+
+// decodes an idle loop instruction, returns its length or 0 if it
+// doesn't qualify; only loads, compares, BIT, AND/ORA/EOR and branches are
+// allowed, with immediate, zero page or absolute operands
+static inline uint8_t nes_cpu_idle_decode(nes_t *nes, uint16_t pc,
+  nes_cpu_idle_op_t *op) {
+  uint8_t opcode, lo, hi;
+  if (!nes_cpu_idle_code(nes, pc, &opcode))
+    return 0;
+
+  *op = (nes_cpu_idle_op_t) { .pc = pc, .cycles = nes_cpu_op_cycles[opcode] };
+
+  switch (opcode) {
+    case 0xEA: // NOP
+      return 1;
+    case 0xA9: case 0xA2: case 0xA0: case 0xC9: case 0xE0: case 0xC0:
+    case 0x29: case 0x09: case 0x49:
+      return 2;
+    case 0x10: case 0x30: case 0x50: case 0x70:
+    case 0x90: case 0xB0: case 0xD0: case 0xF0:
+      return 2; // not taken, the closing one is fixed up by the caller
+    case 0xA5: case 0xA6: case 0xA4: case 0x24: case 0xC5: case 0xE4:
+    case 0xC4: case 0x25: case 0x05: case 0x45:
+      if (!nes_cpu_idle_code(nes, pc + 1, &lo))
+        return 0;
+      op->addr = lo;
+      op->read = NES_CPU_IDLE_READ_RAM;
+      return 2;
+    case 0xAD: case 0xAE: case 0xAC: case 0x2C: case 0xCD: case 0xEC:
+    case 0xCC: case 0x2D: case 0x0D: case 0x4D:
+      if (!nes_cpu_idle_code(nes, pc + 1, &lo) ||
+          !nes_cpu_idle_code(nes, pc + 2, &hi))
+        return 0;
+      op->addr = lo | (hi << 8);
+      if (op->addr < 0x2000)
+        op->read = NES_CPU_IDLE_READ_RAM;
+      else if ((op->addr & 0xE007) == 0x2002)
+        op->read = NES_CPU_IDLE_READ_STATUS;
+      else
+        return 0;
+      return 3;
+    case 0x4C: // JMP, only as the closing instruction
+      return 3;
+  }
+
+  return 0;
+}
+
+// called on taken backward branches and jumps: arms the loop from head to
+// the branch at tail if it qualifies
+static inline void nes_cpu_idle_detect(nes_t *nes, uint16_t head,
+  uint16_t tail) {
+  nes_cpu_idle_t *idle = &nes->cpu.idle;
+
+#if defined(DEBUG) && !defined(DEBUG_SDL)
+  return; // the trace log wants every instruction
+#endif
+
+  if (!idle->enabled || idle->state != NES_CPU_IDLE_NONE)
+    return;
+  if (head == idle->reject_head && tail == idle->reject_tail)
+    return;
+
+  uint16_t pc = head;
+  uint8_t count = 0;
+
+  while (count < NES_CPU_IDLE_MAX_OPS) {
+    nes_cpu_idle_op_t *op = &idle->ops[count++];
+    uint8_t len = nes_cpu_idle_decode(nes, pc, op);
+    if (!len)
+      break;
+
+    uint8_t opcode = 0x00;
+    nes_cpu_idle_code(nes, pc, &opcode);
+    if (opcode == 0x4C && pc != tail)
+      break; // JMP is only allowed as the closing instruction
+
+    if (pc == tail) {
+      // the closing branch is taken, that costs one more cycle and
+      // another one if the target is on a different page
+      if (opcode != 0x4C)
+        op->cycles += ((pc + 2) & 0xFF00) != (head & 0xFF00) ? 2 : 1;
+
+      idle->count = count;
+      idle->cur = 0;
+      idle->state = NES_CPU_IDLE_RECORD;
+      idle->a = nes->cpu.a;
+      idle->x = nes->cpu.x;
+      idle->y = nes->cpu.y;
+      idle->p = nes_cpu_get_p(&nes->cpu);
+      idle->s = nes->cpu.s;
+      return;
+    }
+
+    pc += len;
+    if (pc > tail)
+      break;
+  }
+
+  idle->reject_head = head;
+  idle->reject_tail = tail;
+}
+
+// steps an armed idle loop, called before every instruction while one is
+// armed; returns the cycles taken by a skipped instruction or 0 if the
+// instruction has to be run normally
+static inline uint32_t nes_cpu_idle_op(nes_t *nes) {
+  nes_cpu_idle_t *idle = &nes->cpu.idle;
+
+  if (nes->cpu.stall)
+    return 0; // DMA goes first
+
+  if (idle->cur == idle->count) {
+    // back at the top after the recorded pass
+    idle->cur = 0;
+    if (nes->cpu.a == idle->a && nes->cpu.x == idle->x &&
+        nes->cpu.y == idle->y && nes_cpu_get_p(&nes->cpu) == idle->p &&
+        nes->cpu.s == idle->s) {
+      idle->state = NES_CPU_IDLE_SKIP;
+    } else {
+      idle->a = nes->cpu.a;
+      idle->x = nes->cpu.x;
+      idle->y = nes->cpu.y;
+      idle->p = nes_cpu_get_p(&nes->cpu);
+      idle->s = nes->cpu.s;
+    }
+  }
+
+  nes_cpu_idle_op_t *op = &idle->ops[idle->cur];
+  if (nes->cpu.pc != op->pc) {
+    // left the loop or got interrupted
+    idle->state = NES_CPU_IDLE_NONE;
+    return 0;
+  }
+
+  uint8_t val = op->read ? nes_cpu_idle_peek(nes, op) : 0;
+
+  if (idle->state == NES_CPU_IDLE_RECORD) {
+    op->val = val;
+    idle->cur++;
+    return 0;
+  }
+
+  // reading a set VBLANK clears it, so that one can't be skipped
+  if (val != op->val ||
+      (op->read == NES_CPU_IDLE_READ_STATUS && BITGET(val, NES_PPU_STATUS_VBLANK))) {
+    idle->state = NES_CPU_IDLE_NONE;
+    return 0;
+  }
+
+  idle->cur = (idle->cur + 1 < idle->count) ? idle->cur + 1 : 0;
+  nes->cpu.pc = idle->ops[idle->cur].pc;
+  nes->cpu.cycle += op->cycles;
+  idle->skipped += op->cycles;
+  return op->cycles;
+}
+
 // base function for relative branching instructions
 // adds additional branch cycles where needed
 static inline void nes_branch_jmp(nes_t *nes, uint8_t flag) {
@@ -534,52 +876,57 @@ static inline void nes_branch_jmp(nes_t *nes, uint8_t flag) {
   if (flag) {
     nes->cpu.pc += (int8_t)offset;
     nes_cpu_add_branch_cycles(nes, pc_old);
+    if (nes->cpu.pc < pc_old)
+      nes_cpu_idle_detect(nes, nes->cpu.pc, pc_old - 2);
   }
 }
 
 // BPL: branch if N is 0
 static inline void nes_op_bpl(nes_t *nes) {
-  nes_branch_jmp(nes, !BITMGET(nes->cpu.p, FLAG_MASK_N));
+  nes_branch_jmp(nes, !nes_cpu_get_n(nes));
 }
 
 // BML: branch if N is 1
 static inline void nes_op_bmi(nes_t *nes) {
-  nes_branch_jmp(nes, BITMGET(nes->cpu.p, FLAG_MASK_N));
+  nes_branch_jmp(nes, nes_cpu_get_n(nes));
 }
 
 // BVC: branch if V is 0
 static inline void nes_op_bvc(nes_t *nes) {
-  nes_branch_jmp(nes, !BITMGET(nes->cpu.p, FLAG_MASK_V));
+  nes_branch_jmp(nes, !nes_cpu_get_v(nes));
 }
 
 // BVS: branch if V is 1
 static inline void nes_op_bvs(nes_t *nes) {
-  nes_branch_jmp(nes, BITMGET(nes->cpu.p, FLAG_MASK_V));
+  nes_branch_jmp(nes, nes_cpu_get_v(nes));
 }
 
 // BCC: branch if C is 0
 static inline void nes_op_bcc(nes_t *nes) {
-  nes_branch_jmp(nes, !BITMGET(nes->cpu.p, FLAG_MASK_C));
+  nes_branch_jmp(nes, !nes_cpu_get_c(nes));
 }
 
 // BCS: branch if C is 1
 static inline void nes_op_bcs(nes_t *nes) {
-  nes_branch_jmp(nes, BITMGET(nes->cpu.p, FLAG_MASK_C));
+  nes_branch_jmp(nes, nes_cpu_get_c(nes));
 }
 
 // BNE: branch if Z is 0
 static inline void nes_op_bne(nes_t *nes) {
-  nes_branch_jmp(nes, !BITMGET(nes->cpu.p, FLAG_MASK_Z));
+  nes_branch_jmp(nes, !nes_cpu_get_z(nes));
 }
 
 // BEQ: branch if Z is 1
 static inline void nes_op_beq(nes_t *nes) {
-  nes_branch_jmp(nes, BITMGET(nes->cpu.p, FLAG_MASK_Z));
+  nes_branch_jmp(nes, nes_cpu_get_z(nes));
 }
 
 // JMP: absolute jump
 static inline void nes_op_jmp(nes_t *nes) {
+  uint16_t pc_old = nes->cpu.pc;
   nes->cpu.pc = nes_mem_read_nextw(nes);
+  if (nes->cpu.pc < pc_old)
+    nes_cpu_idle_detect(nes, nes->cpu.pc, pc_old - 1);
 }
 
 // JMI: relative jump
@@ -604,7 +951,7 @@ static inline void nes_op_rts(nes_t *nes) {
 static inline void nes_op_brk(nes_t *nes) {
   if (!BITMGET(nes->cpu.p, FLAG_MASK_I)) {
     nes_pushw(nes, nes->cpu.pc - 1);
-    nes_pushb(nes, nes->cpu.p);
+    nes_pushb(nes, nes_cpu_get_p(&nes->cpu));
 
     nes->cpu.p = BITMSET(nes->cpu.p, FLAG_MASK_I);
     nes->cpu.pc = nes_mem_readw(nes, NES_VEC_IRQ);
@@ -613,7 +960,7 @@ static inline void nes_op_brk(nes_t *nes) {
 
 // RTI: return from interrupt
 static inline void nes_op_rti(nes_t *nes) {
-  nes->cpu.p = (nes_popb(nes) | 0x30) - 0x10;
+  nes_cpu_set_p(&nes->cpu, (nes_popb(nes) | 0x30) - 0x10);
   nes->cpu.pc = nes_popw(nes);
 }
 
@@ -631,12 +978,12 @@ static inline void nes_op_pla(nes_t *nes) {
 
 // PHP: push P to stack
 static inline void nes_op_php(nes_t *nes) {
-  nes_pushb(nes, nes->cpu.p | FLAG_MASK_B);
+  nes_pushb(nes, nes_cpu_get_p(&nes->cpu) | FLAG_MASK_B);
 }
 
 // PLP: pop P from stack
 static inline void nes_op_plp(nes_t *nes) {
-  nes->cpu.p = (nes_popb(nes) | 0x30) - 0x10;
+  nes_cpu_set_p(&nes->cpu, (nes_popb(nes) | 0x30) - 0x10);
 }
 
 // NOP: no-op
@@ -655,7 +1002,7 @@ static inline void nes_op_anc(nes_t *nes, uint16_t val) {
 static inline void nes_op_alr(nes_t *nes, uint16_t val) {
   uint8_t res = (nes->cpu.a & val) >> 1;
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, (val & 0x01));
+  nes_cpu_set_c(nes, (val & 0x01));
   nes_cpu_set_zn(nes, res);
   nes->cpu.a = res;
 }
@@ -664,10 +1011,10 @@ static inline void nes_op_alr(nes_t *nes, uint16_t val) {
 static inline void nes_op_arr(nes_t *nes, uint16_t val) {
   uint8_t res = (nes->cpu.a & val) >> 1;
 
-  if (BITMGET(nes->cpu.p, FLAG_MASK_C)) res |= 0x80;
+  if (nes_cpu_get_c(nes)) res |= 0x80;
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, (res & 0x40));
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, (res & 0x40) ^ (res & 0x20));
+  nes_cpu_set_c(nes, (res & 0x40));
+  nes_cpu_set_c(nes, (res & 0x40) ^ (res & 0x20));
   nes_cpu_set_zn(nes, res);
   nes->cpu.a = res;
 }
@@ -676,10 +1023,9 @@ static inline void nes_op_arr(nes_t *nes, uint16_t val) {
 static inline void nes_op_axs(nes_t *nes, uint16_t val) {
   uint16_t res = (nes->cpu.a & nes->cpu.x) - val;
 
-  nes->cpu.p = BITMCHG(nes->cpu.p, FLAG_MASK_C, !(res & 0x100));
-  nes->cpu.p =
-    BITMCHG(nes->cpu.p, FLAG_MASK_V,
-                 ((nes->cpu.a ^ val) & 0x80) && ((nes->cpu.a ^ res) & 0x80));
+  nes_cpu_set_c(nes, !(res & 0x100));
+  nes_cpu_set_v(nes,
+                ((nes->cpu.a ^ val) & 0x80) && ((nes->cpu.a ^ res) & 0x80));
   nes_cpu_set_zn(nes, res & 0xFF);
   nes->cpu.x = res;
 }
@@ -744,40 +1090,11 @@ static inline void nes_op_ign(nes_t *nes, uint16_t addr) {
 
 // reads and executes next instruction
 static inline uint32_t nes_cpu_op(nes_t *nes) {
-  // cycle costs for each opcode
-  static uint8_t op_cycles[256] = {
-    7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6, 2, 5, 2, 8, 4, 4, 6, 6,
-    2, 4, 2, 7, 4, 4, 7, 7, 6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,
-    6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6, 2, 5, 2, 8, 4, 4, 6, 6,
-    2, 4, 2, 7, 4, 4, 7, 7, 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
-    6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6, 2, 5, 2, 8, 4, 4, 6, 6,
-    2, 4, 2, 7, 4, 4, 7, 7, 2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,
-    2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5, 2, 6, 2, 6, 3, 3, 3, 3,
-    2, 2, 2, 2, 4, 4, 4, 4, 2, 5, 2, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4,
-    2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6, 2, 5, 2, 8, 4, 4, 6, 6,
-    2, 4, 2, 7, 4, 4, 7, 7, 2, 6, 3, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,
-    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
-  };
-
-  // page cross costs for each opcode
-  static uint8_t op_page_cycles[256] = {
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0,
-    0, 1, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0,
-    0, 1, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 1, 0, 0, 0, 0, 0, 1, 0, 1, 1, 1, 1, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0,
-    0, 1, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 0, 0,
-  };
-
   nes->cpu.pages_crossed = 0;
 
   if (nes->cpu.stall) {
     nes->cpu.stall--;
+    if (nes->cpu.dma_oam) nes->cpu.dma_oam--;
     return 1;
   }
 
@@ -1070,8 +1387,8 @@ static inline uint32_t nes_cpu_op(nes_t *nes) {
         opcode, nes->cpu.pc - 1);
   };
 
-  nes->cpu.cycle += op_cycles[opcode];
+  nes->cpu.cycle += nes_cpu_op_cycles[opcode];
   if (nes->cpu.pages_crossed)
-    nes->cpu.cycle += op_page_cycles[opcode];
+    nes->cpu.cycle += nes_cpu_op_page_cycles[opcode];
   return nes->cpu.cycle - cycle_old;
 }
@@ -400,18 +400,19 @@ static inline void nes_cpu_debug_print_axy_full(nes_t *nes, FILE *stream) {
 }
 
 static inline void nes_cpu_debug_print_flags_short(nes_t *nes, FILE *stream) {
-  fprintf(stream, "P:%02X ", nes->cpu.p);
+  fprintf(stream, "P:%02X ", nes_cpu_get_p(&nes->cpu));
 }
 
 static inline void nes_cpu_debug_print_flags_full(nes_t *nes, FILE *stream) {
+  uint8_t p = nes_cpu_get_p(&nes->cpu);
   fprintf(stream, "P:%c%c1%c%c%c%c%c ",
-          (BITMGET(nes->cpu.p, FLAG_MASK_N)) ? 'N' : '-',
-          (BITMGET(nes->cpu.p, FLAG_MASK_V)) ? 'V' : '-',
-          (BITMGET(nes->cpu.p, FLAG_MASK_B)) ? 'B' : '-',
-          (BITMGET(nes->cpu.p, FLAG_MASK_D)) ? 'D' : '-',
-          (BITMGET(nes->cpu.p, FLAG_MASK_I)) ? 'I' : '-',
-          (BITMGET(nes->cpu.p, FLAG_MASK_Z)) ? 'Z' : '-',
-          (BITMGET(nes->cpu.p, FLAG_MASK_C)) ? 'C' : '-');
+          (BITMGET(p, FLAG_MASK_N)) ? 'N' : '-',
+          (BITMGET(p, FLAG_MASK_V)) ? 'V' : '-',
+          (BITMGET(p, FLAG_MASK_B)) ? 'B' : '-',
+          (BITMGET(p, FLAG_MASK_D)) ? 'D' : '-',
+          (BITMGET(p, FLAG_MASK_I)) ? 'I' : '-',
+          (BITMGET(p, FLAG_MASK_Z)) ? 'Z' : '-',
+          (BITMGET(p, FLAG_MASK_C)) ? 'C' : '-');
 }
 
 static inline void nes_cpu_debug_print_stack_med(nes_t *nes, FILE *stream) {
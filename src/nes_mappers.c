@@ -9,20 +9,36 @@
 #include "mappers/unrom.h"
 #include "mappers/cnrom.h"
 #include "mappers/mmc3.h"
+#include "mappers/mmc5.h"
+#include "mappers/axrom.h"
+#include "mappers/mmc2.h"
+#include "mappers/mmc4.h"
+#include "mappers/colordreams.h"
+#include "mappers/gxrom.h"
+#include "mappers/vrc6.h"
+#include "mappers/n163.h"
+#include "mappers/fme7.h"
 
 void nes_mapper_init(nes_t *nes) {
+  nes->cart.mapper.timer_at = NES_MAPPER_TIMER_OFF;
   nes->cart.mapper.funcs.init(nes);
 }
 
-void nes_mapper_tick(nes_t *nes) {
-  if (nes->cart.mapper.funcs.tick)
-    nes->cart.mapper.funcs.tick(nes);
-}
-
 void nes_mapper_cleanup(nes_t *nes) {
   nes->cart.mapper.funcs.cleanup(nes);
 }
 
+// gives a clone its own copy of the mapper's extra data
+// returns 0 on success, -1 if out of memory
+int nes_mapper_clone(nes_t *nes, nes_t *src) {
+  nes->cart.mapper.extra = NULL;
+  if (!nes->cart.mapper.funcs.clone)
+    return 0;
+
+  nes->cart.mapper.funcs.clone(nes, src);
+  return nes->cart.mapper.extra ? 0 : -1;
+}
+
 // mapper registry stuff
 
 // supported mappers list; mappers add themselves to this using
@@ -42,11 +58,21 @@ void nes_get_mapper_funcs(uint8_t id, nes_mapper_funcs_t *funcs) {
 
   funcs->init = nes_mappers[id]->funcs->init;
   funcs->cleanup = nes_mappers[id]->funcs->cleanup;
+  funcs->clone = nes_mappers[id]->funcs->clone;
   funcs->tick = nes_mappers[id]->funcs->tick;
+  funcs->event = nes_mappers[id]->funcs->event;
+  funcs->events = nes_mappers[id]->funcs->events;
+  funcs->timer = nes_mappers[id]->funcs->timer;
+  funcs->fetch = nes_mappers[id]->funcs->fetch;
+  funcs->audio = nes_mappers[id]->funcs->audio;
   funcs->read = nes_mappers[id]->funcs->read;
   funcs->write = nes_mappers[id]->funcs->write;
   funcs->vread = nes_mappers[id]->funcs->vread;
   funcs->vwrite = nes_mappers[id]->funcs->vwrite;
+  funcs->nt_fetch = nes_mappers[id]->funcs->nt_fetch;
+  funcs->at_fetch = nes_mappers[id]->funcs->at_fetch;
+  funcs->bg_fetch = nes_mappers[id]->funcs->bg_fetch;
+  funcs->spr_fetch = nes_mappers[id]->funcs->spr_fetch;
 }
 
 const char *nes_get_mapper_name(uint8_t id) {
@@ -1,13 +1,26 @@
 #pragma once
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "nes_structs.h"
 
 // helper macro for module constructor shit
+// mapper-specialized main loops include a mapper header for its bus
+// functions only, the mapper is registered once by nes_mappers.c
+#ifdef NES_RUN_MAPPER
+#define MAPPER_REG_FUNC __attribute__((unused))
+#define MAPPER_UNREG_FUNC __attribute__((unused))
+#else
 #define MAPPER_REG_FUNC __attribute__((constructor))
 #define MAPPER_UNREG_FUNC __attribute__((destructor))
+#endif
 
 #define NES_MAX_MAPPERS 256
 
+// mapper.timer_at when the mapper has no timer due
+#define NES_MAPPER_TIMER_OFF UINT64_MAX
+
 void nes_get_mapper_funcs(uint8_t id, nes_mapper_funcs_t *funcs);
 const char *nes_get_mapper_name(uint8_t id);
 void nes_reg_mapper(uint8_t id, const char *name, nes_mapper_funcs_t *funcs);
@@ -15,5 +28,22 @@ void nes_unreg_mapper(uint8_t id);
 uint8_t nes_supported_mapper(uint8_t id);
 
 void nes_mapper_init(nes_t *nes);
-void nes_mapper_tick(nes_t *nes);
 void nes_mapper_cleanup(nes_t *nes);
+int nes_mapper_clone(nes_t *nes, nes_t *src);
+
+// has the mapper's timer function called at the first instruction boundary
+// on or after the given APU cycle (NES_MAPPER_TIMER_OFF to cancel)
+// IRQs raised from bus handlers, or by counters that run on the CPU clock,
+// are delivered from here: an IRQ taken in the middle of an instruction
+// would push the wrong return address
+static inline void nes_mapper_timer_set(nes_t *nes, uint64_t cycle) {
+  nes->cart.mapper.timer_at = cycle;
+}
+
+// copies the extra data of src's mapper for a clone (NULL if out of memory)
+static inline void *nes_mapper_copy_extra(nes_t *src, size_t size) {
+  void *extra = malloc(size);
+  if (extra)
+    memcpy(extra, src->cart.mapper.extra, size);
+  return extra;
+}
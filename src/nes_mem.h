@@ -3,6 +3,19 @@
 #include <string.h>
 
 #include "nes_structs.h"
+#include "nes_ppu.h"
+
+#ifdef NES_RUN_MAPPER
+// this is a mapper-specialized main loop (see nes_run.h): CPU bus accesses
+// go straight to that mapper's functions so they can be inlined
+#define NES_RUN_CAT_(a, b) a##b
+#define NES_RUN_CAT(a, b) NES_RUN_CAT_(a, b)
+#define NES_RUN_FUNC(prefix) NES_RUN_CAT(prefix, NES_RUN_MAPPER)
+
+static uint8_t NES_RUN_FUNC(nes_mem_read_)(nes_t *nes, uint16_t addr);
+static void NES_RUN_FUNC(nes_mem_write_)(nes_t *nes, uint16_t addr,
+                                         uint8_t val);
+#endif
 
 // CPU RAM read
 static inline uint8_t nes_ram_read(nes_t *nes, uint16_t addr) {
@@ -10,15 +23,79 @@ static inline uint8_t nes_ram_read(nes_t *nes, uint16_t addr) {
 }
 
 // PRG-ROM read
-static inline uint8_t nes_prg_read(nes_t *nes, uint8_t bank, uint16_t addr) {
-  if (nes->mem.prg[bank] == NULL) return 0x00;
+static inline uint8_t nes_prg_read(nes_t *nes, uint16_t addr) {
+  uint8_t *page = nes->mem.prg[(addr >> 13) & 0x03];
+  if (page == NULL) return 0x00;
+
+  return page[addr & 0x1FFF];
+}
+
+// nametable read ($2000-$3EFF)
+static inline uint8_t nes_nt_read(nes_t *nes, uint16_t addr) {
+  return nes->cart.nt[(addr >> 10) & 0x03][addr & 0x03FF];
+}
+
+// nametable write ($2000-$3EFF)
+static inline void nes_nt_write(nes_t *nes, uint16_t addr, uint8_t val) {
+  nes->cart.nt[(addr >> 10) & 0x03][addr & 0x03FF] = val;
+}
+
+// CHR read
+static inline uint8_t nes_chr_read(nes_t *nes, uint16_t addr) {
+  uint8_t *page = nes->vmem.chr[(addr >> 10) & 0x07];
+  if (page == NULL) return 0x00;
+
+  return page[addr & 0x03FF];
+}
+
+// CHR write, only goes through for CHR-RAM
+static inline void nes_chr_write(nes_t *nes, uint16_t addr, uint8_t val) {
+  uint8_t *page = nes->vmem.chr[(addr >> 10) & 0x07];
+  if (page == NULL || !nes->cart.chr_ram) return;
 
-  return nes->mem.prg[bank][addr];
+  page[addr & 0x03FF] = val;
+}
+
+// maps count 8k PRG-ROM pages from data, starting at 8k slot
+// (slot 0 is $8000, slot 3 is $E000); NULL data unmaps them
+static inline void nes_prg_map(nes_t *nes, uint8_t slot, uint8_t count, uint8_t *data) {
+  for (int i = 0; i < count; ++i)
+    nes->mem.prg[slot + i] = data ? data + i * 0x2000 : NULL;
+}
+
+// maps count 1k CHR pages from data, starting at 1k slot;
+// NULL data unmaps them
+static inline void nes_chr_map(nes_t *nes, uint8_t slot, uint8_t count, uint8_t *data) {
+  for (int i = 0; i < count; ++i) {
+    uint8_t *page = data ? data + i * 0x0400 : NULL;
+    if (nes->vmem.chr[slot + i] != page) {
+      nes->vmem.chr[slot + i] = page;
+      nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_CHR);
+    }
+  }
 }
 
 // PRG-RAM read
 static inline uint8_t nes_prgram_read(nes_t *nes, uint16_t addr) {
-  return nes->mem.prgram[addr];
+  if (nes->mem.wram == NULL) return 0x00;
+
+  return nes->mem.wram[addr & nes->mem.wram_mask];
+}
+
+// returns host memory backing the given 256-byte CPU page, if reading it
+// has no side effects (RAM, PRG-RAM and PRG-ROM); NULL otherwise
+static inline uint8_t *nes_mem_page(nes_t *nes, uint8_t page) {
+  if (page < 0x20) return nes->mem.ram + (page & 0x07) * 0x100;
+
+  if (page >= 0x80) {
+    uint8_t *base = nes->mem.prg[(page >> 5) & 0x03];
+    return base ? base + (page & 0x1F) * 0x100 : NULL;
+  }
+
+  if (page >= 0x60 && nes->mem.wram && nes->mem.wram_mask >= 0xFF)
+    return nes->mem.wram + ((page * 0x100) & nes->mem.wram_mask);
+
+  return NULL;
 }
 
 // CPU RAM write
@@ -28,22 +105,27 @@ static inline void nes_ram_write(nes_t *nes, uint16_t addr, uint8_t val) {
 
 // PRG-RAM write
 static inline void nes_prgram_write(nes_t *nes, uint16_t addr, uint8_t val) {
-  nes->mem.prgram[addr] = val;
+  if (nes->mem.wram == NULL) return;
+
+  nes->mem.wram[addr & nes->mem.wram_mask] = val;
+  nes->mem.wram_dirty = 1;
 }
 
 // initializes RAM on power up
 static inline void nes_mem_init(nes_mem_t *mem) {
   for (int i = 0; i < 0x800; ++i) mem->ram[i] = (i & 0x04) ? 0xFF : 0x00;
-  for (int i = 0; i < 0x2000; ++i) mem->prgram[i] = 0x00;
+  mem->prgram = NULL;
+  mem->prgram_size = 0;
 
-  mem->prg[0] = NULL;
-  mem->prg[1] = NULL;
+  for (int i = 0; i < 4; ++i) mem->prg[i] = NULL;
+  mem->wram = NULL;
 }
 
 // initializes VRAM on power up
 static inline void nes_vmem_init(nes_vmem_t *vmem) {
   for (int i = 0; i < 0x1000; ++i) vmem->vram[i] = 0x00;
   for (int i = 0; i < 0x100; ++i) vmem->oam[i] = 0x00;
+  for (int i = 0; i < 8; ++i) vmem->chr[i] = NULL;
 }
 
 // reads a byte from PPU address space
@@ -58,7 +140,11 @@ static inline void nes_vmem_writeb(nes_t *nes, uint16_t addr, uint8_t val) {
 
 // reads a byte CPU address space
 static inline uint8_t nes_mem_readb(nes_t *nes, uint16_t addr) {
+#ifdef NES_RUN_MAPPER
+  return NES_RUN_FUNC(nes_mem_read_)(nes, addr);
+#else
   return nes->cart.mapper.funcs.read(nes, addr);
+#endif
 }
 
 // reads a byte from CPU address space using zero-page addressing
@@ -80,7 +166,11 @@ static inline uint16_t nes_mem_readw_zp(nes_t *nes, uint16_t addr) {
 
 // writes a byte to CPU address space
 static inline void nes_mem_writeb(nes_t *nes, uint16_t addr, uint8_t val) {
+#ifdef NES_RUN_MAPPER
+  NES_RUN_FUNC(nes_mem_write_)(nes, addr, val);
+#else
   nes->cart.mapper.funcs.write(nes, addr, val);
+#endif
 }
 
 // writes a word to CPU address space
@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 #include "bitops.h"
 #include "nes_structs.h"
 #include "nes_mem.h"
@@ -21,6 +25,8 @@
 #define PPU_GET_2NDWRITE() BITGET(nes->ppu.flags, NES_PPU_FLAG_OFFSET)
 #define PPU_TGL_2NDWRITE() nes->ppu.flags = BITTGL(nes->ppu.flags, NES_PPU_FLAG_OFFSET)
 #define PPU_CLR_2NDWRITE() nes->ppu.flags = BITCLR(nes->ppu.flags, NES_PPU_FLAG_OFFSET)
+#define PPU_NO_OUTPUT() BITMGET(nes->ppu.flags, BIT(NES_PPU_FLAG_SKIP) | \
+                                                BIT(NES_PPU_FLAG_BLIND))
 
 // standard NES palette in ARGB8888
 const uint32_t nes_palette[64] = {
@@ -44,8 +50,163 @@ const uint32_t nes_palette[64] = {
 */
 };
 
+// A12 edge tracking for mappers with scanline counters
+
+// returns a running dot counter (off by one dot on odd frames, which is
+// fine for measuring short intervals)
+static inline uint32_t nes_ppu_dot(nes_t *nes) {
+  return nes->ppu.frame * 341 * 262 + nes->ppu.scanline * 341 + nes->ppu.cycle;
+}
+
+// puts addr on the PPU address bus; only does anything if the mapper
+// watches A12, in which case it gets an event on each filtered rise
+static inline void nes_ppu_bus(nes_t *nes, uint16_t addr) {
+  if (!BITGET(nes->cart.mapper.funcs.events, NES_MAPPER_EVENT_A12))
+    return;
+
+  uint8_t a12 = (addr >> 12) & 0x01;
+  if (a12 == nes->ppu.a12)
+    return;
+
+  uint32_t dot = nes_ppu_dot(nes);
+  if (!a12)
+    nes->ppu.a12_fall = dot;
+  else if (dot - nes->ppu.a12_fall >= NES_PPU_A12_FILTER)
+    nes->cart.mapper.funcs.event(nes, NES_MAPPER_EVENT_A12);
+
+  nes->ppu.a12 = a12;
+}
+
+// tells the mapper about a pattern fetch if it wants to know (MMC2/MMC4
+// switch CHR banks when the PPU reads certain tiles)
+static inline void nes_ppu_fetch_hook(nes_t *nes, uint16_t addr) {
+  if (nes->cart.mapper.funcs.fetch)
+    nes->cart.mapper.funcs.fetch(nes, addr);
+}
+
 // this gets called at power on and reset
+// dot program: what happens on each dot of each kind of line, so the dot
+// function doesn't work it out from the cycle and scanline every time
+// the rendering actions only run with rendering on
+
+enum nes_ppu_line_type {
+  NES_PPU_LINE_VISIBLE, // 0-239
+  NES_PPU_LINE_IDLE, // 240, 242-260
+  NES_PPU_LINE_VBLANK, // 241
+  NES_PPU_LINE_PRE, // 261
+  NES_PPU_LINE_TYPES,
+};
+
+enum nes_ppu_dot_action {
+  NES_PPU_DOT_FETCH = 0x0007, // which fetch, one of the values below
+  NES_PPU_DOT_NTA = 0x0001,
+  NES_PPU_DOT_ATTR = 0x0002,
+  NES_PPU_DOT_LO = 0x0003,
+  NES_PPU_DOT_HI = 0x0004,
+  NES_PPU_DOT_STORE = 0x0005, // also increments X
+  NES_PPU_DOT_SHIFT = 0x0008, // shifts tile data, fetches go with it
+  NES_PPU_DOT_PIXEL = 0x0010, // outputs a pixel (backdrop with rendering off)
+  // the rest only happens on a few dots of a line, the dot function checks
+  // them all at once
+  NES_PPU_DOT_COPY_Y = 0x0020,
+  NES_PPU_DOT_INC_Y = 0x0040,
+  NES_PPU_DOT_COPY_X = 0x0080,
+  NES_PPU_DOT_SPRITES = 0x0100, // sprites for the next line
+  NES_PPU_DOT_SPR_CLEAR = 0x0200, // no sprites on the next line
+  NES_PPU_DOT_SPR_BUS = 0x0400, // sprite fetches on the address bus
+  NES_PPU_DOT_LINE = 0x0800, // mapper line event
+  NES_PPU_DOT_VBL_SET = 0x1000,
+  NES_PPU_DOT_VBL_CLR = 0x2000, // also clears sprite 0 hit and overflow
+  NES_PPU_DOT_LINE_END = 0x4000, // last pixel of a visible line is out
+  NES_PPU_DOT_RARE = 0x7FE0,
+};
+
+static uint8_t nes_ppu_line_types[262];
+static uint16_t nes_ppu_dots[NES_PPU_LINE_TYPES][341];
+
+// fills in the dot program, it's the same for every PPU
+static void nes_ppu_build_dots(void) {
+  static const uint16_t fetches[8] = {
+    NES_PPU_DOT_STORE, NES_PPU_DOT_NTA, 0,
+    NES_PPU_DOT_ATTR, 0, NES_PPU_DOT_LO, 0, NES_PPU_DOT_HI,
+  };
+
+  for (int line = 0; line < 262; ++line) {
+    if (line < 240) nes_ppu_line_types[line] = NES_PPU_LINE_VISIBLE;
+    else if (line == 241) nes_ppu_line_types[line] = NES_PPU_LINE_VBLANK;
+    else if (line == 261) nes_ppu_line_types[line] = NES_PPU_LINE_PRE;
+    else nes_ppu_line_types[line] = NES_PPU_LINE_IDLE;
+  }
+
+  for (int type = 0; type < NES_PPU_LINE_TYPES; ++type) {
+    int vis_line = type == NES_PPU_LINE_VISIBLE;
+    int pre_line = type == NES_PPU_LINE_PRE;
+    int render_line = vis_line || pre_line;
+
+    for (int cycle = 0; cycle < 341; ++cycle) {
+      int vis_cycle = cycle >= 1 && cycle <= 256;
+      int fetch_cycle = vis_cycle || (cycle >= 321 && cycle <= 336);
+      uint16_t act = 0;
+
+      if (cycle == 0) act |= NES_PPU_DOT_LINE;
+      if (vis_line && vis_cycle) act |= NES_PPU_DOT_PIXEL;
+      if (render_line && fetch_cycle)
+        act |= NES_PPU_DOT_SHIFT | fetches[cycle & 0x07];
+      if (pre_line && cycle >= 280 && cycle <= 304) act |= NES_PPU_DOT_COPY_Y;
+      if (render_line && cycle == 256) act |= NES_PPU_DOT_INC_Y;
+      if (render_line && cycle == 257) act |= NES_PPU_DOT_COPY_X;
+      if (cycle == 257)
+        act |= vis_line ? NES_PPU_DOT_SPRITES : NES_PPU_DOT_SPR_CLEAR;
+      if (render_line && cycle >= 257 && cycle <= 320)
+        act |= NES_PPU_DOT_SPR_BUS;
+      if (type == NES_PPU_LINE_VBLANK && cycle == 1)
+        act |= NES_PPU_DOT_VBL_SET;
+      if (pre_line && cycle == 1) act |= NES_PPU_DOT_VBL_CLR;
+      if (vis_line && cycle == 257) act |= NES_PPU_DOT_LINE_END;
+
+      nes_ppu_dots[type][cycle] = act;
+    }
+  }
+}
+
+// deferred drawing, see below
+enum nes_ppu_event {
+  NES_PPU_EVENT_MASK, // PPUMASK write that leaves rendering on or off
+  NES_PPU_EVENT_FINE_X, // fine x scroll write
+  NES_PPU_EVENT_PAL, // palette write
+  NES_PPU_EVENT_DRAW, // output stops being skipped
+};
+
+static void nes_ppu_line_event(nes_ppu_t *ppu, uint8_t what, uint8_t idx,
+                               uint8_t val);
+static void nes_ppu_line_flush(nes_ppu_t *ppu);
+
+// reserves a zeroed frame buffer; mmap is used when possible, so pages only
+// get memory once they are drawn into (a machine that never draws, like a
+// clone running blind, doesn't pay for them)
+static nes_ppu_screen_t *nes_ppu_alloc_screen(void) {
+#ifndef _WIN32
+  void *mem = mmap(NULL, sizeof(nes_ppu_screen_t), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return (mem != MAP_FAILED) ? mem : NULL;
+#else
+  return calloc(1, sizeof(nes_ppu_screen_t));
+#endif
+}
+
+static void nes_ppu_free_screen(nes_ppu_screen_t *screen) {
+  if (!screen)
+    return;
+
+#ifndef _WIN32
+  munmap(screen, sizeof(nes_ppu_screen_t));
+#else
+  free(screen);
+#endif
+}
+
 void nes_ppu_reset(nes_ppu_t *ppu) {
+  if (ppu->line) nes_ppu_line_flush(ppu);
   ppu->flags = BITSET(ppu->flags, NES_PPU_FLAG_RESET);
   ppu->cycle = 340;
   ppu->scanline = 240;
@@ -53,13 +214,50 @@ void nes_ppu_reset(nes_ppu_t *ppu) {
   ppu->ctrl = 0x00;
   ppu->mask = 0x00;
   ppu->oam_addr = 0x00;
+  ppu->flags = BITCLR(ppu->flags, NES_PPU_FLAG_SAME);
+  ppu->flags = BITCLR(ppu->flags, NES_PPU_FLAG_SKIP);
+  ppu->dirty = 0xFF;
+  ppu->a12 = 0;
+  ppu->a12_fall = 0;
+  ppu->dots = nes_ppu_dots[NES_PPU_LINE_IDLE];
 }
 
 void nes_ppu_init(nes_ppu_t *ppu) {
   memset(ppu, 0x00, sizeof(nes_ppu_t));
-  ppu->front = calloc(1, sizeof(nes_ppu_screen_t));
-  ppu->back = calloc(1, sizeof(nes_ppu_screen_t));
+  nes_ppu_build_dots();
+  ppu->front = nes_ppu_alloc_screen();
+  ppu->back = nes_ppu_alloc_screen();
+  nes_ppu_set_target(ppu, NULL, 0);
   nes_ppu_reset(ppu);
+  ppu->tick = nes_ppu_tick;
+}
+
+// makes the PPU draw straight into an external buffer (e.g. a locked
+// texture) with the given pitch in bytes; the owner has to switch buffers
+// when a frame is ready, since nothing is swapped in this mode
+// pass NULL to go back to the internal back buffer
+void nes_ppu_set_target(nes_ppu_t *ppu, void *pixels, int pitch) {
+  if (pixels) {
+    ppu->target = pixels;
+    ppu->target_pitch = pitch / sizeof(uint32_t);
+    ppu->target_ext = 1;
+  } else {
+    ppu->target = &ppu->back->data[0][0];
+    ppu->target_pitch = 256;
+    ppu->target_ext = 0;
+  }
+}
+
+// turns pixel output off or back on; while it's off, the PPU still does
+// everything else, sprite 0 hits included, and the target keeps whatever
+// it had; switch between frames, or the frame under way comes out half drawn
+void nes_ppu_set_blind(nes_ppu_t *ppu, int on) {
+  if (on) {
+    ppu->flags = BITSET(ppu->flags, NES_PPU_FLAG_BLIND);
+    ppu->flags = BITCLR(ppu->flags, NES_PPU_FLAG_SKIP);
+  } else {
+    ppu->flags = BITCLR(ppu->flags, NES_PPU_FLAG_BLIND);
+  }
 }
 
 // writes a byte to PPU bus
@@ -83,12 +281,53 @@ static inline void nes_ppu_nmi_update(nes_t *nes) {
   nes->ppu.nmi_prev = nmi;
 }
 
+// returns 1 if the PPU is currently drawing (pre-render or visible line)
+static inline int nes_ppu_rendering(nes_t *nes) {
+  return (nes->ppu.scanline < 240 || nes->ppu.scanline == 261) &&
+    (PPU_GET_MASK(NES_PPU_MASK_BG) || PPU_GET_MASK(NES_PPU_MASK_SPR));
+}
+
+// called when something changes in a frame that was the same as the last one
+// if pixel output was skipped, the lines skipped so far are copied from the
+// front buffer and drawing continues from here
+void nes_ppu_resume(nes_t *nes) {
+  PPU_CLR_FLAG(NES_PPU_FLAG_SAME);
+  if (!PPU_GET_FLAG(NES_PPU_FLAG_SKIP))
+    return;
+  PPU_CLR_FLAG(NES_PPU_FLAG_SKIP);
+  nes_ppu_line_event(&nes->ppu, NES_PPU_EVENT_DRAW, 0, 0);
+  int lines = 0;
+  if (nes->ppu.scanline < 240) lines = nes->ppu.scanline + 1;
+  else if (nes->ppu.scanline == 240) lines = 240;
+  memcpy(nes->ppu.back->data, nes->ppu.front->data,
+         lines * sizeof(nes->ppu.back->data[0]));
+}
+
 // handles a vblank
 // uses double buffering and also sets the NMI and RENDER state flags
+// if the whole frame was skipped, the front buffer already holds it; if
+// nothing changed since the last vblank, output of the next frame is skipped
+// an external target can't be read back, so it is always drawn into
 static inline void nes_ppu_set_vblank(nes_t *nes) {
-  nes_ppu_screen_t *tmp = nes->ppu.back;
-  nes->ppu.back = nes->ppu.front;
-  nes->ppu.front = tmp;
+  if (PPU_GET_FLAG(NES_PPU_FLAG_SAME))
+    PPU_SET_FLAG(NES_PPU_FLAG_REPEAT);
+  else
+    PPU_CLR_FLAG(NES_PPU_FLAG_REPEAT);
+  if (!nes->ppu.target_ext && !PPU_NO_OUTPUT()) {
+    nes_ppu_screen_t *tmp = nes->ppu.back;
+    nes->ppu.back = nes->ppu.front;
+    nes->ppu.front = tmp;
+    nes->ppu.target = &nes->ppu.back->data[0][0];
+  }
+  if (nes->ppu.dirty) {
+    PPU_CLR_FLAG(NES_PPU_FLAG_SAME);
+    PPU_CLR_FLAG(NES_PPU_FLAG_SKIP);
+  } else {
+    PPU_SET_FLAG(NES_PPU_FLAG_SAME);
+    if (!nes->ppu.target_ext && !PPU_GET_FLAG(NES_PPU_FLAG_BLIND))
+      PPU_SET_FLAG(NES_PPU_FLAG_SKIP);
+  }
+  nes->ppu.dirty = 0x00;
   PPU_SET_FLAG(NES_PPU_FLAG_NMI);
   PPU_SET_FLAG(NES_PPU_FLAG_RENDER);
   nes_ppu_nmi_update(nes);
@@ -100,13 +339,30 @@ static inline void nes_ppu_clr_vblank(nes_t *nes) {
   nes_ppu_nmi_update(nes);
 }
 
+// marks register state as changed if it differs or rendering is under way
+static inline void nes_ppu_mark_reg(nes_t *nes, int what, int changed) {
+  if (changed || nes_ppu_rendering(nes))
+    nes_ppu_mark_dirty(nes, what);
+}
+
+// marks whatever lives at PPU address addr as changed
+static inline void nes_ppu_mark_vmem(nes_t *nes, uint16_t addr) {
+  addr &= 0x3FFF;
+  if (addr < 0x2000) nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_CHR);
+  else if (addr < 0x3F00) nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_VRAM);
+  else nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_PAL);
+}
+
 // memory write function for PPU address space ($2000-$2007)
 // addr is actually the register index (0-7), not the actual address
 void nes_ppu_write(nes_t *nes, uint16_t addr, uint8_t val) {
+  uint16_t tmp_addr = nes->ppu.tmp_addr;
+  uint8_t fine_x = nes->ppu.fine_x;
   // store last written byte on the bus
   nes_ppu_refresh_bus(nes, val);
   switch (addr) {
     case 0: // $2000 - PPUCTRL
+      nes_ppu_mark_reg(nes, NES_PPU_DIRTY_REGS, nes->ppu.ctrl != val);
       // store control flags
       nes->ppu.ctrl = val;
       // start NMI timer if necessary
@@ -115,6 +371,14 @@ void nes_ppu_write(nes_t *nes, uint16_t addr, uint8_t val) {
       nes->ppu.tmp_addr = (nes->ppu.tmp_addr & 0xF3FF) | ((val & 0x03) << 10);
       break;
     case 1: // $2001 - PPUMASK
+      nes_ppu_mark_reg(nes, NES_PPU_DIRTY_REGS, nes->ppu.mask != val);
+      // turning rendering on or off changes what the PPU does on each dot,
+      // so the log can't describe the rest of the line
+      if (nes->ppu.line &&
+          (PPU_GET_MASK(NES_PPU_MASK_BG) || PPU_GET_MASK(NES_PPU_MASK_SPR)) !=
+          (BITGET(val, NES_PPU_MASK_BG) || BITGET(val, NES_PPU_MASK_SPR)))
+        nes_ppu_line_flush(&nes->ppu);
+      nes_ppu_line_event(&nes->ppu, NES_PPU_EVENT_MASK, 0, val);
       nes->ppu.mask = val;
       break;
     case 2: // $2002 - PPUSTATUS
@@ -124,6 +388,8 @@ void nes_ppu_write(nes_t *nes, uint16_t addr, uint8_t val) {
       nes->ppu.oam_addr = val;
       break;
     case 4: // $2004 - OAMDATA
+      if (nes->vmem.oam[nes->ppu.oam_addr] != val)
+        nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_OAM);
       nes->vmem.oam[nes->ppu.oam_addr++] = val;
       break;
     case 5: // $2005 - PPUSCROLL
@@ -132,6 +398,7 @@ void nes_ppu_write(nes_t *nes, uint16_t addr, uint8_t val) {
         nes->ppu.tmp_addr = (nes->ppu.tmp_addr & 0xFFE0) | (val >> 3);
         // store fine X scroll in separate register
         nes->ppu.fine_x = val & 0x07;
+        nes_ppu_line_event(&nes->ppu, NES_PPU_EVENT_FINE_X, 0, val & 0x07);
       } else {
         // bits 12-14: fine Y scroll
         nes->ppu.tmp_addr = (nes->ppu.tmp_addr & 0x8FFF) | ((val & 0x07) << 12);
@@ -139,6 +406,8 @@ void nes_ppu_write(nes_t *nes, uint16_t addr, uint8_t val) {
         nes->ppu.tmp_addr = (nes->ppu.tmp_addr & 0xFC1F) | ((val & 0xF8) << 2);
       }
       PPU_TGL_2NDWRITE();
+      nes_ppu_mark_reg(nes, NES_PPU_DIRTY_SCROLL,
+        tmp_addr != nes->ppu.tmp_addr || fine_x != nes->ppu.fine_x);
       break;
     case 6: // $2006 - PPUADDR
       if (!PPU_GET_2NDWRITE()) {
@@ -149,13 +418,23 @@ void nes_ppu_write(nes_t *nes, uint16_t addr, uint8_t val) {
         nes->ppu.tmp_addr = (nes->ppu.tmp_addr & 0xFF00) | val;
         // address fully received: copy shadow register to address register
         nes->ppu.vmem_addr = nes->ppu.tmp_addr;
+        nes_ppu_bus(nes, nes->ppu.vmem_addr);
       }
       PPU_TGL_2NDWRITE();
+      nes_ppu_mark_reg(nes, NES_PPU_DIRTY_SCROLL, tmp_addr != nes->ppu.tmp_addr);
       break;
     case 7: // $2007 - PPUDATA
       // write byte to video memory and increment address
+      nes_ppu_mark_vmem(nes, nes->ppu.vmem_addr);
       nes_vmem_writeb(nes, nes->ppu.vmem_addr, val);
+      if (nes->ppu.line && (nes->ppu.vmem_addr & 0x3FFF) >= 0x3F00) {
+        uint8_t idx = nes->ppu.vmem_addr & 0x1F;
+        if (idx >= 0x10 && (idx & 0x03) == 0) idx -= 0x10;
+        nes_ppu_line_event(&nes->ppu, NES_PPU_EVENT_PAL, idx,
+                           nes->vmem.pal[idx]);
+      }
       nes->ppu.vmem_addr += (PPU_GET_CTRL(NES_PPU_CTRL_ADDRINC)) ? 32 : 1;
+      nes_ppu_bus(nes, nes->ppu.vmem_addr);
       break;
     default:
       fprintf(stderr, "Invalid PPU register %d (wrote 0x%02X)\n", addr, val);
@@ -207,6 +486,9 @@ uint8_t nes_ppu_read(nes_t *nes, uint16_t addr) {
         nes->ppu.readb = nes_vmem_readb(nes, nes->ppu.vmem_addr - 0x1000);
       }
       nes->ppu.vmem_addr += (PPU_GET_CTRL(NES_PPU_CTRL_ADDRINC)) ? 32 : 1;
+      nes_ppu_bus(nes, nes->ppu.vmem_addr);
+      // moving the address mid-frame scrolls the picture
+      nes_ppu_mark_reg(nes, NES_PPU_DIRTY_SCROLL, 0);
       break;
     default:
       fprintf(stderr, "Invalid PPU register %d (read)\n", addr);
@@ -217,24 +499,43 @@ uint8_t nes_ppu_read(nes_t *nes, uint16_t addr) {
 
 // handles OAM DMA ($4014 writes)
 // stalls the CPU for 513 or 514 cycles
+// most games do this every frame, so OAM is only marked as changed if the
+// copied data actually differs
+// RAM and ROM pages are copied in bulk; anything else is read byte by byte
+// through the mapper, since reads there can have side effects
 void nes_ppu_oamdma(nes_t *nes, uint8_t page) {
-  uint16_t addr = page * 0x100;
-  for (uint16_t i = 0; i < 256; ++i) {
-    nes->vmem.oam[nes->ppu.oam_addr] = nes_mem_readb(nes, addr);
-    nes->ppu.oam_addr++;
-    addr++;
+  uint8_t buf[0x100];
+  uint8_t *src = nes_mem_page(nes, page);
+
+  if (src == NULL) {
+    for (uint16_t i = 0; i < 0x100; ++i)
+      buf[i] = nes_mem_readb(nes, page * 0x100 + i);
+    src = buf;
+  }
+
+  // the copy starts at OAMADDR and wraps around
+  uint8_t *oam = nes->vmem.oam;
+  uint16_t start = nes->ppu.oam_addr;
+  uint16_t len = 0x100 - start;
+  if (memcmp(oam + start, src, len) || memcmp(oam, src + len, start)) {
+    memcpy(oam + start, src, len);
+    memcpy(oam, src + len, start);
+    nes_ppu_mark_dirty(nes, NES_PPU_DIRTY_OAM);
   }
+
   nes->cpu.stall += 513 + (nes->cpu.cycle & 0x01);
+  nes->cpu.dma_oam = nes->cpu.stall;
 }
 
 // rendering logic
 
 // returns ARGB8888 value from NES color index, handling color emphasis bits
-static inline uint32_t nes_ppu_get_color(nes_t *nes, uint8_t col) {
+// of the given PPUMASK value
+static inline uint32_t nes_ppu_color(uint8_t mask, uint8_t col) {
   // TODO: precompute all of this or at least the dark palette
-  if (PPU_GET_MASK(NES_PPU_MASK_GRAYSCALE)) col &= 0x30;
+  if (BITGET(mask, NES_PPU_MASK_GRAYSCALE)) col &= 0x30;
   uint32_t ret = nes_palette[col & 0x3F];
-  if ((nes->ppu.mask & 0xE0) == 0xE0) {
+  if ((mask & 0xE0) == 0xE0) {
     // if all three emphasis bits are set, just darken the color
     uint8_t r = (ret & 0x00FF0000) >> 17;
     uint8_t g = (ret & 0x0000FF00) >> 9;
@@ -242,13 +543,18 @@ static inline uint32_t nes_ppu_get_color(nes_t *nes, uint8_t col) {
     ret = 0xFF000000 | (r << 16) | (g << 8) | b;
   } else if (ret & 0x00FEFEFE) {
     // otherwise maximize particular color component
-    if (PPU_GET_MASK(NES_PPU_MASK_ERED)) ret |= 0x00FF0000;
-    if (PPU_GET_MASK(NES_PPU_MASK_EGREEN)) ret |= 0x0000FF00;
-    if (PPU_GET_MASK(NES_PPU_MASK_EBLUE)) ret |= 0x000000FF;
+    if (BITGET(mask, NES_PPU_MASK_ERED)) ret |= 0x00FF0000;
+    if (BITGET(mask, NES_PPU_MASK_EGREEN)) ret |= 0x0000FF00;
+    if (BITGET(mask, NES_PPU_MASK_EBLUE)) ret |= 0x000000FF;
   }
   return ret;
 }
 
+// same, with the current PPUMASK
+static inline uint32_t nes_ppu_get_color(nes_t *nes, uint8_t col) {
+  return nes_ppu_color(nes->ppu.mask, col);
+}
+
 // advances vram pointer to the next tile row
 static void nes_ppu_increment_y(nes_t *nes) {
   if ((nes->ppu.vmem_addr & 0x7000) != 0x7000) {
@@ -290,30 +596,58 @@ static inline void nes_ppu_copy_x(nes_t *nes) {
     (nes->ppu.vmem_addr & 0xFBE0) | (nes->ppu.tmp_addr & 0x041F);
 }
 
+// how the dot functions do rendering fetches, always a constant
+enum nes_ppu_fetch {
+  NES_PPU_FETCH_VREAD, // patterns through the mapper's vread
+  NES_PPU_FETCH_HOOKED, // everything through the mapper's fetch hooks
+  NES_PPU_FETCH_CHR, // patterns straight from the CHR pages, for mappers
+                     // that only bank CHR below $2000
+};
+
+// reads a pattern byte, read is the mapper function for the hooked and
+// vread variants
+static inline uint8_t nes_ppu_read_pattern(nes_t *nes, nes_read_func_t read,
+                                           uint16_t addr, const int fetch) {
+  if (fetch == NES_PPU_FETCH_CHR)
+    return nes_chr_read(nes, addr);
+  return read(nes, addr);
+}
+
 // fetches nametable data for current tile
-static inline void nes_ppu_fetch_nta(nes_t *nes) {
+static inline void nes_ppu_fetch_nta(nes_t *nes, const int fetch) {
   uint16_t t = nes->ppu.vmem_addr;
-  nes->ppu.tile.nta = nes_vmem_readb(nes, 0x2000 | (t & 0x0FFF));
+  nes_ppu_bus(nes, 0x2000);
+  if (fetch == NES_PPU_FETCH_HOOKED)
+    nes->ppu.tile.nta = nes->cart.mapper.funcs.nt_fetch(nes, 0x2000 | (t & 0x0FFF));
+  else
+    nes->ppu.tile.nta = nes_nt_read(nes, t);
 }
 
 // fetches attribute data for current tile
-static inline void nes_ppu_fetch_attr(nes_t *nes) {
+static inline void nes_ppu_fetch_attr(nes_t *nes, const int fetch) {
   uint16_t t = nes->ppu.vmem_addr;
   uint16_t addr = 0x23C0 | (t & 0x0C00) | ((t >> 4) & 0x38) | ((t >> 2) & 0x07);
   uint16_t shift = ((t >> 4) & 0x04) | (t & 0x02);
-  nes->ppu.tile.attr = ((nes_vmem_readb(nes, addr) >> shift) & 0x03) << 2;
+  uint8_t attr = (fetch == NES_PPU_FETCH_HOOKED) ?
+    nes->cart.mapper.funcs.at_fetch(nes, addr) : nes_nt_read(nes, addr);
+  nes->ppu.tile.attr = ((attr >> shift) & 0x03) << 2;
 }
 
 // fetches tile graphics for current tile
-static inline void nes_ppu_fetch_tile(nes_t *nes, int hi) {
+static inline void nes_ppu_fetch_tile(nes_t *nes, int hi, const int fetch) {
+  nes_read_func_t read = (fetch == NES_PPU_FETCH_HOOKED) ?
+    nes->cart.mapper.funcs.bg_fetch : nes->cart.mapper.funcs.vread;
   uint8_t fine_y = (nes->ppu.vmem_addr >> 12) & 0x07;
   uint8_t table = !!PPU_GET_CTRL(NES_PPU_CTRL_BGTABLE);
   uint8_t tile = nes->ppu.tile.nta;
   uint16_t addr = 0x1000 * table + tile * 16 + fine_y;
-  if (hi)
-    nes->ppu.tile.data_hi = nes_vmem_readb(nes, addr + 0x08);
-  else
-    nes->ppu.tile.data_lo = nes_vmem_readb(nes, addr);
+  nes_ppu_bus(nes, addr);
+  if (hi) {
+    nes->ppu.tile.data_hi = nes_ppu_read_pattern(nes, read, addr + 0x08, fetch);
+    nes_ppu_fetch_hook(nes, addr + 0x08);
+  } else {
+    nes->ppu.tile.data_lo = nes_ppu_read_pattern(nes, read, addr, fetch);
+  }
 }
 
 // forms complete tile data from attributes and hi and lo bytes
@@ -332,7 +666,10 @@ static inline void nes_ppu_store_tile(nes_t *nes) {
 }
 
 // returns sprite data for the row-th row of the i-th sprite
-static inline uint64_t nes_ppu_fetch_spr(nes_t *nes, int i, int row) {
+static inline uint64_t nes_ppu_fetch_spr(nes_t *nes, int i, int row,
+                                         const int fetch) {
+  nes_read_func_t read = (fetch == NES_PPU_FETCH_HOOKED) ?
+    nes->cart.mapper.funcs.spr_fetch : nes->cart.mapper.funcs.vread;
   uint8_t tile = nes->vmem.oam[i * 4 + 1];
   uint8_t attr = nes->vmem.oam[i * 4 + 2];
 
@@ -349,8 +686,9 @@ static inline uint64_t nes_ppu_fetch_spr(nes_t *nes, int i, int row) {
   uint16_t addr = 0x1000 * table + tile * 16 + row;
 
   uint8_t a = (attr & 0x03) << 2;
-  uint8_t lo = nes_vmem_readb(nes, addr);
-  uint8_t hi = nes_vmem_readb(nes, addr + 0x08);
+  uint8_t lo = nes_ppu_read_pattern(nes, read, addr, fetch);
+  uint8_t hi = nes_ppu_read_pattern(nes, read, addr + 0x08, fetch);
+  nes_ppu_fetch_hook(nes, addr + 0x08);
 
   uint32_t data = 0;
   uint8_t p1, p2;
@@ -377,8 +715,26 @@ static inline uint64_t nes_ppu_fetch_spr(nes_t *nes, int i, int row) {
   return data;
 }
 
+// replays the A12 levels of sprite pattern fetches at dots 257-320,
+// since the sprites themselves are all fetched at once at dot 257
+static inline void nes_ppu_spr_bus(nes_t *nes) {
+  int slot = (nes->ppu.cycle - 257) >> 3;
+
+  switch ((nes->ppu.cycle - 257) & 0x07) {
+    case 0: nes_ppu_bus(nes, 0x2000); break; // garbage nametable fetch
+    case 4:
+      if (slot < nes->ppu.spr_count)
+        nes_ppu_bus(nes, nes->ppu.spr[slot].a12 << 12);
+      else if (PPU_GET_CTRL(NES_PPU_CTRL_SPRSIZE))
+        nes_ppu_bus(nes, 0x1000); // empty slots fetch tile $FF
+      else
+        nes_ppu_bus(nes, PPU_GET_CTRL(NES_PPU_CTRL_SPRTABLE) ? 0x1000 : 0x0000);
+      break;
+  }
+}
+
 // prepares sprite data (fills the nes_ppu_spr_t structs)
-static inline void nes_ppu_process_sprites(nes_t *nes) {
+static inline void nes_ppu_process_sprites(nes_t *nes, const int fetch) {
   int h = (PPU_GET_CTRL(NES_PPU_CTRL_SPRSIZE)) ? 16 : 8;
   int n = 0;
   for (uint32_t i = 0; i < 64; ++i) {
@@ -388,10 +744,12 @@ static inline void nes_ppu_process_sprites(nes_t *nes) {
     int row = nes->ppu.scanline - y;
     if (row < 0 || row >= h) continue;
     if (n < 8) {
-      nes->ppu.spr[n].data = nes_ppu_fetch_spr(nes, i, row);
+      nes->ppu.spr[n].data = nes_ppu_fetch_spr(nes, i, row, fetch);
       nes->ppu.spr[n].pos = x;
       nes->ppu.spr[n].pri = (a >> 5) & 0x01;
       nes->ppu.spr[n].idx = i;
+      nes->ppu.spr[n].a12 = (h == 16) ? (nes->vmem.oam[i * 4 + 1] & 0x01) :
+        !!PPU_GET_CTRL(NES_PPU_CTRL_SPRTABLE);
     }
     n++;
   }
@@ -425,10 +783,16 @@ static inline void nes_ppu_get_spr_pixel(nes_t *nes, uint8_t *p, uint8_t *n) {
 }
 
 // draws current pixel into the back buffer
+// while output is skipped or off, or the line is logged for deferred
+// drawing, only sprite 0 hits are still checked for
 static inline void nes_ppu_render_pixel(nes_t *nes) {
   int x = nes->ppu.cycle - 1;
   int y = nes->ppu.scanline;
 
+  int skip = PPU_NO_OUTPUT() || nes->ppu.line;
+  if (skip && (!nes->ppu.spr_count || nes->ppu.spr[0].idx != 0))
+    return;
+
   uint8_t bg = nes_ppu_get_bg_pixel(nes);
   uint8_t spr, spr_idx;
   nes_ppu_get_spr_pixel(nes, &spr, &spr_idx);
@@ -451,7 +815,161 @@ static inline void nes_ppu_render_pixel(nes_t *nes) {
       col = bg;
   }
 
-  nes->ppu.back->data[y][x] = nes_ppu_get_color(nes, nes->vmem.pal[col]);
+  if (skip) return;
+
+  nes->ppu.target[y * nes->ppu.target_pitch + x] =
+    nes_ppu_get_color(nes, nes->vmem.pal[col]);
+}
+
+// deferred drawing
+// the PPU still does all the fetches and timing on the emulation thread, so
+// mapper IRQs, fetch hooks and sprite 0 hits stay exact; what gets deferred
+// is composing the pixels: each visible line logs its fetched background
+// pixels, its sprites, and the PPUMASK, fine x and palette state with any
+// changes to them during the line, and gets drawn from that later
+
+// composes pixel x of a logged line from the given state
+static inline uint8_t nes_ppu_line_pixel(const nes_ppu_line_t *line,
+                                         uint8_t mask, uint8_t fine_x, int x) {
+  uint8_t bg = 0x00;
+  if (BITGET(mask, NES_PPU_MASK_BG)) {
+    int n = x + fine_x;
+    bg = (line->bg[n >> 3] >> ((7 - (n & 0x07)) * 4)) & 0x0F;
+  }
+
+  uint8_t spr = 0x00, spr_idx = 0x00;
+  if (BITGET(mask, NES_PPU_MASK_SPR)) {
+    for (uint32_t i = 0; i < line->spr_count; ++i) {
+      int offset = x - line->spr[i].pos;
+      if (offset < 0 || offset > 7) continue;
+      uint8_t col = (line->spr[i].data >> ((7 - offset) * 4)) & 0x0F;
+      if (!(col & 0x03)) continue;
+      spr = col; spr_idx = i;
+      break;
+    }
+  }
+
+  if (x < 8 && !BITGET(mask, NES_PPU_MASK_LEFTBG)) bg = 0;
+  if (x < 8 && !BITGET(mask, NES_PPU_MASK_LEFTSPR)) spr = 0;
+
+  if (!(spr & 0x03)) return (bg & 0x03) ? bg : 0x00;
+  if ((bg & 0x03) && line->spr[spr_idx].pri) return bg;
+  return spr | 0x10;
+}
+
+// draws pixels 0 to end-1 of a logged line
+static void nes_ppu_draw_line(const nes_ppu_line_t *line, int end) {
+  uint8_t pal[0x20];
+  memcpy(pal, line->pal, sizeof(pal));
+  uint8_t mask = line->mask;
+  uint8_t fine_x = line->fine_x;
+  uint8_t skip = line->skip;
+  int e = 0;
+
+  for (int x = 0; x < end; ++x) {
+    for (; e < line->ev_count && line->ev[e].x <= x; ++e) {
+      const nes_ppu_event_t *ev = &line->ev[e];
+      switch (ev->what) {
+        case NES_PPU_EVENT_MASK: mask = ev->val; break;
+        case NES_PPU_EVENT_FINE_X: fine_x = ev->val; break;
+        case NES_PPU_EVENT_PAL: pal[ev->idx] = ev->val; break;
+        case NES_PPU_EVENT_DRAW: skip = 0; break;
+      }
+    }
+    if (skip) continue;
+    uint8_t col = line->render ? nes_ppu_line_pixel(line, mask, fine_x, x) : 0;
+    line->row[x] = nes_ppu_color(mask, pal[col]);
+  }
+}
+
+// draws logged lines first to first+count-1 that haven't been drawn yet;
+// can be called from any thread for lines whose logs are complete
+void nes_ppu_draw_lines(nes_ppu_t *ppu, int first, int count) {
+  for (int y = first; y < first + count && y < 240; ++y) {
+    if (!ppu->lines[y].row) continue;
+    nes_ppu_draw_line(&ppu->lines[y], 256);
+    ppu->lines[y].row = NULL;
+  }
+}
+
+// starts logging the current line
+static void nes_ppu_line_begin(nes_t *nes) {
+  nes_ppu_t *ppu = &nes->ppu;
+  nes_ppu_line_t *line = &ppu->lines[ppu->scanline];
+
+  line->row = ppu->target + ppu->scanline * ppu->target_pitch;
+  line->bg[0] = ppu->tile.data >> 32;
+  line->bg[1] = (uint32_t)ppu->tile.data;
+  line->bg_count = 2;
+  memcpy(line->spr, ppu->spr, sizeof(line->spr));
+  line->spr_count = ppu->spr_count;
+  memcpy(line->pal, nes->vmem.pal, sizeof(line->pal));
+  line->mask = ppu->mask;
+  line->fine_x = ppu->fine_x;
+  line->render = PPU_GET_MASK(NES_PPU_MASK_BG) || PPU_GET_MASK(NES_PPU_MASK_SPR);
+  line->skip = !!PPU_NO_OUTPUT();
+  line->ev_count = 0;
+  ppu->line = line;
+}
+
+// the current line's last pixel is out, so it can be drawn
+static void nes_ppu_line_end(nes_t *nes) {
+  nes->ppu.line = NULL;
+  nes->ppu.line_done(nes->ppu.defer_ctx, nes->ppu.scanline);
+}
+
+// logs a change affecting the pixels of the current line from here on
+static void nes_ppu_line_event(nes_ppu_t *ppu, uint8_t what, uint8_t idx,
+                               uint8_t val) {
+  nes_ppu_line_t *line = ppu->line;
+  if (!line || ppu->cycle > 255)
+    return;
+  if (line->ev_count == NES_PPU_LINE_EVENTS) {
+    nes_ppu_line_flush(ppu);
+    return;
+  }
+  line->ev[line->ev_count++] = (nes_ppu_event_t){ppu->cycle, what, idx, val};
+}
+
+// for changes the log can't describe: draws the logged part of the current
+// line right away, and the rest of it gets drawn as it goes
+static void nes_ppu_line_flush(nes_ppu_t *ppu) {
+  nes_ppu_draw_line(ppu->line, ppu->cycle < 256 ? ppu->cycle : 256);
+  ppu->line->row = NULL;
+  ppu->line = NULL;
+}
+
+// waits for the logged lines to be drawn and draws any left over
+static void nes_ppu_sync_lines(nes_ppu_t *ppu) {
+  ppu->sync(ppu->defer_ctx);
+  nes_ppu_draw_lines(ppu, 0, 240);
+}
+
+// hands drawing the visible lines over to someone else, e.g. a pool of
+// worker threads; line_done gets called on the emulation thread as soon as
+// line y is logged, after which nes_ppu_draw_lines can draw it, and sync
+// gets called at vblank and has to wait until those calls are done
+// pass NULL line_done to go back to drawing right away
+// returns 0 on success
+int nes_ppu_defer(nes_ppu_t *ppu, nes_ppu_line_func_t line_done,
+                  nes_ppu_sync_func_t sync, void *ctx) {
+  if (ppu->lines) {
+    if (ppu->line) nes_ppu_line_flush(ppu);
+    nes_ppu_sync_lines(ppu);
+    free(ppu->lines);
+    ppu->lines = NULL;
+  }
+
+  if (!line_done)
+    return 0;
+
+  ppu->lines = calloc(240, sizeof(nes_ppu_line_t));
+  if (!ppu->lines)
+    return -1;
+  ppu->line_done = line_done;
+  ppu->sync = sync;
+  ppu->defer_ctx = ctx;
+  return 0;
 }
 
 // counts all kinds of shit: increments cycle, scanline and frame counters,
@@ -487,69 +1005,136 @@ static void nes_ppu_clock(nes_t *nes) {
   }
 }
 
-void nes_ppu_tick(nes_t *nes) {
+// one PPU dot; gets inlined into all dot functions below, with fetch
+// known at compile time
+static inline void nes_ppu_dot_step(nes_t *nes, const int fetch) {
   nes_ppu_clock(nes);
 
+  if (nes->ppu.cycle == 0)
+    nes->ppu.dots = nes_ppu_dots[nes_ppu_line_types[nes->ppu.scanline]];
+  uint16_t act = nes->ppu.dots[nes->ppu.cycle];
+  if (!act) return;
+
+  // nothing on a line's first dot renders, so the line event is still the
+  // first thing that happens on it
   int render =
     PPU_GET_MASK(NES_PPU_MASK_BG) || PPU_GET_MASK(NES_PPU_MASK_SPR);
-  int pre_line = nes->ppu.scanline == 261;
-  int vis_line = nes->ppu.scanline < 240;
-  int render_line = pre_line || vis_line;
-
-  int pre_cycle = nes->ppu.cycle >= 321 && nes->ppu.cycle <= 336;
-  int vis_cycle = nes->ppu.cycle >= 1 && nes->ppu.cycle <= 256;
-  int fetch_cycle = pre_cycle || vis_cycle;
 
   if (render) {
-    if (vis_line && vis_cycle)
+    if (act & NES_PPU_DOT_PIXEL)
       nes_ppu_render_pixel(nes);
 
-    if (render_line && fetch_cycle) {
+    if (act & NES_PPU_DOT_SHIFT) {
       nes->ppu.tile.data <<= 4;
-      switch (nes->ppu.cycle & 0x07) {
-        case 1: nes_ppu_fetch_nta(nes); break;
-        case 3: nes_ppu_fetch_attr(nes); break;
-        case 5: nes_ppu_fetch_tile(nes, 0); break;
-        case 7: nes_ppu_fetch_tile(nes, 1); break;
-        case 0: nes_ppu_store_tile(nes); break;
+      switch (act & NES_PPU_DOT_FETCH) {
+        case NES_PPU_DOT_NTA: nes_ppu_fetch_nta(nes, fetch); break;
+        case NES_PPU_DOT_ATTR: nes_ppu_fetch_attr(nes, fetch); break;
+        case NES_PPU_DOT_LO: nes_ppu_fetch_tile(nes, 0, fetch); break;
+        case NES_PPU_DOT_HI: nes_ppu_fetch_tile(nes, 1, fetch); break;
+        case NES_PPU_DOT_STORE:
+          nes_ppu_store_tile(nes);
+          nes_ppu_increment_x(nes);
+          if (nes->ppu.line && (act & NES_PPU_DOT_PIXEL))
+            nes->ppu.line->bg[nes->ppu.line->bg_count++] = nes->ppu.tile.data;
+          break;
       }
     }
+  } else if ((act & NES_PPU_DOT_PIXEL) && !PPU_NO_OUTPUT() &&
+             !nes->ppu.line) {
+    nes->ppu.target[nes->ppu.scanline * nes->ppu.target_pitch +
+                    nes->ppu.cycle - 1] = nes_ppu_get_color(nes, nes->vmem.pal[0x00]);
+  }
 
-    if (pre_line && nes->ppu.cycle >= 280 && nes->ppu.cycle <= 304)
-      nes_ppu_copy_y(nes);
+  if (!(act & NES_PPU_DOT_RARE)) return;
 
-    if (render_line) {
-      if (fetch_cycle && (nes->ppu.cycle  & 0x07) == 0)
-        nes_ppu_increment_x(nes);
-      if (nes->ppu.cycle == 256)
-        nes_ppu_increment_y(nes);
-      if (nes->ppu.cycle == 257)
-        nes_ppu_copy_x(nes);
-    }
+  if ((act & NES_PPU_DOT_LINE) && nes->ppu.lines && nes->ppu.scanline < 240)
+    nes_ppu_line_begin(nes);
+  if ((act & NES_PPU_DOT_LINE) &&
+      BITGET(nes->cart.mapper.funcs.events, NES_MAPPER_EVENT_LINE))
+    nes->cart.mapper.funcs.event(nes, NES_MAPPER_EVENT_LINE);
 
-    if (nes->ppu.cycle == 257) {
-      if (vis_line)
-        nes_ppu_process_sprites(nes);
-      else
-        nes->ppu.spr_count = 0;
-    }
-  } else if (vis_line && vis_cycle) {
-    nes->ppu.back->data[nes->ppu.scanline][nes->ppu.cycle - 1] =
-      nes_ppu_get_color(nes, nes->vmem.pal[0x00]);
-  }
-
-  if (nes->ppu.cycle == 1) {
-    if (nes->ppu.scanline == 241)
-      nes_ppu_set_vblank(nes);
-    if (pre_line) {
-      nes_ppu_clr_vblank(nes);
-      PPU_CLR_STATUS(NES_PPU_STATUS_SPRITE0);
-      PPU_CLR_STATUS(NES_PPU_STATUS_OVERFLOW);
-    }
+  if (render) {
+    if (act & NES_PPU_DOT_COPY_Y) nes_ppu_copy_y(nes);
+    if (act & NES_PPU_DOT_INC_Y) nes_ppu_increment_y(nes);
+    if (act & NES_PPU_DOT_COPY_X) nes_ppu_copy_x(nes);
+    if (act & NES_PPU_DOT_SPRITES) nes_ppu_process_sprites(nes, fetch);
+    if (act & NES_PPU_DOT_SPR_CLEAR) nes->ppu.spr_count = 0;
+    if (act & NES_PPU_DOT_SPR_BUS) nes_ppu_spr_bus(nes);
+  }
+
+  if ((act & NES_PPU_DOT_LINE_END) && nes->ppu.lines)
+    nes_ppu_line_end(nes);
+
+  if (act & NES_PPU_DOT_VBL_SET) {
+    if (nes->ppu.lines) nes_ppu_sync_lines(&nes->ppu);
+    nes_ppu_set_vblank(nes);
+  }
+  if (act & NES_PPU_DOT_VBL_CLR) {
+    nes_ppu_clr_vblank(nes);
+    PPU_CLR_STATUS(NES_PPU_STATUS_SPRITE0);
+    PPU_CLR_STATUS(NES_PPU_STATUS_OVERFLOW);
   }
 }
 
+void nes_ppu_tick(nes_t *nes) {
+  nes_ppu_dot_step(nes, NES_PPU_FETCH_VREAD);
+}
+
+// same, but rendering fetches go through the mapper's fetch hooks
+void nes_ppu_tick_hooked(nes_t *nes) {
+  nes_ppu_dot_step(nes, NES_PPU_FETCH_HOOKED);
+}
+
+// same, but pattern fetches skip the mapper (see nes_run.h)
+void nes_ppu_tick_chr(nes_t *nes) {
+  nes_ppu_dot_step(nes, NES_PPU_FETCH_CHR);
+}
+
+static uint8_t nes_ppu_nt_fetch(nes_t *nes, uint16_t addr) {
+  return nes_nt_read(nes, addr);
+}
+
+// picks the dot function for the loaded mapper; call after mapper init
+// mappers with fetch hooks get the hooked one, any hooks they leave out
+// fall back to the plain fetches
+void nes_ppu_attach(nes_t *nes) {
+  nes_mapper_funcs_t *funcs = &nes->cart.mapper.funcs;
+
+  if (!funcs->nt_fetch && !funcs->at_fetch &&
+      !funcs->bg_fetch && !funcs->spr_fetch) {
+    nes->ppu.tick = nes_ppu_tick;
+    return;
+  }
+
+  if (!funcs->nt_fetch) funcs->nt_fetch = nes_ppu_nt_fetch;
+  if (!funcs->at_fetch) funcs->at_fetch = nes_ppu_nt_fetch;
+  if (!funcs->bg_fetch) funcs->bg_fetch = funcs->vread;
+  if (!funcs->spr_fetch) funcs->spr_fetch = funcs->vread;
+  nes->ppu.tick = nes_ppu_tick_hooked;
+}
+
+// sets up a clone's PPU, which holds a plain copy of src's
+// the clone gets its own frame buffers and draws right away into the back
+// one; since they don't hold src's last frame, the next one is drawn in
+// full, and the lines of the frame under way that src had drawn already
+// stay blank
+// returns 0 on success, -1 if out of memory
+int nes_ppu_clone(nes_ppu_t *ppu, const nes_ppu_t *src) {
+  ppu->front = nes_ppu_alloc_screen();
+  ppu->back = nes_ppu_alloc_screen();
+  ppu->lines = NULL;
+  ppu->line = NULL;
+  ppu->line_done = NULL;
+  ppu->sync = NULL;
+  ppu->defer_ctx = NULL;
+  ppu->flags = BITCLR(ppu->flags, NES_PPU_FLAG_SAME);
+  ppu->flags = BITCLR(ppu->flags, NES_PPU_FLAG_SKIP);
+  nes_ppu_set_target(ppu, NULL, 0);
+  return (ppu->front && ppu->back) ? 0 : -1;
+}
+
 void nes_ppu_cleanup(nes_ppu_t *ppu) {
-  if (ppu->back) free(ppu->back);
-  if (ppu->front) free(ppu->front);
+  nes_ppu_free_screen(ppu->back);
+  nes_ppu_free_screen(ppu->front);
+  if (ppu->lines) free(ppu->lines);
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "nes_structs.h"
+#include "bitops.h"
+
 // NOTE: all of these enums are bit indices, not masks
 
 // PPU internal state flags
@@ -8,6 +11,20 @@ enum nes_ppu_flags {
   NES_PPU_FLAG_OFFSET, // 1 when PPU is waiting for the second data write
   NES_PPU_FLAG_RENDER, // 1 when a frame is ready to be displayed
   NES_PPU_FLAG_NMI,    // set after NMI was requested by the tick function
+  NES_PPU_FLAG_SAME,   // 1 while nothing changed since the last frame
+  NES_PPU_FLAG_SKIP,   // 1 while pixel output is skipped (nothing changed)
+  NES_PPU_FLAG_REPEAT, // 1 when the ready frame is the same as the last one
+  NES_PPU_FLAG_BLIND,  // 1 while pixel output is off (see nes_ppu_set_blind)
+};
+
+// kinds of PPU-visible state changes that make the next frame differ
+enum nes_ppu_dirty {
+  NES_PPU_DIRTY_VRAM,   // nametable data or mirroring
+  NES_PPU_DIRTY_PAL,    // palette data
+  NES_PPU_DIRTY_OAM,    // sprite data
+  NES_PPU_DIRTY_CHR,    // pattern data or CHR banks
+  NES_PPU_DIRTY_SCROLL, // scroll/address registers
+  NES_PPU_DIRTY_REGS,   // PPUCTRL/PPUMASK
 };
 
 // PPUCTRL ($2000) register bits
@@ -39,13 +56,34 @@ enum nes_ppu_status {
   NES_PPU_STATUS_VBLANK   = 7, // set during vblank
 };
 
+// how many dots A12 has to stay low before a rise counts as an edge
+// (MMC3 filters out the short drops between background fetches)
+#define NES_PPU_A12_FILTER 10
+
 // standard NES palette in ARGB8888
 extern const uint32_t nes_palette[64];
 
 void nes_ppu_init(nes_ppu_t *ppu);
 void nes_ppu_reset(nes_ppu_t *ppu);
 void nes_ppu_cleanup(nes_ppu_t *ppu);
+int nes_ppu_clone(nes_ppu_t *ppu, const nes_ppu_t *src);
 void nes_ppu_tick(nes_t *nes);
+void nes_ppu_tick_hooked(nes_t *nes);
+void nes_ppu_tick_chr(nes_t *nes);
+void nes_ppu_attach(nes_t *nes);
 void nes_ppu_write(nes_t *nes, uint16_t addr, uint8_t val);
 void nes_ppu_oamdma(nes_t *nes, uint8_t addr);
 uint8_t nes_ppu_read(nes_t *nes, uint16_t addr);
+void nes_ppu_resume(nes_t *nes);
+void nes_ppu_set_target(nes_ppu_t *ppu, void *pixels, int pitch);
+void nes_ppu_set_blind(nes_ppu_t *ppu, int on);
+int nes_ppu_defer(nes_ppu_t *ppu, nes_ppu_line_func_t line_done,
+                  nes_ppu_sync_func_t sync, void *ctx);
+void nes_ppu_draw_lines(nes_ppu_t *ppu, int first, int count);
+
+// marks PPU-visible state as changed, so the current frame gets drawn
+static inline void nes_ppu_mark_dirty(nes_t *nes, int what) {
+  nes->ppu.dirty = BITSET(nes->ppu.dirty, what);
+  if (BITGET(nes->ppu.flags, NES_PPU_FLAG_SAME))
+    nes_ppu_resume(nes);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ROM properties, taken from the header and corrected by the database
+typedef struct {
+  uint16_t mapper; // mapper number
+  uint8_t submapper; // NES 2.0 submapper number
+  uint8_t mirroring; // hardwired mirroring (enum mirror_mode)
+  uint8_t battery; // 1 if PRG-RAM is battery-backed
+  uint8_t nes2; // 1 if the header is NES 2.0
+  uint32_t prg_size; // PRG-ROM size in bytes
+  uint32_t chr_size; // CHR-ROM size in bytes (0 if the cart has CHR-RAM)
+  uint32_t prgram_size; // PRG-RAM size in bytes (volatile + battery-backed)
+  uint32_t chrram_size; // CHR-RAM size in bytes
+  uint8_t no_idle; // 1 if idle loops must not be skipped for this ROM
+} nes_rom_info_t;
+
+// database entry, matched by the CRC32 of everything after the header
+// and trainer (PRG-ROM followed by CHR-ROM)
+typedef struct {
+  uint32_t crc;
+  nes_rom_info_t info;
+} nes_romdb_entry_t;
+
+uint32_t nes_romdb_crc32(uint32_t crc, const uint8_t *data, size_t len);
+const nes_romdb_entry_t *nes_romdb_find(uint32_t crc);
+int nes_romdb_load(const char *fname);
+void nes_romdb_free(void);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "nes_structs.h"
+
+// mapper-specialized main loops
+// nes_cpu_run() goes through the mapper's read/write functions on every
+// access and calls the PPU through a pointer on every dot; for the mappers
+// below there's a copy of the whole loop built with the mapper's bus
+// functions bound at compile time, picked by nes_cart_load()
+// only mappers without fetch hooks whose vread reads nothing but the CHR
+// pages below $2000 can go here, the loops fetch patterns straight from them
+
+// name (as in the mapper's function names), mapper number
+#define NES_RUN_MAPPERS(X) \
+  X(nrom, 0) \
+  X(mmc1, 1) \
+  X(unrom, 2) \
+  X(cnrom, 3) \
+  X(mmc3, 4) \
+  X(axrom, 7)
+
+#define NES_RUN_DECL(name, id) \
+  uint8_t nes_cpu_run_##name(nes_t *nes, uint32_t budget);
+NES_RUN_MAPPERS(NES_RUN_DECL)
+#undef NES_RUN_DECL
+
+// returns the main loop built for the given mapper, NULL if there's none
+static inline nes_run_func_t nes_run_get(uint16_t mapper_id) {
+#define NES_RUN_CASE(name, id) case id: return nes_cpu_run_##name;
+  switch (mapper_id) {
+    NES_RUN_MAPPERS(NES_RUN_CASE)
+  }
+#undef NES_RUN_CASE
+
+  return NULL;
+}
+
+// a loop is built by a file in src/run/ that defines NES_RUN_MAPPER to the
+// mapper's name before including anything, then includes the mapper's
+// header and this one
+#ifdef NES_RUN_MAPPER
+
+#include "nes.h"
+
+uint8_t NES_RUN_FUNC(nes_cpu_run_)(nes_t *nes, uint32_t budget) {
+  return nes_cpu_run_loop(nes, budget, NULL, nes_ppu_tick_chr);
+}
+
+#endif
@@ -1,11 +1,45 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
+typedef struct nes nes_t;
+typedef struct nes_apu_queue nes_apu_queue_t;
+
+#define NES_CPU_IDLE_MAX_OPS 8 // longest idle loop that gets detected
+
+// instruction of a detected idle loop
+typedef struct {
+  uint16_t pc; // address of the instruction
+  uint16_t addr; // address it reads (if it does)
+  uint8_t read; // what it reads (enum nes_cpu_idle_read)
+  uint8_t cycles; // cycles it takes
+  uint8_t val; // value read on the recorded pass
+} nes_cpu_idle_op_t;
+
+// idle loop detection state, see nes_cpu_idle_detect()
+typedef struct {
+  uint8_t allowed; // 0 if turned off from the command line
+  uint8_t enabled; // 0 if turned off for the loaded ROM
+  uint8_t state; // enum nes_cpu_idle_state
+
+  nes_cpu_idle_op_t ops[NES_CPU_IDLE_MAX_OPS];
+  uint8_t count; // number of instructions in the loop
+  uint8_t cur; // instruction about to run
+
+  uint8_t a, x, y, p, s; // registers at the top of the loop
+
+  uint16_t reject_head; // last loop that didn't qualify, not decoded again
+  uint16_t reject_tail;
+
+  uint64_t skipped; // CPU cycles of instructions that were skipped
+} nes_cpu_idle_t;
+
 // CPU state struct
 typedef struct {
   uint64_t cycle; // cycle counter
   uint64_t stall; // stall cycle counter ("wait for this many cycles")
+  uint32_t dma_oam; // stall cycles left until a running OAM DMA is done
   uint8_t pages_crossed; // >0 when a page boundary was crossed on last rw op
 
   // registers
@@ -15,6 +49,15 @@ typedef struct {
   uint8_t y; // index register
   uint8_t s; // stack pointer
   uint8_t p; // flags
+#ifdef NES_CPU_LAZY_FLAGS
+  // N, Z, C and V as left by the last op, p only holds the others
+  uint8_t flag_n; // N is bit 7 of the last result
+  uint8_t flag_z; // Z is set when the last result is 0
+  uint8_t flag_c; // 1 if C is set
+  uint8_t flag_v; // 1 if V is set
+#endif
+
+  nes_cpu_idle_t idle;
 } nes_cpu_t;
 
 // APU square channel state struct
@@ -96,6 +139,9 @@ typedef struct {
 // APU state struct
 typedef struct {
   uint64_t cycle; // cycle counter
+  uint64_t tmr_cycle; // cycle the channel timers were last run up to
+  uint64_t frame_next; // cycle of the next frame counter step
+  uint64_t sample_next; // cycle of the next output sample
 
   // channels
   nes_apu_sqr_t sq1;
@@ -112,13 +158,22 @@ typedef struct {
   uint8_t *buf;
   uint32_t buf_size;
   uint32_t max_buf_size;
+  uint8_t mute; // 1 if no sound is made at all (see nes_apu_mute)
+
+  // writes for the synthesis thread (nes_apu.c), NULL when samples are
+  // made right here
+  nes_apu_queue_t *queue;
 } nes_apu_t;
 
 // RAM/ROM state struct
 typedef struct {
   uint8_t ram[0x800]; // RAM
-  uint8_t prgram[0x2000]; // PRG-RAM
-  uint8_t *prg[2]; // current PRG-ROM banks
+  uint8_t *prgram; // PRG-RAM (NULL if the cart has none)
+  uint32_t prgram_size; // PRG-RAM size
+  uint8_t *prg[4]; // 8k PRG-ROM pages at $8000-$FFFF (NULL if unmapped)
+  uint8_t *wram; // PRG-RAM as mapped at $6000-$7FFF (NULL if unmapped)
+  uint16_t wram_mask; // address mask for wram (smaller PRG-RAM is mirrored)
+  uint8_t wram_dirty; // 1 if PRG-RAM was written since the last save snapshot
 } nes_mem_t;
 
 // PPU tile data
@@ -136,6 +191,7 @@ typedef struct {
   uint8_t pos;
   uint8_t pri;
   uint8_t idx;
+  uint8_t a12; // 1 if the sprite comes from the $1000 pattern table
 } nes_ppu_spr_t;
 
 // frame buffer
@@ -143,11 +199,44 @@ typedef struct {
   uint32_t data[240][256];
 } nes_ppu_screen_t;
 
+#define NES_PPU_LINE_EVENTS 16 // mid-line changes a logged line can hold
+
+// mid-line change to something that affects how pixels are composed
+typedef struct {
+  uint8_t x; // first pixel it applies to
+  uint8_t what; // nes_ppu_event
+  uint8_t idx; // palette index (palette writes only)
+  uint8_t val; // new value
+} nes_ppu_event_t;
+
+// a visible line logged for deferred drawing: its background pixels as
+// fetched, and whatever composing them with the sprites needs
+typedef struct {
+  uint32_t *row; // where the line goes (NULL if there's nothing to draw)
+  uint32_t bg[34]; // background pixels, 8 per word, starting with the two
+                   // tiles fetched at the end of the line before
+  uint8_t bg_count; // words in bg so far
+  nes_ppu_spr_t spr[8]; // sprites on the line
+  uint8_t spr_count;
+  uint8_t pal[0x20]; // palette at the start of the line
+  uint8_t mask; // PPUMASK at the start of the line
+  uint8_t fine_x; // fine x scroll at the start of the line
+  uint8_t render; // 1 if rendering was on at the start of the line
+  uint8_t skip; // 1 if output was skipped at the start of the line
+  uint8_t ev_count;
+  nes_ppu_event_t ev[NES_PPU_LINE_EVENTS];
+} nes_ppu_line_t;
+
+// deferred drawing callbacks (see nes_ppu_defer)
+typedef void (*nes_ppu_line_func_t)(void *ctx, int y);
+typedef void (*nes_ppu_sync_func_t)(void *ctx);
+
 // PPU state struct
 typedef struct {
   int32_t cycle; // cycle counter
   uint32_t frame; // frame counter
   int32_t scanline; // scanline counter
+  const uint16_t *dots; // dot program for the current line
   uint8_t flags; // state flags
 
   uint8_t ctrl; // PPUCTRL
@@ -166,6 +255,10 @@ typedef struct {
   uint32_t nmi_delay; // cycles before NMI
   uint8_t nmi_prev; // previous NMI state
   uint8_t frame_end; // frame end flag
+  uint8_t dirty; // state changes since last vblank (nes_ppu_dirty bits)
+
+  uint8_t a12; // last level seen on PPU address line A12
+  uint32_t a12_fall; // dot at which A12 last went low
 
   uint32_t spr_count; // sprite count
   nes_ppu_tile_t tile; // current tile data
@@ -174,6 +267,20 @@ typedef struct {
   // frame buffers
   nes_ppu_screen_t *front;
   nes_ppu_screen_t *back;
+
+  // where pixels are drawn: the back buffer or an external buffer
+  uint32_t *target;
+  uint32_t target_pitch; // row length in pixels
+  uint8_t target_ext; // 1 if target is an external buffer
+
+  // deferred drawing (see nes_ppu_defer)
+  nes_ppu_line_t *lines; // visible line logs (NULL when drawing right away)
+  nes_ppu_line_t *line; // log of the current line (NULL while not logging)
+  nes_ppu_line_func_t line_done; // called when a line's log is complete
+  nes_ppu_sync_func_t sync; // waits until all logged lines are drawn
+  void *defer_ctx; // passed to both
+
+  void (*tick)(nes_t *nes); // dot function, picked for the mapper at load
 } nes_ppu_t;
 
 // VRAM state struct
@@ -181,6 +288,7 @@ typedef struct {
   uint8_t vram[0x1000]; // nametable data
   uint8_t oam[0x100]; // OAM data
   uint8_t pal[0x20]; // current palette
+  uint8_t *chr[8]; // 1k CHR pages at $0000-$1FFF (NULL if unmapped)
 } nes_vmem_t;
 
 // input device state struct
@@ -203,51 +311,101 @@ typedef struct {
   uint8_t last_write; // last write to the input register
 } nes_input_t;
 
-typedef struct nes nes_t;
+// PPU events mappers can ask to be notified about
+// NOTE: these are bit indices, not masks
+enum nes_mapper_event {
+  NES_MAPPER_EVENT_A12,  // PPU address line A12 rose after being low a while
+  NES_MAPPER_EVENT_LINE, // a new scanline started (dot 0)
+};
 
 // mapper interface function types
 typedef void (*nes_map_init_func_t)(nes_t *nes);
 typedef void (*nes_map_cleanup_func_t)(nes_t *nes);
+typedef void (*nes_map_clone_func_t)(nes_t *nes, nes_t *src); // see nes_clone
 typedef void (*nes_map_tick_func_t)(nes_t *nes); // called after each PPU tick
+typedef void (*nes_map_event_func_t)(nes_t *nes, uint8_t ev); // PPU event
+typedef void (*nes_map_fetch_func_t)(nes_t *nes, uint16_t addr); // PPU fetch
+typedef float (*nes_map_audio_func_t)(nes_t *nes); // expansion audio output
 typedef uint8_t (*nes_read_func_t)(nes_t *nes, uint16_t addr);
 typedef void (*nes_write_func_t)(nes_t *nes, uint16_t addr, uint8_t value);
+typedef uint8_t (*nes_run_func_t)(nes_t *nes, uint32_t budget); // main loop
 
 // mapper interface struct
 typedef struct {
   nes_map_init_func_t init; // init function pointer
   nes_map_cleanup_func_t cleanup; // cleanup function pointer
+  nes_map_clone_func_t clone; // copies extra data from another machine
+                              // (NULL if the mapper has none)
   nes_map_tick_func_t tick; // tick function pointer (can be NULL)
+  nes_map_event_func_t event; // PPU event function pointer (can be NULL)
+  uint8_t events; // nes_mapper_event bits the event function wants
+  nes_map_tick_func_t timer; // called between instructions once the APU
+                             // cycle reaches mapper.timer_at (can be NULL
+                             // if the mapper never sets it)
+  nes_map_fetch_func_t fetch; // pattern fetch hook, gets the address of
+                              // each high bitplane byte (can be NULL)
+  nes_map_audio_func_t audio; // expansion audio, called for each output
+                              // sample, mixed with the APU (can be NULL)
 
   nes_read_func_t read; // CPU memory read function
   nes_write_func_t write; // CPU memory write function
 
   nes_read_func_t vread; // PPU memory read function
   nes_write_func_t vwrite; // PPU memory write function
+
+  // rendering fetch hooks (can be NULL); if a mapper sets any of them, the
+  // PPU runs a separate dot function that goes through all four, so other
+  // mappers don't pay for them
+  nes_read_func_t nt_fetch; // nametable byte fetch
+  nes_read_func_t at_fetch; // attribute byte fetch
+  nes_read_func_t bg_fetch; // background pattern fetch
+  nes_read_func_t spr_fetch; // sprite pattern fetch
 } nes_mapper_funcs_t;
 
 // mapper state struct
 typedef struct {
   nes_mapper_funcs_t funcs; // mapper interface
+  nes_run_func_t run; // main loop specialized for the mapper (can be NULL)
+  uint64_t timer_at; // APU cycle the timer function is due on
+                     // (NES_MAPPER_TIMER_OFF if none)
 
   void *extra; // extra mapper data (allocated and handled by mapper)
 } nes_mapper_t;
 
-// screen mirroring function type
-// accepts PPU address, returns mirrored address
-typedef uint16_t (*nes_mirror_func_t)(uint16_t addr);
-
 // cartridge struct
 typedef struct {
   nes_mapper_t mapper;
-  nes_mirror_func_t mirror;
 
+  uint8_t *nt[4]; // 1k nametable pages at $2000/$2400/$2800/$2C00
+  uint8_t mirroring; // current mirroring mode (enum mirror_mode)
+
+  uint16_t mapper_id; // mapper number
+  uint8_t submapper; // NES 2.0 submapper number
+  uint8_t battery; // 1 if PRG-RAM is battery-backed
+  char *sav_fname; // battery save file name (NULL if there's nothing to save)
+  uint32_t crc; // CRC32 of PRG-ROM and CHR-ROM
   uint8_t chr_ram; // if 1, CHR-RAM is present
 
-  uint8_t rom16_count; // 16k PRG-ROM bank count
-  uint8_t **rom; // array of 16k PRG-ROM banks
+  // the whole ROM image lives in one arena
+  uint8_t *image; // arena start
+  size_t image_size; // arena size
+  uint8_t image_mapped; // 1 if the arena is mmap'd, 0 if malloc'd
+  uint32_t *image_users; // machines sharing the arena (see nes_clone), NULL
+                         // while there's only this one
+
+  // CHR-RAM and PRG-RAM live in another one
+  uint8_t *ram; // cartridge RAM start
+  size_t ram_size; // cartridge RAM size
+  uint8_t ram_mapped; // 1 if cartridge RAM is mmap'd, 0 if malloc'd
+
+  uint8_t *prg; // PRG-ROM data in the arena
+  uint8_t *chr; // CHR-ROM/RAM data in the arena
+
+  uint16_t rom16_count; // 16k PRG-ROM bank count
+  uint8_t **rom; // array of 16k PRG-ROM banks (pointers into prg)
 
-  uint8_t vram8_count; // 8k CHR bank count
-  uint8_t **vram; // array of 8k CHR banks
+  uint16_t vram8_count; // 8k CHR bank count
+  uint8_t **vram; // array of 8k CHR banks (pointers into chr)
 } nes_cart_t;
 
 // NES state struct
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+
+#include "pacer.h"
+
+// returns the frame period in ticks, rounded down
+static inline uint64_t pacer_period(pacer_t *pacer) {
+  return pacer->period_num / pacer->period_den;
+}
+
+// moves the deadline one frame period forward, keeping the remainder
+static inline void pacer_advance(pacer_t *pacer) {
+  uint64_t t = pacer->period_num + pacer->rem;
+  pacer->deadline += t / pacer->period_den;
+  pacer->rem = t % pacer->period_den;
+}
+
+// with sync enabled, paces to the display refresh rate instead of the NES
+// one if they're close enough, so every frame lands on its own refresh
+static inline void pacer_sync(pacer_t *pacer) {
+  int hz = sdl_get_refresh_rate(pacer->sdl);
+  double nes_hz = (double)PACER_NES_PERIOD_DEN / PACER_NES_PERIOD_NUM;
+
+  double diff = (hz > nes_hz) ? hz - nes_hz : nes_hz - hz;
+
+  if (hz <= 0 || diff / nes_hz > PACER_SYNC_TOLERANCE)
+    return;
+
+  pacer->period_num = pacer->freq;
+  pacer->period_den = hz;
+  fprintf(stdout, "Pacing synced to %d Hz display\n", hz);
+}
+
+void pacer_init(pacer_t *pacer, sdl_man_t *sdl, int mode, int sync) {
+  pacer->sdl = sdl;
+  pacer->mode = mode;
+  pacer->freq = sdl_get_counter_freq(sdl);
+  pacer->period_num = pacer->freq * PACER_NES_PERIOD_NUM;
+  pacer->period_den = PACER_NES_PERIOD_DEN;
+  pacer->spin = pacer->freq * PACER_SPIN_US / 1000000;
+  pacer->hist_count = 0;
+
+  if (sync)
+    pacer_sync(pacer);
+
+  pacer->rem = 0;
+  pacer->last = sdl_get_counter(sdl);
+  pacer->deadline = pacer->last;
+  pacer_advance(pacer);
+}
+
+// waits until the current frame's deadline and moves on to the next one
+void pacer_wait(pacer_t *pacer) {
+  uint64_t now = sdl_get_counter(pacer->sdl);
+  uint64_t period = pacer_period(pacer);
+
+  if (now < pacer->deadline) {
+    uint64_t left = pacer->deadline - now;
+    if (pacer->mode == PACER_MODE_HYBRID)
+      left = (left > pacer->spin) ? left - pacer->spin : 0;
+
+    uint32_t ms = left * 1000 / pacer->freq;
+    if (ms > 0)
+      sdl_sleep(pacer->sdl, ms);
+
+    if (pacer->mode == PACER_MODE_HYBRID)
+      while ((now = sdl_get_counter(pacer->sdl)) < pacer->deadline) {}
+    else
+      now = sdl_get_counter(pacer->sdl);
+  }
+
+  pacer->hist[pacer->hist_count % PACER_HIST_SIZE] =
+    (now - pacer->last) * 1000000 / pacer->freq;
+  pacer->hist_count++;
+  pacer->last = now;
+
+  // don't try to catch up after a long stall, just start over
+  if (now > pacer->deadline + period * PACER_RESYNC_FRAMES) {
+    pacer->deadline = now;
+    pacer->rem = 0;
+  }
+
+  pacer_advance(pacer);
+}
+
+static int pacer_cmp(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// prints frame time and jitter (deviation from the period) percentiles
+// over the last PACER_HIST_SIZE frames
+void pacer_report(pacer_t *pacer, FILE *stream) {
+  static uint32_t times[PACER_HIST_SIZE];
+  static uint32_t jitter[PACER_HIST_SIZE];
+  static const int pct[] = {50, 90, 99, 100};
+
+  uint32_t n = pacer->hist_count;
+  if (n > PACER_HIST_SIZE) n = PACER_HIST_SIZE;
+  if (n < 2) return;
+
+  // the first sample includes startup, skip it if it's still in the history
+  uint32_t first = (pacer->hist_count > PACER_HIST_SIZE) ? 0 : 1;
+  uint32_t period_us = pacer_period(pacer) * 1000000 / pacer->freq;
+
+  n -= first;
+  for (uint32_t i = 0; i < n; ++i) {
+    times[i] = pacer->hist[i + first];
+    jitter[i] = abs((int32_t)times[i] - (int32_t)period_us);
+  }
+
+  qsort(times, n, sizeof(times[0]), pacer_cmp);
+  qsort(jitter, n, sizeof(jitter[0]), pacer_cmp);
+
+  fprintf(stream, "Frame pacing over %u frames (target %u us):\n", n,
+          period_us);
+  for (int i = 0; i < sizeof(pct) / sizeof(pct[0]); ++i) {
+    uint32_t idx = (n - 1) * pct[i] / 100;
+    fprintf(stream, "  p%-3d frame time %6u us, jitter %6u us\n", pct[i],
+            times[idx], jitter[idx]);
+  }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "sdl_manager.h"
+
+// NTSC NES frame period is 29780.5 CPU cycles at 1789773 Hz (~60.0988 Hz),
+// kept as a fraction so deadlines don't drift
+#define PACER_NES_PERIOD_NUM 59561
+#define PACER_NES_PERIOD_DEN 3579546
+
+#define PACER_SPIN_US 2000 // hybrid mode spins for the last 2 ms
+#define PACER_RESYNC_FRAMES 4 // deadline resets if we are this late
+#define PACER_SYNC_TOLERANCE 0.015 // max refresh rate mismatch for sync
+#define PACER_HIST_SIZE 1024 // frame time samples kept for stats
+
+// pacing modes
+enum pacer_mode {
+  PACER_MODE_SLEEP,  // sleep only (cheap, ~1 ms precision)
+  PACER_MODE_HYBRID, // sleep, then spin on the counter until the deadline
+};
+
+// frame pacer state
+typedef struct {
+  sdl_man_t *sdl;
+  uint8_t mode; // pacing mode
+
+  uint64_t freq; // counter ticks per second
+  uint64_t period_num; // frame period is period_num / period_den ticks
+  uint64_t period_den;
+  uint64_t rem; // accumulated fractional part of the deadline
+  uint64_t deadline; // counter value the current frame should end at
+  uint64_t spin; // spin time in ticks
+  uint64_t last; // counter value at the end of the last frame
+
+  uint32_t hist[PACER_HIST_SIZE]; // frame times in microseconds
+  uint32_t hist_count; // samples taken so far
+} pacer_t;
+
+void pacer_init(pacer_t *pacer, sdl_man_t *sdl, int mode, int sync);
+void pacer_wait(pacer_t *pacer);
+void pacer_report(pacer_t *pacer, FILE *stream);
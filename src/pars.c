@@ -3,6 +3,7 @@
 #include "error.h"
 #include "errcodes.h"
 #include "pars.h"
+#include "pacer.h"
 
 static inline void pars_set_default(pars_t *pars) {
   pars->rom_fname = NULL;
@@ -11,6 +12,17 @@ static inline void pars_set_default(pars_t *pars) {
   pars->res_factor_h = 1;
 
   pars->run_frames = 0;
+
+  pars->direct = 0;
+  pars->threaded = 0;
+
+  pars->pacing = PACER_MODE_HYBRID;
+  pars->sync = 0;
+  pars->no_idle = 0;
+  pars->apu_thread = 0;
+  pars->render_threads = 0;
+  pars->romdb_fname = NULL;
+  pars->hash = 0;
 }
 
 static inline void pars_check(pars_t *pars) {
@@ -33,6 +45,15 @@ static inline void pars_check(pars_t *pars) {
     error_log_write("Incorrect height resolution factor");
     return;
   }
+
+  // frames are hashed on the emulation thread, from the frame buffer
+  if (pars->hash && (pars->direct || pars->render_threads ||
+                     (pars->threaded && !pars->run_frames))) {
+    error_set_code(ERR_ARGS);
+    error_log_write("Parameter --hash can't be combined with -d, -r or -t "
+      "without -f");
+    return;
+  }
 }
 
 void pars_parse(pars_t *pars, int argc, char *argv[]) {
@@ -103,13 +124,104 @@ void pars_parse(pars_t *pars, int argc, char *argv[]) {
       return;
     }
 
+    if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--direct")) {
+      pars->direct = 1;
+      ++i;
+
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--threaded")) {
+      pars->threaded = 1;
+      ++i;
+
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-p") || !strcmp(argv[i], "--pacing")) {
+      if ((argc > i + 1) && !strcmp(argv[i + 1], "sleep")) {
+        pars->pacing = PACER_MODE_SLEEP;
+        i += 2;
+
+        continue;
+      }
+
+      if ((argc > i + 1) && !strcmp(argv[i + 1], "hybrid")) {
+        pars->pacing = PACER_MODE_HYBRID;
+        i += 2;
+
+        continue;
+      }
+
+      error_set_code(ERR_ARGS);
+      error_log_write("Parameter -p (--pacing) requires value sleep or "
+        "hybrid\n");
+      return;
+    }
+
+    if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--sync")) {
+      pars->sync = 1;
+      ++i;
+
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--no-idle")) {
+      pars->no_idle = 1;
+      ++i;
+
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-a") || !strcmp(argv[i], "--apu-thread")) {
+      pars->apu_thread = 1;
+      ++i;
+
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--render-threads")) {
+      if ((argc > i + 1) && sscanf(argv[i + 1], "%d", &temp_int) &&
+          temp_int >= 0 && temp_int <= PARS_RENDER_THREADS_MAX) {
+        pars->render_threads = temp_int;
+        i += 2;
+
+        continue;
+      }
+
+      error_set_code(ERR_ARGS);
+      error_log_write("Parameter -r (--render-threads) requires integer "
+        "value between 0 and 8\n");
+      return;
+    }
+
+    if (!strcmp(argv[i], "--hash")) {
+      pars->hash = 1;
+      ++i;
+
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--romdb")) {
+      if (argc > i + 1) {
+        pars->romdb_fname = argv[i + 1];
+        i += 2;
+
+        continue;
+      }
+
+      error_set_code(ERR_ARGS);
+      error_log_write("Parameter --romdb requires a file name\n");
+      return;
+    }
+
     if (pars->rom_fname != NULL) {
       error_set_code(ERR_ARGS);
       error_log_write("ROM file name is specified already\n");
       return;
     }
 
-    pars->rom_fname = argv[1];
+    pars->rom_fname = argv[i];
     ++i;
   }
 
@@ -5,6 +5,10 @@
 #define PARS_RES_FACTOR_MIN 1
 #define PARS_RES_FACTOR_MAX 5
 
+#define PARS_RENDER_THREADS_MAX 8
+
+#define PARS_ROMDB_DEFAULT "nes20db.xml" // tried if no --romdb is given
+
 typedef struct {
   char *rom_fname;
 
@@ -12,6 +16,18 @@ typedef struct {
   unsigned char res_factor_h;
 
   unsigned int run_frames;
+
+  unsigned char direct; // if 1, the PPU draws straight into SDL textures
+  unsigned char threaded; // if 1, emulation runs on a separate thread
+
+  unsigned char pacing; // frame pacing mode (see pacer_mode)
+  unsigned char sync; // if 1, pace to the display refresh rate if close
+  unsigned char no_idle; // if 1, idle loops are always run, not skipped
+  unsigned char apu_thread; // if 1, sound is synthesized on its own thread
+  unsigned char render_threads; // if > 0, PPU output is drawn on this many
+                                // threads (see nes_ppu_defer)
+  char *romdb_fname; // NES 2.0 XML database fixing up bad ROM headers
+  unsigned char hash; // if 1, a CRC32 of every frame is printed
 } pars_t;
 
 void pars_parse(pars_t *pars, int argc, char *argv[]);
\ No newline at end of file
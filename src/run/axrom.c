@@ -0,0 +1,5 @@
+// main loop specialized for AxROM
+#define NES_RUN_MAPPER axrom
+
+#include "../mappers/axrom.h"
+#include "../nes_run.h"
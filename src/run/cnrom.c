@@ -0,0 +1,5 @@
+// main loop specialized for CNROM
+#define NES_RUN_MAPPER cnrom
+
+#include "../mappers/cnrom.h"
+#include "../nes_run.h"
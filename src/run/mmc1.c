@@ -0,0 +1,5 @@
+// main loop specialized for MMC1
+#define NES_RUN_MAPPER mmc1
+
+#include "../mappers/mmc1.h"
+#include "../nes_run.h"
@@ -0,0 +1,5 @@
+// main loop specialized for MMC3
+#define NES_RUN_MAPPER mmc3
+
+#include "../mappers/mmc3.h"
+#include "../nes_run.h"
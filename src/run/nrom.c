@@ -0,0 +1,5 @@
+// main loop specialized for NROM
+#define NES_RUN_MAPPER nrom
+
+#include "../mappers/nrom.h"
+#include "../nes_run.h"
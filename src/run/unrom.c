@@ -0,0 +1,5 @@
+// main loop specialized for UNROM
+#define NES_RUN_MAPPER unrom
+
+#include "../mappers/unrom.h"
+#include "../nes_run.h"
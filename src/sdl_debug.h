@@ -4,6 +4,7 @@
 
 #include "error.h"
 #include "nes_structs.h"
+#include "nes_cpu.h"
 #include "bitops.h"
 
 static SDL_Window *sdl_debug_win;
@@ -90,8 +91,9 @@ static void sdl_debug_frame(nes_t *nes) {
   SDL_RenderClear(sdl_debug_ren);
   SDL_SetRenderDrawColor(sdl_debug_ren, 255, 255, 255, 255);
   char flags[9] = "NVssDIZC";
+  uint8_t p = nes_cpu_get_p(&nes->cpu);
   for (int i = 7; i >= 0; --i)
-    if (!BITGET(nes->cpu.p, i)) flags[i] = '-';
+    if (!BITGET(p, i)) flags[i] = '-';
   char bkgpal[33] = {0};
   char sprpal[33] = {0};
   for (int i = 0; i < 16; ++i) {
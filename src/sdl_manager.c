@@ -48,6 +48,23 @@ static inline void sdl_init_video(sdl_man_video_t *v, pars_t *pars) {
     error_log_write("Could not create texture\n");
     return;
   }
+
+  v->ring_idx = 0;
+  v->ring_locked = 0;
+  if (!pars->direct) return;
+
+  for (int i = 0; i < SDL_TEX_RING_SIZE; ++i) {
+    v->ring[i] = SDL_CreateTexture(v->ren,
+                                   SDL_PIXELFORMAT_ARGB8888,
+                                   SDL_TEXTUREACCESS_STREAMING,
+                                   256, 240);
+
+    if (!v->ring[i]) {
+      error_set_code(ERR_SDL_INIT);
+      error_log_write("Could not create texture ring\n");
+      return;
+    }
+  }
 }
 
 static inline void sdl_init_audio(sdl_man_audio_t *a, pars_t *pars) {
@@ -58,6 +75,9 @@ static inline void sdl_init_audio(sdl_man_audio_t *a, pars_t *pars) {
 }
 
 static inline void sdl_cleanup_video(sdl_man_video_t *v) {
+  if (v->ring_locked)
+    SDL_UnlockTexture(v->ring[v->ring_idx]);
+
   SDL_DestroyWindow(v->win);
 
   SDL_QuitSubSystem(SDL_INIT_VIDEO);
@@ -114,9 +134,29 @@ void sdl_open_audio(sdl_man_t *sdl, int sn, sdl_audio_callback_t fn, void *u) {
   SDL_PauseAudioDevice(dev, 0);
 }
 
+// the stream is also read by the audio callback, so the device is locked
 void sdl_mix_audio(sdl_man_t *sdl, uint8_t *buf, uint32_t buflen) {
   if (!sdl->a.open) return;
+  SDL_LockAudioDevice(sdl->a.dev);
   SDL_AudioStreamPut(sdl->a.stream, buf, buflen);
+  SDL_UnlockAudioDevice(sdl->a.dev);
+}
+
+// returns the amount of converted audio (in bytes) waiting to be played
+uint32_t sdl_get_queued_audio(sdl_man_t *sdl) {
+  if (!sdl->a.open) return 0;
+  SDL_LockAudioDevice(sdl->a.dev);
+  int res = SDL_AudioStreamAvailable(sdl->a.stream);
+  SDL_UnlockAudioDevice(sdl->a.dev);
+  return (res > 0) ? res : 0;
+}
+
+static inline void sdl_present(sdl_man_t *sdl) {
+  SDL_SetRenderDrawColor(sdl->v.ren, 255, 0, 0, 255);
+  SDL_RenderClear(sdl->v.ren);
+  SDL_SetRenderDrawColor(sdl->v.ren, 255, 255, 255, 255);
+  SDL_RenderCopyEx(sdl->v.ren, sdl->v.tex, NULL, NULL, 0, NULL, SDL_FLIP_NONE);
+  SDL_RenderPresent(sdl->v.ren);
 }
 
 void sdl_frame(sdl_man_t *sdl, uint32_t screen[240][256]) {
@@ -127,11 +167,37 @@ void sdl_frame(sdl_man_t *sdl, uint32_t screen[240][256]) {
   memcpy(raw_pixels, screen, pitch * 240);
   SDL_UnlockTexture(sdl->v.tex);
 
-  SDL_SetRenderDrawColor(sdl->v.ren, 255, 0, 0, 255);
-  SDL_RenderClear(sdl->v.ren);
-  SDL_SetRenderDrawColor(sdl->v.ren, 255, 255, 255, 255);
-  SDL_RenderCopyEx(sdl->v.ren, sdl->v.tex, NULL, NULL, 0, NULL, SDL_FLIP_NONE);
-  SDL_RenderPresent(sdl->v.ren);
+  sdl_present(sdl);
+}
+
+// presents the last uploaded frame again
+void sdl_frame_repeat(sdl_man_t *sdl) {
+  sdl_present(sdl);
+}
+
+// locks the next texture of the ring and returns its pixels, so a frame can
+// be drawn straight into it
+void *sdl_frame_begin(sdl_man_t *sdl, int *pitch) {
+  void *raw_pixels = NULL;
+  int next = (sdl->v.ring_idx + 1) % SDL_TEX_RING_SIZE;
+
+  if (SDL_LockTexture(sdl->v.ring[next], NULL, &raw_pixels, pitch) < 0)
+    return NULL;
+
+  sdl->v.ring_idx = next;
+  sdl->v.ring_locked = 1;
+  return raw_pixels;
+}
+
+// unlocks the texture locked by sdl_frame_begin and presents it
+void sdl_frame_end(sdl_man_t *sdl) {
+  if (!sdl->v.ring_locked) return;
+
+  SDL_UnlockTexture(sdl->v.ring[sdl->v.ring_idx]);
+  sdl->v.ring_locked = 0;
+  sdl->v.tex = sdl->v.ring[sdl->v.ring_idx];
+
+  sdl_present(sdl);
 }
 
 void sdl_sleep(sdl_man_t *sdl, uint32_t ms) {
@@ -142,6 +208,25 @@ uint32_t sdl_get_ticks(sdl_man_t *sdl) {
   return SDL_GetTicks();
 }
 
+uint64_t sdl_get_counter(sdl_man_t *sdl) {
+  return SDL_GetPerformanceCounter();
+}
+
+uint64_t sdl_get_counter_freq(sdl_man_t *sdl) {
+  return SDL_GetPerformanceFrequency();
+}
+
+// returns refresh rate of the display the window is on, 0 if unknown
+int sdl_get_refresh_rate(sdl_man_t *sdl) {
+  SDL_DisplayMode mode;
+  int idx = SDL_GetWindowDisplayIndex(sdl->v.win);
+
+  if (idx < 0 || SDL_GetCurrentDisplayMode(idx, &mode) < 0)
+    return 0;
+
+  return mode.refresh_rate;
+}
+
 void sdl_screenshot(sdl_man_t *sdl, const char *fname) {
   int w, h;
   SDL_GetRendererOutputSize(sdl->v.ren, &w, &h);
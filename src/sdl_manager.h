@@ -8,6 +8,8 @@
 #define WIN_WIDTH 256
 #define WIN_HEIGHT 240
 
+#define SDL_TEX_RING_SIZE 3 // textures used for direct rendering
+
 typedef void (*sdl_audio_callback_t)(void *, uint8_t *, int);
 typedef void (*sdl_event_callback_t)(SDL_Event *, void *);
 
@@ -15,6 +17,12 @@ typedef struct {
   SDL_Window *win;
   SDL_Texture *tex;
   SDL_Renderer *ren;
+
+  // texture ring for direct rendering: one is being drawn into while
+  // another one is shown, so locking never waits on the GPU
+  SDL_Texture *ring[SDL_TEX_RING_SIZE];
+  int ring_idx; // texture being drawn into (or last drawn into)
+  int ring_locked; // 1 while ring[ring_idx] is locked
 } sdl_man_video_t;
 
 typedef struct {
@@ -44,7 +52,13 @@ void sdl_cleanup(sdl_man_t *sdl);
 
 void sdl_sleep(sdl_man_t *sdl, uint32_t ms);
 void sdl_frame(sdl_man_t *sdl, uint32_t screen[240][256]);
+void sdl_frame_repeat(sdl_man_t *sdl);
+void *sdl_frame_begin(sdl_man_t *sdl, int *pitch);
+void sdl_frame_end(sdl_man_t *sdl);
 uint32_t sdl_get_ticks(sdl_man_t *sdl);
+uint64_t sdl_get_counter(sdl_man_t *sdl);
+uint64_t sdl_get_counter_freq(sdl_man_t *sdl);
+int sdl_get_refresh_rate(sdl_man_t *sdl);
 void sdl_screenshot(sdl_man_t *sdl, const char *fname);
 
 void sdl_set_event_callback(sdl_man_t *sdl, sdl_event_callback_t fn, void *ud);
@@ -54,3 +68,4 @@ void sdl_open_audio(sdl_man_t *sdl, int sn, sdl_audio_callback_t fn, void *ud);
 void sdl_pause_audio(sdl_man_t *sdl, int pause);
 void sdl_close_audio(sdl_man_t *sdl);
 void sdl_mix_audio(sdl_man_t *sdl, uint8_t *buf, uint32_t buflen);
+uint32_t sdl_get_queued_audio(sdl_man_t *sdl);
@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+
+# rebuilds 01_nestest.nes from expected/01_nestest_log.txt: every ROM byte the
+# trace executes or reads is put back in place, so the image runs the same
+# instruction stream as nestest's automated mode (entry at $C000) and the
+# log can be compared without shipping the original ROM
+# usage: mknestest.py [log] [rom]
+
+import re
+import sys
+
+log_fname = sys.argv[1] if len(sys.argv) > 1 else 'expected/01_nestest_log.txt'
+rom_fname = sys.argv[2] if len(sys.argv) > 2 else '01_nestest.nes'
+
+prg = bytearray(0x4000) # mapped at $C000, NROM-128
+
+def put(addr, val):
+    if addr < 0xC000:
+        return # RAM, the program writes it itself
+    if prg[addr - 0xC000] not in (0, val):
+        sys.exit('conflicting bytes at ${:04X}'.format(addr))
+    prg[addr - 0xC000] = val
+
+for line in open(log_fname):
+    m = re.match(r'([0-9A-F]{4})  ((?:[0-9A-F]{2} ){1,3})', line)
+    if not m:
+        continue
+    pc = int(m.group(1), 16)
+    for i, val in enumerate(bytes.fromhex(m.group(2))):
+        put(pc + i, val)
+    # operands read from ROM, "$addr = val" or "@ addr = val"
+    for addr, val in re.findall(r'(?:@ |\$)([0-9A-F]{4}) = ([0-9A-F]{2})', line):
+        put(int(addr, 16), int(val, 16))
+
+# the log starts after nestest's JMP $C5F5 at $C000
+prg[0x0000:0x0003] = bytes([0x4C, 0xF5, 0xC5])
+prg[0x3FFA:0x4000] = bytes([0x00, 0xC0, 0x00, 0xC0, 0x00, 0xC0])
+
+header = b'NES\x1a' + bytes([1, 1, 0, 0]) + bytes(8)
+with open(rom_fname, 'wb') as f:
+    f.write(header + prg + bytes(0x2000))
@@ -4,6 +4,7 @@ import os
 import sys
 import subprocess
 import filecmp
+import re
 
 def get_subdirs(dir):
     return [name for name in os.listdir(dir)
@@ -16,30 +17,90 @@ def get_inputs():
 
 root_dir = os.getcwd()
 bin_file = os.path.join(root_dir, 'bin', 'dndltr_d')
+# CPU trace builds, the packed and the lazy flag layout must log the same
+cpu_bin_files = [os.path.join(root_dir, 'bin', 'dndltr_cpud'),
+                 os.path.join(root_dir, 'bin', 'dndltr_cpud_lazy')]
+
+# trace lines are "PC  bytes  disassembly  registers"; the disassembly shows
+# what the emulator reads back from I/O registers, so only the PC, the bytes
+# and the registers are compared
+trace_line = re.compile(r'^([0-9A-F]{4}  .{9}).*(A:[0-9A-F]{2} .*)$')
+
+def get_trace(lines):
+    res = []
+    for line in lines:
+        m = trace_line.match(line.rstrip())
+        if m:
+            res.append(m.group(1) + m.group(2))
+    return res
 
 def setup_suite():
     pass
 
+def run_cpu_suite():
+    for rom in get_inputs():
+        path = os.path.join(os.getcwd(), rom)
+        with open(os.path.join('expected', rom.replace('.nes', '_log.txt'))) as f:
+            expected = get_trace(f)
+        for cpu_bin_file in cpu_bin_files:
+            name = os.path.basename(cpu_bin_file)
+            res = subprocess.run([cpu_bin_file, path, '-f', '2'],
+                                 stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                                 universal_newlines=True)
+            if res.returncode != 0:
+                print('  FAIL: Test', rom, 'failed on', name + ':', res.returncode)
+                return res.returncode
+            # the log may start past the entry point
+            trace = get_trace(res.stdout.splitlines())
+            start = next((i for i, line in enumerate(trace)
+                          if line[:4] == expected[0][:4]), 0)
+            trace = trace[start:start + len(expected)]
+            for i, line in enumerate(expected):
+                if i >= len(trace) or trace[i] != line:
+                    print('  FAIL: Test', rom, 'failed on', name + ':',
+                          'trace differs at line', i + 1)
+                    print('    expected:', line)
+                    print('    got:     ', trace[i] if i < len(trace) else 'nothing')
+                    return -1
+        print('  SUCCESS: Test', rom, 'passed')
+    return 0
+
 def run_suite():
-    with open(os.devnull, 'w') as FNULL:
-        for rom in get_inputs():
-            path = os.path.join(os.getcwd(), rom)
-            res = subprocess.call([bin_file, path, '-f', '100'], stdout=FNULL)
-            if res != 0:
-                print('  FAIL: Test', rom, 'failed:', res)
-                return res
-            if not filecmp.cmp('output.bmp', os.path.join('expected', rom.replace('.nes', '.bmp'))):
-                print('  FAIL: Test', rom, 'failed: output does not match expected')
+    if os.path.basename(os.getcwd()) == 'cpu':
+        return run_cpu_suite()
+    for rom in get_inputs():
+        path = os.path.join(os.getcwd(), rom)
+        res = subprocess.run([bin_file, path, '-f', '100', '--hash'],
+                             stdout=subprocess.PIPE, universal_newlines=True)
+        if res.returncode != 0:
+            print('  FAIL: Test', rom, 'failed:', res.returncode)
+            return res.returncode
+        if not filecmp.cmp('output.bmp', os.path.join('expected', rom.replace('.nes', '.bmp'))):
+            print('  FAIL: Test', rom, 'failed: output does not match expected')
+            return -1
+        # every frame has to match, not just the last one on screen
+        hashes = [line for line in res.stdout.splitlines()
+                  if line.startswith('frame ')]
+        with open(os.path.join('expected', rom.replace('.nes', '_hashes.txt'))) as f:
+            expected = f.read().splitlines()
+        for i, line in enumerate(expected):
+            if i >= len(hashes) or hashes[i] != line:
+                print('  FAIL: Test', rom, 'failed: frame hashes differ')
+                print('    expected:', line)
+                print('    got:     ', hashes[i] if i < len(hashes) else 'nothing')
                 return -1
-            print('  SUCCESS: Test', rom, 'passed')
+        print('  SUCCESS: Test', rom, 'passed')
     return 0
 
 def teardown_suite():
     if os.path.isfile('output.bmp'):
         os.remove('output.bmp')
 
+# suites to run can be given by name, all of them run otherwise
+suites = sys.argv[1:] or get_subdirs('tests')
+
 retcode = 0
-for dir in get_subdirs('tests'):
+for dir in suites:
     print('SUITE:', dir)
     os.chdir(os.path.join(root_dir, 'tests', dir))
     setup_suite()